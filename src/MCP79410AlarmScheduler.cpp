@@ -0,0 +1,383 @@
+#include "MCP79410AlarmScheduler.h"
+
+#include <algorithm>
+
+static Logger log("app.rtc");
+
+MCP79410AlarmScheduler::MCP79410AlarmScheduler(MCP79410 &rtc, int alarmNum) : rtc(rtc), alarmNum(alarmNum) {
+
+}
+
+MCP79410AlarmScheduler::~MCP79410AlarmScheduler() {
+
+}
+
+void MCP79410AlarmScheduler::setup() {
+	interruptMode = rtc.hasAlarmInterrupt();
+	if (interruptMode) {
+		rtc.withAlarmCallback(alarmNum, [this](int) {
+			alarmFired = true;
+		});
+	}
+
+	restore();
+
+	// A timer may have come due while the device was reset or in SLEEP_MODE_DEEP, and the flag may have
+	// already been cleared by MCP79410::setup(), so check the time until the alarm is set
+	timeCheck = true;
+
+	time_t now = rtc.getRTCTime();
+	if (now != 0) {
+		armAlarm(now);
+	}
+}
+
+void MCP79410AlarmScheduler::loop() {
+	if (heap.empty()) {
+		return;
+	}
+
+	bool fired = alarmFired;
+	alarmFired = false;
+	if (!fired) {
+		if (millis() - lastCheckMs < LOOP_CHECK_INTERVAL_MS) {
+			return;
+		}
+		lastCheckMs = millis();
+
+		if (!interruptMode && rtc.getInterrupt(alarmNum)) {
+			rtc.clearInterrupt(alarmNum);
+			fired = true;
+		}
+		else
+		if (!timeCheck) {
+			return;
+		}
+	}
+
+	time_t now = rtc.getRTCTime();
+	if (now == 0) {
+		// RTC is not valid
+		timeCheck = true;
+		return;
+	}
+
+	// Take the timers that are due off the heap first, and call the callbacks after the heap is consistent
+	// again, because callbacks can add or cancel timers
+	std::vector<Timer> due;
+	bool changed = false;
+	while(!heap.empty() && heap.front().deadline <= now) {
+		std::pop_heap(heap.begin(), heap.end(), heapCompare);
+		due.push_back(heap.back());
+
+		Timer &timer = heap.back();
+		if (timer.periodSec != 0) {
+			// Next multiple of the period after now, skipping any that were missed
+			timer.deadline += (time_t)timer.periodSec * ((now - timer.deadline) / (time_t)timer.periodSec + 1);
+			std::push_heap(heap.begin(), heap.end(), heapCompare);
+		}
+		else {
+			heap.pop_back();
+		}
+		changed = true;
+	}
+
+	if (changed || armedTime <= now) {
+		// Also arms it again after a step towards a deadline more than MAX_ARM_SECONDS away, or if it
+		// could not be armed before
+		armAlarm(now);
+	}
+	if (changed) {
+		persist();
+	}
+
+	// Keep checking the time if the alarm could not be set, or if it went off but nothing was due yet because
+	// the time read was slightly behind the RTC
+	timeCheck = (armedTime == 0 && !heap.empty()) || (fired && !changed);
+
+	// cancel() marks the timers in due, so a callback can cancel a timer that's due but not called yet
+	dueTimers = &due;
+	for(size_t ii = 0; ii < due.size(); ii++) {
+		Timer &timer = due[ii];
+		if (timer.cancelled) {
+			continue;
+		}
+		if (timer.callback) {
+			timer.callback(timer.name.c_str());
+		}
+		else {
+			log.info("timer %08lx fired but was not added again after restoring", (unsigned long)timer.hash);
+		}
+	}
+	dueTimers = nullptr;
+}
+
+bool MCP79410AlarmScheduler::addOneShotAt(const char *name, time_t time, TimerCallback callback) {
+	Timer timer;
+	timer.deadline = time;
+	timer.periodSec = 0;
+	timer.hash = nameHash(name);
+	timer.restored = false;
+	timer.name = name;
+	timer.callback = callback;
+	timer.cancelled = false;
+
+	addTimer(timer);
+	return true;
+}
+
+bool MCP79410AlarmScheduler::addOneShot(const char *name, uint32_t secondsFromNow, TimerCallback callback) {
+	time_t now = rtc.getRTCTime();
+	if (now == 0) {
+		return false;
+	}
+	return addOneShotAt(name, now + (time_t)secondsFromNow, callback);
+}
+
+bool MCP79410AlarmScheduler::addPeriodic(const char *name, uint32_t periodSec, TimerCallback callback, time_t firstTime) {
+	if (periodSec == 0) {
+		return false;
+	}
+	if (firstTime == 0) {
+		time_t now = rtc.getRTCTime();
+		if (now == 0) {
+			return false;
+		}
+		firstTime = now + (time_t)periodSec;
+	}
+
+	Timer timer;
+	timer.deadline = firstTime;
+	timer.periodSec = periodSec;
+	timer.hash = nameHash(name);
+	timer.restored = false;
+	timer.name = name;
+	timer.callback = callback;
+	timer.cancelled = false;
+
+	addTimer(timer);
+	return true;
+}
+
+bool MCP79410AlarmScheduler::cancel(const char *name) {
+	bool found = false;
+	if (dueTimers) {
+		// Called from a callback in loop()
+		uint32_t hash = nameHash(name);
+		for(auto it = dueTimers->begin(); it != dueTimers->end(); it++) {
+			if (!it->cancelled && timerMatches(*it, name, hash)) {
+				it->cancelled = true;
+				found = true;
+			}
+		}
+	}
+
+	int index = findTimer(name);
+	if (index < 0) {
+		return found;
+	}
+
+	heap.erase(heap.begin() + index);
+	std::make_heap(heap.begin(), heap.end(), heapCompare);
+
+	time_t now = rtc.getRTCTime();
+	if (now != 0) {
+		armAlarm(now);
+	}
+	persist();
+
+	return true;
+}
+
+time_t MCP79410AlarmScheduler::getNextTime(const char *name) const {
+	int index = findTimer(name);
+	return (index >= 0) ? heap[index].deadline : 0;
+}
+
+// static
+uint32_t MCP79410AlarmScheduler::nameHash(const char *name) {
+	uint32_t hash = 2166136261UL;
+
+	for(const char *cp = name; *cp; cp++) {
+		hash ^= (uint8_t)*cp;
+		hash *= 16777619UL;
+	}
+	return hash;
+}
+
+void MCP79410AlarmScheduler::addTimer(Timer &timer) {
+	int index = findTimer(timer.name.c_str());
+	if (index >= 0) {
+		Timer &existing = heap[index];
+		if (existing.restored && existing.periodSec == timer.periodSec) {
+			// Same timer as before deep sleep or reset, keep its deadline
+			timer.deadline = existing.deadline;
+		}
+		existing = timer;
+		std::make_heap(heap.begin(), heap.end(), heapCompare);
+	}
+	else {
+		heap.push_back(timer);
+		std::push_heap(heap.begin(), heap.end(), heapCompare);
+	}
+
+	time_t now = rtc.getRTCTime();
+	if (now != 0) {
+		armAlarm(now);
+	}
+	persist();
+}
+
+int MCP79410AlarmScheduler::findTimer(const char *name) const {
+	uint32_t hash = nameHash(name);
+
+	for(size_t ii = 0; ii < heap.size(); ii++) {
+		if (timerMatches(heap[ii], name, hash)) {
+			return (int)ii;
+		}
+	}
+	return -1;
+}
+
+// static
+bool MCP79410AlarmScheduler::timerMatches(const Timer &timer, const char *name, uint32_t hash) {
+	if (timer.hash != hash) {
+		return false;
+	}
+	// Different names can have the same hash. Restored timers only have the hash.
+	return timer.restored || timer.name == name;
+}
+
+void MCP79410AlarmScheduler::armAlarm(time_t now) {
+	if (heap.empty()) {
+		if (armedTime != 0) {
+			rtc.clearAlarm(alarmNum);
+			armedTime = 0;
+		}
+		return;
+	}
+
+	time_t target = heap.front().deadline;
+	if (target <= now) {
+		// Already due, loop() will handle it. Don't program a time in the past, because that would
+		// match next year.
+		target = now + 1;
+	}
+	else
+	if (target - now > (time_t)MAX_ARM_SECONDS) {
+		// Wake up part way there; loop() arms the alarm again
+		target = now + (time_t)MAX_ARM_SECONDS;
+	}
+
+	if (target == armedTime) {
+		return;
+	}
+
+	MCP79410Time time;
+	time.fromUnixTime(target);
+	time.alarmMode = time.ALARM_MONTH_DAY_DOW_HMS;
+
+	if (rtc.setAlarm(time, polarity, alarmNum)) {
+		armedTime = target;
+	}
+	else {
+		// loop() checks the time and tries again
+		armedTime = 0;
+		timeCheck = true;
+	}
+}
+
+void MCP79410AlarmScheduler::persist() {
+	if (sramAddr < 0 || (size_t)sramAddr >= rtc.sram().length()) {
+		return;
+	}
+
+	size_t len = std::min(sramLen, rtc.sram().length() - (size_t)sramAddr);
+	if (len < PERSIST_HEADER_SIZE + PERSIST_ENTRY_SIZE) {
+		return;
+	}
+	size_t maxCount = (len - PERSIST_HEADER_SIZE) / PERSIST_ENTRY_SIZE;
+
+	// The heap is only partially ordered, so sort a copy to store the earliest deadlines
+	std::vector<Timer> sorted(heap);
+	std::sort(sorted.begin(), sorted.end(), [](const Timer &a, const Timer &b) { return a.deadline < b.deadline; });
+	if (sorted.size() > maxCount) {
+		log.info("only %u of %u timers fit in SRAM", (unsigned)maxCount, (unsigned)sorted.size());
+		sorted.resize(maxCount);
+	}
+
+	uint8_t buf[64];
+	size_t offset = PERSIST_HEADER_SIZE;
+	for(auto it = sorted.begin(); it != sorted.end(); it++) {
+		uint32_t values[3] = { it->hash, (uint32_t)it->deadline, it->periodSec };
+		for(size_t ii = 0; ii < 3; ii++) {
+			for(size_t jj = 0; jj < 4; jj++) {
+				buf[offset++] = (uint8_t)(values[ii] >> (jj * 8));
+			}
+		}
+	}
+
+	uint8_t checksum = 0;
+	for(size_t ii = PERSIST_HEADER_SIZE; ii < offset; ii++) {
+		checksum += buf[ii];
+	}
+	buf[0] = PERSIST_MAGIC;
+	buf[1] = (uint8_t)sorted.size();
+	buf[2] = (uint8_t)~(checksum + buf[1]);
+
+	rtc.sram().writeData((size_t)sramAddr, buf, offset);
+}
+
+void MCP79410AlarmScheduler::restore() {
+	if (sramAddr < 0 || (size_t)sramAddr >= rtc.sram().length()) {
+		return;
+	}
+
+	size_t len = std::min(sramLen, rtc.sram().length() - (size_t)sramAddr);
+	if (len < PERSIST_HEADER_SIZE + PERSIST_ENTRY_SIZE) {
+		return;
+	}
+	size_t maxCount = (len - PERSIST_HEADER_SIZE) / PERSIST_ENTRY_SIZE;
+
+	uint8_t buf[64];
+	if (!rtc.sram().readData((size_t)sramAddr, buf, PERSIST_HEADER_SIZE) || buf[0] != PERSIST_MAGIC || buf[1] > maxCount) {
+		return;
+	}
+	size_t count = buf[1];
+	size_t dataLen = count * PERSIST_ENTRY_SIZE;
+	if (!rtc.sram().readData((size_t)sramAddr + PERSIST_HEADER_SIZE, &buf[PERSIST_HEADER_SIZE], dataLen)) {
+		return;
+	}
+
+	uint8_t checksum = 0;
+	for(size_t ii = PERSIST_HEADER_SIZE; ii < PERSIST_HEADER_SIZE + dataLen; ii++) {
+		checksum += buf[ii];
+	}
+	if (buf[2] != (uint8_t)~(checksum + buf[1])) {
+		log.info("timers in SRAM are not valid");
+		return;
+	}
+
+	heap.clear();
+	size_t offset = PERSIST_HEADER_SIZE;
+	for(size_t ii = 0; ii < count; ii++) {
+		uint32_t values[3];
+		for(size_t jj = 0; jj < 3; jj++) {
+			values[jj] = 0;
+			for(size_t kk = 0; kk < 4; kk++) {
+				values[jj] |= ((uint32_t)buf[offset++]) << (kk * 8);
+			}
+		}
+
+		Timer timer;
+		timer.hash = values[0];
+		timer.deadline = (time_t)values[1];
+		timer.periodSec = values[2];
+		timer.restored = true;
+		timer.cancelled = false;
+		heap.push_back(timer);
+	}
+	std::make_heap(heap.begin(), heap.end(), heapCompare);
+
+	log.info("restored %u timers from SRAM", (unsigned)count);
+}
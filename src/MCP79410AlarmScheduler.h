@@ -0,0 +1,262 @@
+#ifndef __MCP79410ALARMSCHEDULER_H
+#define __MCP79410ALARMSCHEDULER_H
+
+#include "MCP79410RK.h"
+
+#include <vector>
+
+/**
+ * @brief Any number of one-shot and periodic timers on top of one MCP79410 hardware alarm
+ *
+ * Timers are kept in a min-heap ordered by deadline, and the earliest deadline is always programmed into
+ * the hardware alarm, so MFP can wake the device from sleep for whichever timer is next. Timers are
+ * identified by name; adding a timer with a name that's already in use replaces it.
+ *
+ * ```
+ * MCP79410 rtc;
+ * MCP79410AlarmScheduler scheduler(rtc);
+ *
+ * void setup() {
+ *     rtc.setup();
+ *     scheduler.withSRAM(0).setup();
+ *
+ *     scheduler.addPeriodic("sample", 300, [](const char *name) {
+ *         // Take a sample
+ *     });
+ *     scheduler.addPeriodic("upload", 3600, [](const char *name) {
+ *         // Upload
+ *     });
+ * }
+ *
+ * void loop() {
+ *     rtc.loop();
+ *     scheduler.loop();
+ * }
+ * ```
+ *
+ * Callbacks are called from loop(). A callback can add or cancel timers, including its own.
+ *
+ * loop() only reads the RTC time when the hardware alarm goes off. With MCP79410::withAlarmInterrupt(), this
+ * object sets the alarm callback (MCP79410::withAlarmCallback()) for its alarm and there's no I2C traffic
+ * between timers. Otherwise, loop() reads the alarm flag once per second (LOOP_CHECK_INTERVAL_MS). It also
+ * checks the time once after setup(), and once per second while the alarm could not be set.
+ *
+ * This can't be combined with MCP79410::withSecondsCounter(). Square wave mode overrides the alarm output
+ * on MFP, and setup() clears the alarm enables when it turns on the square wave.
+ */
+class MCP79410AlarmScheduler {
+public:
+	/**
+	 * @brief Timer callback. The parameter is the name of the timer (empty for a timer restored from SRAM
+	 * that has not been added again).
+	 */
+	typedef std::function<void(const char *name)> TimerCallback;
+
+	/**
+	 * @brief Constructor
+	 *
+	 * @param rtc The MCP79410 object. Its setup() must be called before setup() of this object.
+	 *
+	 * @param alarmNum The hardware alarm to use, 0 (the default) or 1. The other one is still available
+	 * for your own use. Only one is needed because the earliest deadline is the only one that's armed.
+	 */
+	MCP79410AlarmScheduler(MCP79410 &rtc, int alarmNum = 0);
+
+	/**
+	 * @brief Destructor
+	 */
+	virtual ~MCP79410AlarmScheduler();
+
+	/**
+	 * @brief Store the timers in the RTC SRAM so they survive SLEEP_MODE_DEEP and resets
+	 *
+	 * @param addr Offset in the SRAM (0 - 63) to store the timers at
+	 *
+	 * @param len Number of bytes to use (default: the rest of the SRAM). Each timer takes
+	 * PERSIST_ENTRY_SIZE (12) bytes plus PERSIST_HEADER_SIZE (3) bytes, so all 64 bytes hold 5 timers.
+	 * If there are more timers than fit, the ones with the earliest deadlines are stored.
+	 *
+	 * Only the hash of the name, the deadline, and the period are stored. When setup() restores the timers,
+	 * they don't have callbacks or names, so you should add them again after setup() with the same name.
+	 * Restored timers are matched by the hash only, until they're added again. If a
+	 * restored timer with the same name and period exists, it keeps its deadline instead of starting over,
+	 * so a timer that's longer than the time between deep sleeps still fires on time.
+	 *
+	 * The withXXX() syntax allows you to chain multiple options, fluent-style.
+	 */
+	MCP79410AlarmScheduler &withSRAM(size_t addr, size_t len = 64) { sramAddr = (int)addr; sramLen = len; return *this; };
+
+	/**
+	 * @brief Alarm polarity passed to MCP79410::setAlarm() (default: true, active high, for waking on D8)
+	 *
+	 * The withXXX() syntax allows you to chain multiple options, fluent-style.
+	 */
+	MCP79410AlarmScheduler &withPolarity(bool value) { polarity = value; return *this; };
+
+	/**
+	 * @brief Restores the timers from SRAM (if enabled with withSRAM()) and programs the hardware alarm
+	 *
+	 * Call this from setup(), after MCP79410::setup(). With MCP79410::withAlarmInterrupt(), this sets the
+	 * alarm callback for the alarm passed to the constructor.
+	 */
+	void setup();
+
+	/**
+	 * @brief Calls the callbacks for timers that are due, reschedules periodic timers, and programs the next
+	 * deadline into the hardware alarm
+	 *
+	 * Call this from loop(), after MCP79410::loop(). It only reads the RTC time when the hardware alarm has
+	 * gone off, once after setup(), and once per second (LOOP_CHECK_INTERVAL_MS) while the alarm could not
+	 * be set. Without MCP79410::withAlarmInterrupt(), it reads the alarm flag once per second while there
+	 * are timers.
+	 */
+	void loop();
+
+	/**
+	 * @brief Add a timer that fires once at a specific time
+	 *
+	 * @param name Name of the timer. Adding a timer with the same name as an existing one replaces it.
+	 *
+	 * @param time When to fire, Unix time (UTC)
+	 *
+	 * @param callback Function to call when the timer fires
+	 *
+	 * @return true on success, false if the RTC time is not valid
+	 */
+	bool addOneShotAt(const char *name, time_t time, TimerCallback callback);
+
+	/**
+	 * @brief Add a timer that fires once, a number of seconds from now
+	 *
+	 * @param name Name of the timer. Adding a timer with the same name as an existing one replaces it.
+	 *
+	 * @param secondsFromNow How long from now to fire, in seconds
+	 *
+	 * @param callback Function to call when the timer fires
+	 *
+	 * @return true on success, false if the RTC time is not valid
+	 */
+	bool addOneShot(const char *name, uint32_t secondsFromNow, TimerCallback callback);
+
+	/**
+	 * @brief Add a timer that fires repeatedly
+	 *
+	 * @param name Name of the timer. Adding a timer with the same name as an existing one replaces it, unless
+	 * it's a restored timer with the same period (see withSRAM()).
+	 *
+	 * @param periodSec How often to fire, in seconds
+	 *
+	 * @param callback Function to call when the timer fires
+	 *
+	 * @param firstTime When to fire the first time, Unix time (UTC). The default (0) is one period from now.
+	 *
+	 * If the device was asleep or loop() was not called for more than one period, the callback is called once
+	 * and the next deadline is the next multiple of the period after the current time, so the timer stays
+	 * aligned to firstTime.
+	 *
+	 * @return true on success, false if periodSec is 0 or the RTC time is not valid
+	 */
+	bool addPeriodic(const char *name, uint32_t periodSec, TimerCallback callback, time_t firstTime = 0);
+
+	/**
+	 * @brief Remove a timer
+	 *
+	 * @param name Name of the timer
+	 *
+	 * @return true if the timer existed
+	 */
+	bool cancel(const char *name);
+
+	/**
+	 * @brief Returns the time a timer fires next, or 0 if there is no timer with that name
+	 */
+	time_t getNextTime(const char *name) const;
+
+	/**
+	 * @brief Returns the earliest deadline of all timers, or 0 if there are no timers
+	 */
+	time_t getNextDeadline() const { return heap.empty() ? 0 : heap.front().deadline; };
+
+	/**
+	 * @brief Returns the number of timers
+	 */
+	size_t getCount() const { return heap.size(); };
+
+	/**
+	 * @brief Hash used to identify timers by name in SRAM (32-bit FNV-1a)
+	 */
+	static uint32_t nameHash(const char *name);
+
+	static const size_t PERSIST_HEADER_SIZE = 3; //!< Bytes used in SRAM for the magic byte, count, and checksum
+	static const size_t PERSIST_ENTRY_SIZE = 12; //!< Bytes used in SRAM per timer: name hash, deadline, period
+	static const uint8_t PERSIST_MAGIC = 0xa5; //!< First byte of the timers in SRAM
+	static const unsigned long LOOP_CHECK_INTERVAL_MS = 1000; //!< How often loop() reads the alarm flag, or the RTC time when checking the time
+	static const uint32_t MAX_ARM_SECONDS = 300 * 86400; //!< The alarm does not compare the year, so deadlines further out than this are armed in steps
+
+protected:
+	/**
+	 * @brief One timer in the heap
+	 */
+	struct Timer {
+		time_t deadline; //!< When the timer fires next
+		uint32_t periodSec; //!< Period for periodic timers, 0 for one-shot timers
+		uint32_t hash; //!< nameHash() of the name
+		bool restored; //!< true if restored from SRAM and not added again yet
+		String name; //!< Name of the timer, empty if restored from SRAM and not added again yet
+		TimerCallback callback; //!< Function to call, may be empty
+		bool cancelled; //!< Set in the list of due timers in loop() if a callback cancels it before it's called
+	};
+
+	/**
+	 * @brief Ordering for the min-heap (std::push_heap makes a max-heap, so this is reversed)
+	 */
+	static bool heapCompare(const Timer &a, const Timer &b) { return a.deadline > b.deadline; };
+
+	/**
+	 * @brief Add a timer, replacing any timer with the same name
+	 */
+	void addTimer(Timer &timer);
+
+	/**
+	 * @brief Returns the index in heap of the timer with the given name, or -1 if not found
+	 *
+	 * Restored timers that have not been added again don't have a name, so they're matched by nameHash().
+	 */
+	int findTimer(const char *name) const;
+
+	/**
+	 * @brief Returns true if the timer is the one with the given name and hash. See findTimer().
+	 */
+	static bool timerMatches(const Timer &timer, const char *name, uint32_t hash);
+
+	/**
+	 * @brief Program the earliest deadline into the hardware alarm if it changed, or clear it if there
+	 * are no timers
+	 */
+	void armAlarm(time_t now);
+
+	/**
+	 * @brief Store the timers in SRAM if enabled using withSRAM()
+	 */
+	void persist();
+
+	/**
+	 * @brief Load the timers from SRAM if enabled using withSRAM()
+	 */
+	void restore();
+
+	MCP79410 &rtc; //!< The MCP79410 object passed to the constructor
+	int alarmNum; //!< Hardware alarm number, 0 or 1
+	bool polarity = true; //!< See withPolarity()
+	int sramAddr = -1; //!< See withSRAM(), -1 if not enabled
+	size_t sramLen = 64; //!< See withSRAM()
+	std::vector<Timer> heap; //!< Timers, a min-heap by deadline
+	time_t armedTime = 0; //!< Time programmed into the hardware alarm, 0 if not armed
+	unsigned long lastCheckMs = 0; //!< millis() value when loop() last read the alarm flag or the RTC time
+	bool interruptMode = false; //!< true if MCP79410::withAlarmInterrupt() is used, set in setup()
+	bool alarmFired = false; //!< Set by the MCP79410 alarm callback in interrupt mode, cleared by loop()
+	bool timeCheck = true; //!< true if loop() checks the RTC time once per second instead of waiting for the alarm
+	std::vector<Timer> *dueTimers = nullptr; //!< Timers whose callbacks loop() is calling, so cancel() can skip them
+};
+
+#endif /* __MCP79410ALARMSCHEDULER_H */
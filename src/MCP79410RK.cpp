@@ -2,6 +2,70 @@
 
 static Logger log("app.rtc");
 
+#ifndef MCP79410_DISABLE_TWOWIRE
+
+MCP79410TwoWireTransport::MCP79410TwoWireTransport(TwoWire &wire) : wire(wire) {
+
+}
+
+MCP79410TwoWireTransport::~MCP79410TwoWireTransport() {
+
+}
+
+void MCP79410TwoWireTransport::begin() {
+	wire.begin();
+}
+
+int MCP79410TwoWireTransport::writeRead(uint8_t i2cAddr, const uint8_t *writeBuf, size_t writeLen, uint8_t *readBuf, size_t readLen) {
+	if (writeLen > maxWriteLen() || readLen > maxReadLen()) {
+		return STAT_TOO_LONG;
+	}
+
+	wire.beginTransmission(i2cAddr);
+	for(size_t ii = 0; ii < writeLen; ii++) {
+		wire.write(writeBuf[ii]);
+	}
+
+	if (readLen == 0) {
+		return wire.endTransmission(true);
+	}
+
+	int stat = wire.endTransmission(false);
+	if (stat == 0) {
+		size_t count = wire.requestFrom(i2cAddr, readLen, (uint8_t) true);
+		for(size_t ii = 0; ii < count; ii++) {
+			readBuf[ii] = wire.read();
+		}
+		if (count < readLen) {
+			stat = STAT_OTHER;
+		}
+	}
+	return stat;
+}
+
+int MCP79410TwoWireTransport::writeSegments(uint8_t i2cAddr, const MCP79410TransportSegment *segments, size_t numSegments) {
+	size_t total = 0;
+	for(size_t ii = 0; ii < numSegments; ii++) {
+		total += segments[ii].len;
+	}
+	if (total > maxWriteLen()) {
+		return STAT_TOO_LONG;
+	}
+
+	wire.beginTransmission(i2cAddr);
+	for(size_t ii = 0; ii < numSegments; ii++) {
+		for(size_t jj = 0; jj < segments[ii].len; jj++) {
+			wire.write(segments[ii].buf[jj]);
+		}
+	}
+	return wire.endTransmission(true);
+}
+
+#endif /* MCP79410_DISABLE_TWOWIRE */
+
+//
+//
+//
 
 MCP79410MemoryBase::MCP79410MemoryBase(MCP79410 *parent) : parent(parent) {
 
@@ -76,7 +140,8 @@ bool MCP79410SRAM::writeData(size_t addr, const uint8_t *data, size_t dataLen) {
 //
 //
 MCP79410EEPROM::MCP79410EEPROM(MCP79410 *parent) : MCP79410MemoryBase(parent) {
-
+	memset(asyncDirty, 0, sizeof(asyncDirty));
+	resetStats();
 }
 
 MCP79410EEPROM::~MCP79410EEPROM() {
@@ -103,13 +168,11 @@ bool MCP79410EEPROM::setBlockProtection(uint8_t value) {
 
 	int stat = parent->deviceWrite(MCP79410::EEPROM_I2C_ADDR, MCP79410::EEPROM_STATUS, buf, 1);
 	if (stat == 0) {
-		parent->waitForEEPROM();
-		return true;
-	}
-	else {
-		return false;
+		stat = parent->waitForEEPROM();
 	}
 
+	return (stat == 0);
+
 }
 
 
@@ -127,8 +190,26 @@ bool MCP79410EEPROM::readData(size_t addr, uint8_t *data, size_t dataLen) {
 		return false;
 	}
 
+	if (asyncInFlight) {
+		// The EEPROM does not respond during a write cycle. Only wait for the one in progress; loop() does
+		// the rest of the page.
+		asyncWaitCycle(true);
+	}
+
 	int stat = parent->deviceRead(MCP79410::EEPROM_I2C_ADDR, addr, data, dataLen);
 
+	// Return data that is being written or has been queued but not written yet
+	for(size_t ii = 0; ii < dataLen; ii++) {
+		size_t curAddr = addr + ii;
+		if (asyncDirty[curAddr / 8] & (1 << (curAddr % 8))) {
+			data[ii] = asyncData[curAddr];
+		}
+		else
+		if (asyncInFlight && curAddr >= asyncInFlightAddr && curAddr < (size_t)asyncInFlightAddr + asyncInFlightLen) {
+			data[ii] = asyncInFlightData[curAddr - asyncInFlightAddr];
+		}
+	}
+
 	return (stat == 0);
 }
 
@@ -139,11 +220,389 @@ bool MCP79410EEPROM::writeData(size_t addr, const uint8_t *data, size_t dataLen)
 		return false;
 	}
 
+	if (asyncWrite) {
+		return writeDataAsync(addr, data, dataLen);
+	}
+
+	if (hasPendingWrites()) {
+		// Make sure queued data does not overwrite this data later
+		flush();
+	}
+
+	stats.bytesRequested += dataLen;
+
+	if (differentialWrite) {
+		return writeDataDifferential(addr, data, dataLen);
+	}
+
+	stats.writeCycles += (addr + dataLen + MCP79410::EEPROM_PAGE_SIZE - 1) / MCP79410::EEPROM_PAGE_SIZE - addr / MCP79410::EEPROM_PAGE_SIZE;
+
 	int stat = parent->deviceWriteEEPROM(addr, data, dataLen);
 
 	return (stat == 0);
 }
 
+bool MCP79410EEPROM::writeDataDifferential(size_t addr, const uint8_t *data, size_t dataLen) {
+	uint8_t current[128];
+
+	// Read the whole range at once
+	int stat = parent->deviceRead(MCP79410::EEPROM_I2C_ADDR, addr, current, dataLen);
+	if (stat != 0) {
+		return false;
+	}
+
+	size_t offset = 0;
+	while(offset < dataLen) {
+		// Process one page at a time
+		size_t curAddr = addr + offset;
+		size_t count = MCP79410::EEPROM_PAGE_SIZE - (curAddr % MCP79410::EEPROM_PAGE_SIZE);
+		if (count > dataLen - offset) {
+			count = dataLen - offset;
+		}
+
+		// Find the first and last changed bytes in this page
+		size_t first = offset, last = offset + count;
+		while(first < offset + count && current[first] == data[first]) {
+			first++;
+		}
+		while(last > first && current[last - 1] == data[last - 1]) {
+			last--;
+		}
+
+		if (first < last) {
+			stats.writeCycles++;
+			stats.bytesSkipped += count - (last - first);
+
+			stat = parent->deviceWriteEEPROM(addr + first, &data[first], last - first);
+			if (stat != 0) {
+				return false;
+			}
+		}
+		else {
+			stats.cyclesSaved++;
+			stats.bytesSkipped += count;
+		}
+
+		offset += count;
+	}
+
+	return true;
+}
+
+MCP79410EEPROM &MCP79410EEPROM::withAsyncWrite(bool value) {
+	if (!value && asyncWrite) {
+		flush();
+	}
+	asyncWrite = value;
+	return *this;
+}
+
+bool MCP79410EEPROM::writeDataAsync(size_t addr, const uint8_t *data, size_t dataLen, std::function<void(bool)> callback) {
+	if ((addr + dataLen) > length()) {
+		return false;
+	}
+
+	AsyncCallback *slot = NULL;
+	if (callback && dataLen > 0) {
+		for(size_t ii = 0; ii < ASYNC_MAX_CALLBACKS; ii++) {
+			if (!asyncCallbacks[ii].callback) {
+				slot = &asyncCallbacks[ii];
+				break;
+			}
+		}
+		if (!slot) {
+			// Too many pending callbacks
+			return false;
+		}
+	}
+
+	asyncSeq++;
+	stats.bytesRequested += dataLen;
+
+	for(size_t ii = 0; ii < dataLen; ii++) {
+		size_t curAddr = addr + ii;
+		asyncData[curAddr] = data[ii];
+		asyncDirty[curAddr / 8] |= (1 << (curAddr % 8));
+	}
+
+	if (slot) {
+		slot->pageMask = 0;
+		for(size_t page = addr / MCP79410::EEPROM_PAGE_SIZE; page <= (addr + dataLen - 1) / MCP79410::EEPROM_PAGE_SIZE; page++) {
+			slot->pageMask |= (1 << page);
+		}
+		slot->seq = asyncSeq;
+		slot->success = true;
+		slot->callback = callback;
+	}
+	else
+	if (callback) {
+		// Nothing to write
+		callback(true);
+	}
+
+	return true;
+}
+
+bool MCP79410EEPROM::flush() {
+	asyncFailed = false;
+	asyncRetryWait = false;
+
+	while(true) {
+		if (asyncInFlight) {
+			asyncFinishPage(true);
+		}
+		if (!asyncStartPage()) {
+			break;
+		}
+	}
+
+	// Data can still be queued if reading the EEPROM failed; loop() retries it later
+	return !asyncFailed && !hasPendingWrites();
+}
+
+bool MCP79410EEPROM::hasPendingWrites() const {
+	if (asyncInFlight) {
+		return true;
+	}
+	for(size_t ii = 0; ii < sizeof(asyncDirty); ii++) {
+		if (asyncDirty[ii]) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void MCP79410EEPROM::loop() {
+	if (asyncInFlight) {
+		if (!asyncFinishPage(false)) {
+			// Write cycle still in progress
+			return;
+		}
+	}
+	asyncStartPage();
+}
+
+bool MCP79410EEPROM::asyncStartPage() {
+	if (asyncRetryWait) {
+		if (millis() - asyncRetryMs < ASYNC_RETRY_MS) {
+			return false;
+		}
+		asyncRetryWait = false;
+	}
+
+	// Each byte of asyncDirty is one 8-byte page
+	size_t page;
+	for(page = 0; page < sizeof(asyncDirty); page++) {
+		if (asyncDirty[page]) {
+			break;
+		}
+	}
+	if (page >= sizeof(asyncDirty)) {
+		return false;
+	}
+
+	if (differentialWrite) {
+		// Don't write bytes that already have the queued value
+		uint8_t current[MCP79410::EEPROM_PAGE_SIZE];
+		uint8_t pageAddr = (uint8_t)(page * MCP79410::EEPROM_PAGE_SIZE);
+		if (parent->deviceRead(MCP79410::EEPROM_I2C_ADDR, pageAddr, current, sizeof(current)) == 0) {
+			for(size_t ii = 0; ii < sizeof(current); ii++) {
+				if ((asyncDirty[page] & (1 << ii)) != 0 && current[ii] == asyncData[pageAddr + ii]) {
+					asyncDirty[page] &= ~(1 << ii);
+					stats.bytesSkipped++;
+				}
+			}
+		}
+		if (asyncDirty[page] == 0) {
+			// Whole page unchanged
+			stats.cyclesSaved++;
+			asyncCompletePage(page, true, asyncSeq);
+			return true;
+		}
+	}
+
+	uint8_t dirty = asyncDirty[page];
+	uint8_t first = 0, last = 7;
+	while((dirty & (1 << first)) == 0) {
+		first++;
+	}
+	while((dirty & (1 << last)) == 0) {
+		last--;
+	}
+
+	asyncInFlightAddr = (uint8_t)(page * MCP79410::EEPROM_PAGE_SIZE + first);
+	asyncInFlightLen = last - first + 1;
+	asyncInFlightSeq = asyncSeq;
+
+	uint8_t spanMask = (uint8_t)(((1 << asyncInFlightLen) - 1) << first);
+	if ((dirty & spanMask) != spanMask) {
+		// There are bytes that weren't changed between the first and last changed byte. Read the current
+		// values so the whole span can be written in one write cycle, and verified.
+		int stat = parent->deviceRead(MCP79410::EEPROM_I2C_ADDR, asyncInFlightAddr, asyncInFlightData, asyncInFlightLen);
+		if (stat != 0) {
+			// The page stays queued and is tried again later
+			log.info("async EEPROM read failed addr=%02x stat=%d, will retry", asyncInFlightAddr, stat);
+			asyncRetryWait = true;
+			asyncRetryMs = millis();
+			return false;
+		}
+	}
+	for(uint8_t ii = first; ii <= last; ii++) {
+		if (dirty & (1 << ii)) {
+			asyncInFlightData[ii - first] = asyncData[asyncInFlightAddr - first + ii];
+		}
+	}
+
+	// Bytes queued after this point will be written again
+	asyncDirty[page] = 0;
+
+	// In byte mode, only the changed bytes are written, one per write cycle
+	asyncInFlightMask = parent->eepromPageWrite ? 0 : (uint8_t)(dirty >> first);
+	asyncInFlightRetry = false;
+
+	int stat = asyncWriteStart();
+	if (stat != 0) {
+		// The queued data for this page is discarded
+		log.info("async EEPROM write failed addr=%02x stat=%d", asyncInFlightAddr, stat);
+		asyncCompletePage(page, false, asyncInFlightSeq);
+		return true;
+	}
+
+	asyncInFlight = true;
+	asyncInFlightStat = 0;
+	return true;
+}
+
+int MCP79410EEPROM::asyncWriteStart() {
+	uint8_t addr = asyncInFlightAddr;
+	const uint8_t *data = asyncInFlightData;
+	size_t len = asyncInFlightLen;
+
+	if (asyncInFlightMask != 0) {
+		// Byte mode, write the next changed byte
+		uint8_t index = 0;
+		while((asyncInFlightMask & (1 << index)) == 0) {
+			index++;
+		}
+		asyncInFlightMask &= ~(1 << index);
+
+		addr += index;
+		data += index;
+		len = 1;
+	}
+
+	int stat = parent->deviceWriteEEPROMStart(addr, data, len);
+	stats.writeCycles++;
+
+	asyncCycleActive = (stat == 0);
+	asyncInFlightStartMs = millis();
+	return stat;
+}
+
+bool MCP79410EEPROM::asyncWaitCycle(bool block) {
+	if (!asyncCycleActive) {
+		return true;
+	}
+
+	int stat;
+	if (block) {
+		stat = parent->waitForEEPROM();
+	}
+	else {
+		unsigned long elapsed = millis() - asyncInFlightStartMs;
+		if (elapsed < parent->eepromWriteCycleMinMs) {
+			return false;
+		}
+		stat = parent->devicePollEEPROM();
+		if (stat != 0) {
+			if (elapsed < parent->eepromWriteCycleTimeoutMs) {
+				return false;
+			}
+			stat = MCP79410::ERROR_EEPROM_TIMEOUT;
+			parent->busStatsEEPROMTimeout();
+		}
+	}
+
+	asyncCycleActive = false;
+	if (stat != 0) {
+		asyncInFlightStat = stat;
+	}
+	return true;
+}
+
+bool MCP79410EEPROM::asyncFinishPage(bool block) {
+	if (!asyncInFlight) {
+		return true;
+	}
+
+	while(true) {
+		if (!asyncWaitCycle(block)) {
+			// Write cycle still in progress
+			return false;
+		}
+		if (asyncInFlightStat != 0) {
+			break;
+		}
+
+		if (asyncInFlightMask != 0) {
+			// Byte mode, start the next byte
+			asyncInFlightStat = asyncWriteStart();
+			if (asyncInFlightStat != 0) {
+				break;
+			}
+			if (!block) {
+				return false;
+			}
+			continue;
+		}
+
+		asyncInFlightStat = parent->deviceVerifyEEPROM(asyncInFlightAddr, asyncInFlightData, asyncInFlightLen);
+		if (asyncInFlightStat != 0 && parent->eepromPageWrite && asyncInFlightLen > 1 && !asyncInFlightRetry) {
+			// Retry this page in byte mode. Each byte is a separate write cycle, started from loop() like
+			// any other byte mode write, so this doesn't block.
+			log.info("async EEPROM page write failed addr=%02x stat=%d, retrying in byte mode", asyncInFlightAddr, asyncInFlightStat);
+			asyncInFlightRetry = true;
+			asyncInFlightStat = 0;
+			asyncInFlightMask = (uint8_t)((1 << asyncInFlightLen) - 1);
+			continue;
+		}
+		break;
+	}
+	asyncInFlight = false;
+	asyncInFlightMask = 0;
+
+	if (asyncInFlightStat != 0) {
+		log.info("async EEPROM write failed addr=%02x stat=%d", asyncInFlightAddr, asyncInFlightStat);
+	}
+
+	asyncCompletePage(asyncInFlightAddr / MCP79410::EEPROM_PAGE_SIZE, asyncInFlightStat == 0, asyncInFlightSeq);
+	return true;
+}
+
+void MCP79410EEPROM::asyncCompletePage(uint8_t page, bool success, uint32_t startSeq) {
+	if (!success) {
+		asyncFailed = true;
+	}
+
+	for(size_t ii = 0; ii < ASYNC_MAX_CALLBACKS; ii++) {
+		AsyncCallback &cb = asyncCallbacks[ii];
+
+		// Only writes queued before this page write started are covered by it; later writes to
+		// the same page were marked dirty again and will be written by a later page write.
+		if (cb.callback && (cb.pageMask & (1 << page)) != 0 && (int32_t)(startSeq - cb.seq) >= 0) {
+			cb.pageMask &= ~(1 << page);
+			if (!success) {
+				cb.success = false;
+			}
+			if (cb.pageMask == 0) {
+				std::function<void(bool)> callback = cb.callback;
+				cb.callback = nullptr;
+				callback(cb.success);
+			}
+		}
+	}
+}
+
 
 
 MCP79410Time::MCP79410Time() {
@@ -185,41 +644,113 @@ void MCP79410Time::clear() {
 
 
 void MCP79410Time::fromUnixTime(time_t time) {
-	struct tm *tm = gmtime(&time);
+	// Floor division so times before 1970 work too
+	int32_t days = (int32_t)(time / 86400);
+	int32_t secondOfDay = (int32_t)(time % 86400);
+	if (secondOfDay < 0) {
+		secondOfDay += 86400;
+		days--;
+	}
 
-	// Technically tm_year is years since 1900 but we can't represent dates not in 2000 - 2099
-	setYear(tm->tm_year);
+	int year, month, dayOfMonth;
+	civilFromDays(days, year, month, dayOfMonth);
 
-	// 0 <= tm_mon <= 11! We use the more conventional 1-12 for getMonth/setMonth
-	setMonth(tm->tm_mon + 1);
+	// Pack the binary fields in register order and convert them to BCD all at once. We can't represent
+	// dates not in 2000 - 2099, the year is stored modulo 100. The hour is always 24-hour format.
+	uint64_t packed = (uint64_t)(secondOfDay % 60)
+		| ((uint64_t)((secondOfDay / 60) % 60) << 8)
+		| ((uint64_t)(secondOfDay / 3600) << 16)
+		| ((uint64_t)(weekdayFromDays(days) + 1) << 24)
+		| ((uint64_t)dayOfMonth << 32)
+		| ((uint64_t)month << 40)
+		| ((uint64_t)(year % 100) << 48);
 
-	setDayOfMonth(tm->tm_mday);
+	// Like setSecond(), setDayOfWeek() and setDayOfMonth(), preserve the ST bit, the status bits
+	// in the day of week, and the upper bits of the day of month.
+	const uint64_t preserveMask = 0x000000c0f8000080ULL;
 
-	setDayOfWeek(tm->tm_wday);
+	fromRawPacked((toRawPacked() & preserveMask) | intToBcdPacked(packed));
+}
+
+time_t MCP79410Time::toUnixTime() const {
+	// Decode all of the fields at once, masking off the mode and status bits
+	uint64_t fields = bcdToIntPacked(toRawPacked() & RAW_PACKED_VALUE_MASK);
 
+	int hour;
+	if (rawHour & 0x40) {
+		// 12-hour mode, let getHour() deal with AM/PM
+		hour = getHour();
+	}
+	else {
+		hour = (int)((fields >> 16) & 0xff);
+	}
 
-	// days since Sunday – [0, 6]
+	int32_t days = daysFromCivil(2000 + (int)((fields >> 48) & 0xff), (int)((fields >> 40) & 0xff), (int)((fields >> 32) & 0xff));
 
-	setHour(tm->tm_hour); // tm_hour is 0-23
-	setMinute(tm->tm_min); // tm_min is 0-59
-	setSecond(tm->tm_sec < 60 ? tm->tm_sec : 59); // tm_sec is 0-61, inclusive, because of leap seconds.
+	return (time_t)days * 86400 + hour * 3600 + (int)((fields >> 8) & 0xff) * 60 + (int)(fields & 0xff);
 }
 
-time_t MCP79410Time::toUnixTime() const {
-	struct tm tm;
-	memset(&tm, 0, sizeof(struct tm));
+uint64_t MCP79410Time::toRawPacked() const {
+	return (uint64_t)rawSecond
+		| ((uint64_t)rawMinute << 8)
+		| ((uint64_t)rawHour << 16)
+		| ((uint64_t)rawDayOfWeek << 24)
+		| ((uint64_t)rawDayOfMonth << 32)
+		| ((uint64_t)rawMonth << 40)
+		| ((uint64_t)rawYear << 48);
+}
+
+void MCP79410Time::fromRawPacked(uint64_t packed) {
+	rawSecond = (uint8_t)packed;
+	rawMinute = (uint8_t)(packed >> 8);
+	rawHour = (uint8_t)(packed >> 16);
+	rawDayOfWeek = (uint8_t)(packed >> 24);
+	rawDayOfMonth = (uint8_t)(packed >> 32);
+	rawMonth = (uint8_t)(packed >> 40);
+	rawYear = (uint8_t)(packed >> 48);
+}
+
+// [static]
+uint64_t MCP79410Time::bcdToIntPacked(uint64_t value) {
+	// Each byte is 16 * tens + ones and we want 10 * tens + ones, so subtract 6 * tens from each byte.
+	// 6 * tens is at most 54 and the result is never negative so there are no carries or borrows
+	// between bytes.
+	uint64_t tens = (value >> 4) & 0x0f0f0f0f0f0f0f0fULL;
+	return value - tens * 6;
+}
+
+// [static]
+uint64_t MCP79410Time::intToBcdPacked(uint64_t value) {
+	// Handle the even and odd bytes separately in 16-bit lanes so the products (at most 99 * 103 = 10197)
+	// don't overflow into the next lane. tens = (v * 103) >> 10 is exact for 0 <= v <= 99. The shift
+	// brings bits from the lane above into the upper bits of each lane, which are masked off.
+	const uint64_t laneMask = 0x00ff00ff00ff00ffULL;
+	const uint64_t tensMask = 0x000f000f000f000fULL;
 
-	tm.tm_year = getYear() - 1900; // tm_year is years since 1900
-	tm.tm_mon = getMonth() - 1; // tm_mon is 0-11!
-	tm.tm_mday = getDayOfMonth(); // 1-31
+	uint64_t even = value & laneMask;
+	uint64_t odd = (value >> 8) & laneMask;
 
-	tm.tm_hour = getHour();
-	tm.tm_min = getMinute();
-	tm.tm_sec = getSecond();
+	uint64_t evenTens = ((even * 103) >> 10) & tensMask;
+	uint64_t oddTens = ((odd * 103) >> 10) & tensMask;
 
-	// time->tm_wday and time->tm_yday are ignored by mktime
+	// BCD is 16 * tens + ones = v + 6 * tens
+	return (even + evenTens * 6) | ((odd + oddTens * 6) << 8);
+}
+
+// [static]
+void MCP79410Time::civilFromDays(int32_t days, int &year, int &month, int &dayOfMonth) {
+	// Inverse of daysFromCivil, also from Howard Hinnant. The year is shifted to start on March 1
+	// so the leap day is at the end of the year.
+	days += 719468;
+	int32_t era = (days >= 0 ? days : days - 146096) / 146097;
+	uint32_t dayOfEra = (uint32_t)(days - era * 146097); // 0 - 146096
+	uint32_t yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365; // 0 - 399
+	uint32_t dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100); // 0 - 365
+	uint32_t monthIndex = (5 * dayOfYear + 2) / 153; // 0 = March, 11 = February
 
-	return mktime(&tm);
+	dayOfMonth = (int)(dayOfYear - (153 * monthIndex + 2) / 5 + 1);
+	month = (int)(monthIndex < 10 ? monthIndex + 3 : monthIndex - 9);
+	year = (int)yearOfEra + era * 400 + (month <= 2 ? 1 : 0);
 }
 
 int MCP79410Time::getYear() const {
@@ -319,41 +850,249 @@ void MCP79410Time::setSecond(int value) {
 	rawSecond |= intToBcd(value);
 }
 
-void MCP79410Time::setAlarmSecond(int second) {
-	clear();
-	alarmMode = ALARM_SECOND;
-	setSecond(second);
-}
+void MCP79410Time::addSeconds(int32_t seconds) {
+	int32_t days = seconds / 86400;
+	int32_t secondOfDay = getHour() * 3600 + getMinute() * 60 + getSecond() + seconds % 86400;
 
-void MCP79410Time::setAlarmMinute(int minute) {
-	clear();
-	alarmMode = ALARM_MINUTE;
-	setMinute(minute);
-}
+	// seconds % 86400 is in the range (-86400, 86400) so at most one day of carry or borrow
+	if (secondOfDay < 0) {
+		secondOfDay += 86400;
+		days--;
+	}
+	else
+	if (secondOfDay >= 86400) {
+		secondOfDay -= 86400;
+		days++;
+	}
 
-void MCP79410Time::setAlarmHour(int hour) {
-	clear();
-	alarmMode = ALARM_HOUR;
-	setHour(hour);
-}
+	setHour(secondOfDay / 3600);
+	setMinute((secondOfDay / 60) % 60);
+	setSecond(secondOfDay % 60);
 
-void MCP79410Time::setAlarmDayOfWeek(int dayOfWeek) {
-	clear();
-	alarmMode = ALARM_DAY_OF_WEEK;
-	setDayOfWeek(dayOfWeek);
+	if (days != 0) {
+		addDays(days);
+	}
 }
 
-void MCP79410Time::setAlarmDayOfMonth(int dayOfMonth) {
-	clear();
-	alarmMode = ALARM_DAY_OF_MONTH;
-	setDayOfMonth(dayOfMonth);
+void MCP79410Time::addMinutes(int32_t minutes) {
+	// Split so minutes * 60 can't overflow
+	addDays(minutes / 1440);
+	addSeconds((minutes % 1440) * 60);
 }
 
-void MCP79410Time::setAlarmTime(time_t unixTime) {
-	fromUnixTime(unixTime);
+void MCP79410Time::addDays(int32_t days) {
+	if (days == 0) {
+		return;
+	}
+
+	int year = getYear();
+	int month = getMonth();
+	int dayOfMonth = getDayOfMonth() + days;
+
+	// Day of week always rolls forward 1 - 7, like the RTC does
+	int dayOfWeek = (getDayOfWeek() + (int)(days % 7) + 7) % 7;
+
+	if (dayOfMonth >= 1 && dayOfMonth <= daysInMonth(year, month)) {
+		// Common case, no carry into the month
+		setDayOfMonth(dayOfMonth);
+	}
+	else
+	if (dayOfMonth == daysInMonth(year, month) + 1) {
+		// Carry into the next month, such as a relative alarm that goes past midnight on the last day of a month
+		setDayOfMonth(1);
+		if (month == 12) {
+			setMonth(1);
+			setYear(year + 1);
+		}
+		else {
+			setMonth(month + 1);
+		}
+	}
+	else {
+		// More than one month away, go through the day number
+		civilFromDays(daysFromCivil(year, month, getDayOfMonth()) + days, year, month, dayOfMonth);
+		setYear(year);
+		setMonth(month);
+		setDayOfMonth(dayOfMonth);
+	}
+	setDayOfWeek(dayOfWeek);
+}
+
+int64_t MCP79410Time::difference(const MCP79410Time &other) const {
+	int64_t days = daysFromCivil(getYear(), getMonth(), getDayOfMonth()) - daysFromCivil(other.getYear(), other.getMonth(), other.getDayOfMonth());
+
+	int32_t seconds = (getHour() - other.getHour()) * 3600 + (getMinute() - other.getMinute()) * 60 + (getSecond() - other.getSecond());
+
+	return days * 86400 + seconds;
+}
+
+int MCP79410Time::compare(const MCP79410Time &other) const {
+	int64_t diff = difference(other);
+	if (diff < 0) {
+		return -1;
+	}
+	else
+	if (diff > 0) {
+		return +1;
+	}
+	else {
+		return 0;
+	}
+}
+
+void MCP79410Time::setAlarmSecond(int second) {
+	clear();
+	alarmMode = ALARM_SECOND;
+	setSecond(second);
+}
+
+void MCP79410Time::setAlarmMinute(int minute) {
+	clear();
+	alarmMode = ALARM_MINUTE;
+	setMinute(minute);
+}
+
+void MCP79410Time::setAlarmHour(int hour) {
+	clear();
+	alarmMode = ALARM_HOUR;
+	setHour(hour);
+}
+
+void MCP79410Time::setAlarmDayOfWeek(int dayOfWeek) {
+	clear();
+	alarmMode = ALARM_DAY_OF_WEEK;
+	setDayOfWeek(dayOfWeek);
+}
+
+void MCP79410Time::setAlarmDayOfMonth(int dayOfMonth) {
+	clear();
+	alarmMode = ALARM_DAY_OF_MONTH;
+	setDayOfMonth(dayOfMonth);
+}
+
+void MCP79410Time::setAlarmTime(time_t unixTime) {
+	fromUnixTime(unixTime);
 	alarmMode = ALARM_MONTH_DAY_DOW_HMS;
 }
 
+bool MCP79410Time::getNextAlarmTime(time_t after, time_t &next) const {
+	int second = getSecond();
+	int minute = getMinute();
+	int hour = getHour();
+	int dayOfWeek = getDayOfWeek();
+	int dayOfMonth = getDayOfMonth();
+	int month = getMonth();
+
+	// Floor division, so the day and the time within the day are correct for times before 1970 too
+	int64_t days = (int64_t)after / 86400;
+	if ((int64_t)after < 0 && ((int64_t)after % 86400) != 0) {
+		days--;
+	}
+	int64_t dayStart = days * 86400;
+	int64_t result;
+
+	if (alarmMode == ALARM_SECOND) {
+		if (second < 0 || second > 59) {
+			return false;
+		}
+		result = (int64_t)after - ((int64_t)after - dayStart) % 60 + second;
+		if (result <= (int64_t)after) {
+			result += 60;
+		}
+	}
+	else
+	if (alarmMode == ALARM_MINUTE) {
+		if (minute < 0 || minute > 59) {
+			return false;
+		}
+		result = (int64_t)after - ((int64_t)after - dayStart) % 3600 + minute * 60;
+		if (result <= (int64_t)after) {
+			result += 3600;
+		}
+	}
+	else
+	if (alarmMode == ALARM_HOUR) {
+		if (hour < 0 || hour > 23) {
+			return false;
+		}
+		result = dayStart + hour * 3600;
+		if (result <= (int64_t)after) {
+			result += 86400;
+		}
+	}
+	else
+	if (alarmMode == ALARM_DAY_OF_WEEK) {
+		if (dayOfWeek < 0 || dayOfWeek > 6) {
+			return false;
+		}
+		int delta = (dayOfWeek - weekdayFromDays((int32_t)days) + 7) % 7;
+		result = dayStart + (int64_t)delta * 86400;
+		if (result <= (int64_t)after) {
+			result += 7 * 86400;
+		}
+	}
+	else
+	if (alarmMode == ALARM_DAY_OF_MONTH) {
+		if (dayOfMonth < 1 || dayOfMonth > 31) {
+			return false;
+		}
+		int y, m, d;
+		civilFromDays((int32_t)days, y, m, d);
+
+		// Months without that day are skipped, at most 2 in a row (day 31)
+		result = 0;
+		for(int ii = 0; ii < 13 && result == 0; ii++) {
+			if (dayOfMonth <= daysInMonth(y, m)) {
+				int64_t start = (int64_t)daysFromCivil(y, m, dayOfMonth) * 86400;
+				if (start > (int64_t)after) {
+					result = start;
+				}
+			}
+			if (++m > 12) {
+				m = 1;
+				y++;
+			}
+		}
+	}
+	else
+	if (alarmMode == ALARM_MONTH_DAY_DOW_HMS) {
+		if (second < 0 || second > 59 || minute < 0 || minute > 59 || hour < 0 || hour > 23 ||
+			dayOfWeek < 0 || dayOfWeek > 6 || month < 1 || month > 12 || dayOfMonth < 1 || dayOfMonth > daysInMonth(2000, month)) {
+			// daysInMonth(2000, 2) is 29, so February 29 is allowed here
+			return false;
+		}
+		int y, m, d;
+		civilFromDays((int32_t)days, y, m, d);
+
+		// The year is not compared, so look for the first year the date is valid and on the right day of week.
+		// The RTC calendar ends at 2099.
+		result = 0;
+		for(; y <= 2099 && result == 0; y++) {
+			if (dayOfMonth > daysInMonth(y, month)) {
+				continue;
+			}
+			int32_t alarmDays = daysFromCivil(y, month, dayOfMonth);
+			if (weekdayFromDays(alarmDays) != dayOfWeek) {
+				continue;
+			}
+			int64_t t = (int64_t)alarmDays * 86400 + hour * 3600 + minute * 60 + second;
+			if (t > (int64_t)after) {
+				result = t;
+			}
+		}
+	}
+	else {
+		// Reserved ALMxMSK values
+		return false;
+	}
+
+	if (result == 0) {
+		return false;
+	}
+	next = (time_t)result;
+	return true;
+}
+
 String MCP79410Time::toStringRaw() const {
 	char buf[128];
 
@@ -363,66 +1102,755 @@ String MCP79410Time::toStringRaw() const {
 	return String(buf);
 }
 
-// [static]
-int MCP79410Time::bcdToInt(uint8_t value) {
-	return ((value >> 4) & 0xf) * 10 + (value & 0xf);
+// [static]
+int MCP79410Time::bcdToInt(uint8_t value) {
+	return ((value >> 4) & 0xf) * 10 + (value & 0xf);
+}
+
+// [static]
+uint8_t MCP79410Time::intToBcd(int value) {
+	uint8_t result;
+
+	result = (uint8_t) (((value / 10) % 10) << 4);
+
+	result |= (uint8_t) (value % 10);
+
+	return result;
+}
+
+//
+//
+//
+
+// [static]
+MCP79410Schedule MCP79410Schedule::every(uint32_t intervalSec, uint32_t offsetSec) {
+	MCP79410Schedule schedule;
+
+	if (intervalSec != 0) {
+		schedule.kind = KIND_INTERVAL;
+		schedule.intervalSec = intervalSec;
+		schedule.offsetSec = offsetSec % intervalSec;
+	}
+	return schedule;
+}
+
+// [static]
+MCP79410Schedule MCP79410Schedule::everyMinute(int second) {
+	if (!isValidTimeOfDay(0, 0, second)) {
+		return MCP79410Schedule();
+	}
+	return every(60, (uint32_t)second);
+}
+
+// [static]
+MCP79410Schedule MCP79410Schedule::everyHour(int minute, int second) {
+	if (!isValidTimeOfDay(0, minute, second)) {
+		return MCP79410Schedule();
+	}
+	return every(3600, (uint32_t)(minute * 60 + second));
+}
+
+// [static]
+MCP79410Schedule MCP79410Schedule::everyDay(int hour, int minute, int second) {
+	if (!isValidTimeOfDay(hour, minute, second)) {
+		return MCP79410Schedule();
+	}
+	return every(86400, (uint32_t)(hour * 3600 + minute * 60 + second));
+}
+
+// [static]
+MCP79410Schedule MCP79410Schedule::everyWeek(int dayOfWeek, int hour, int minute, int second) {
+	if (dayOfWeek < 0 || dayOfWeek > 6 || !isValidTimeOfDay(hour, minute, second)) {
+		return MCP79410Schedule();
+	}
+
+	// January 1, 1970 was a Thursday (4)
+	uint32_t days = (uint32_t)((dayOfWeek + 3) % 7);
+
+	return every(7 * 86400, days * 86400 + (uint32_t)(hour * 3600 + minute * 60 + second));
+}
+
+// [static]
+MCP79410Schedule MCP79410Schedule::everyMonth(int dayOfMonth, int hour, int minute, int second) {
+	MCP79410Schedule schedule;
+
+	if (dayOfMonth >= 1 && dayOfMonth <= 31 && isValidTimeOfDay(hour, minute, second)) {
+		schedule.kind = KIND_MONTHLY;
+		schedule.dayOfMonth = (uint8_t)dayOfMonth;
+		schedule.offsetSec = (uint32_t)(hour * 3600 + minute * 60 + second);
+	}
+	return schedule;
+}
+
+// [static]
+bool MCP79410Schedule::isValidTimeOfDay(int hour, int minute, int second) {
+	return hour >= 0 && hour <= 23 && minute >= 0 && minute <= 59 && second >= 0 && second <= 59;
+}
+
+bool MCP79410Schedule::isNative() const {
+	MCP79410Time time;
+
+	return getNativeAlarm(time);
+}
+
+bool MCP79410Schedule::getNativeAlarm(MCP79410Time &time) const {
+	if (kind == KIND_MONTHLY) {
+		if (offsetSec == 0) {
+			time.setAlarmDayOfMonth(dayOfMonth);
+			return true;
+		}
+		return false;
+	}
+	if (kind != KIND_INTERVAL) {
+		return false;
+	}
+
+	// The hardware matches one field, with the lower fields 0 because the match starts when that field
+	// changes
+	switch(intervalSec) {
+	case 60:
+		time.setAlarmSecond(offsetSec);
+		return true;
+
+	case 3600:
+		if ((offsetSec % 60) == 0) {
+			time.setAlarmMinute(offsetSec / 60);
+			return true;
+		}
+		break;
+
+	case 86400:
+		if ((offsetSec % 3600) == 0) {
+			time.setAlarmHour(offsetSec / 3600);
+			return true;
+		}
+		break;
+
+	case 7 * 86400:
+		if ((offsetSec % 86400) == 0) {
+			time.setAlarmDayOfWeek(MCP79410Time::weekdayFromDays(offsetSec / 86400));
+			return true;
+		}
+		break;
+	}
+	return false;
+}
+
+time_t MCP79410Schedule::nextAfter(time_t time) const {
+	if (kind == KIND_INTERVAL) {
+		// Floor division, so times before the offset work too
+		int64_t base = (int64_t)time - (int64_t)offsetSec;
+		int64_t count = base / (int64_t)intervalSec;
+		if (base < 0 && (base % (int64_t)intervalSec) != 0) {
+			count--;
+		}
+		return (time_t)((count + 1) * (int64_t)intervalSec + (int64_t)offsetSec);
+	}
+	else
+	if (kind == KIND_MONTHLY) {
+		int64_t days = (int64_t)time / 86400;
+		if ((int64_t)time < 0 && ((int64_t)time % 86400) != 0) {
+			days--;
+		}
+		int year, month, day;
+		MCP79410Time::civilFromDays((int32_t)days, year, month, day);
+
+		// At most 2 months are skipped (day 31), so this always finds one
+		for(int ii = 0; ii < 13; ii++) {
+			if (dayOfMonth <= MCP79410Time::daysInMonth(year, month)) {
+				int64_t result = (int64_t)MCP79410Time::daysFromCivil(year, month, dayOfMonth) * 86400 + offsetSec;
+				if (result > (int64_t)time) {
+					return (time_t)result;
+				}
+			}
+			if (++month > 12) {
+				month = 1;
+				year++;
+			}
+		}
+	}
+	return 0;
+}
+
+//
+//
+//
+
+MCP79410RegisterSnapshot::MCP79410RegisterSnapshot() {
+	memset(raw, 0, sizeof(raw));
+}
+
+MCP79410RegisterSnapshot::~MCP79410RegisterSnapshot() {
+
+}
+
+bool MCP79410RegisterSnapshot::getRTCTime(MCP79410Time &time) const {
+	MCP79410::deviceDecodeTime(&raw[MCP79410::REG_DATE_TIME], time, MCP79410::TIME_MODE_RTC);
+
+	return time.rawYear > 0 && time.getOscillatorRunning();
+}
+
+void MCP79410RegisterSnapshot::getAlarm(int alarmNum, MCP79410Time &time) const {
+	uint8_t reg = (alarmNum == 0) ? MCP79410::REG_ALARM0 : MCP79410::REG_ALARM1;
+
+	MCP79410::deviceDecodeTime(&raw[reg], time, MCP79410::TIME_MODE_ALARM);
+	time.rawYear = raw[MCP79410::REG_DATE_TIME + 6];
+}
+
+bool MCP79410RegisterSnapshot::getInterrupt(int alarmNum) const {
+	uint8_t reg = ((alarmNum == 0) ? MCP79410::REG_ALARM0 : MCP79410::REG_ALARM1) + MCP79410::REG_ALARM_WKDAY_OFFSET;
+
+	return (raw[reg] & MCP79410::REG_ALARM_WKDAY_ALMIF) != 0;
+}
+
+bool MCP79410RegisterSnapshot::getAlarmEnabled(int alarmNum) const {
+	uint8_t bit = (alarmNum == 0) ? MCP79410::REG_CONTROL_ALM0EN : MCP79410::REG_CONTROL_ALM1EN;
+
+	return (raw[MCP79410::REG_CONTROL] & bit) != 0;
+}
+
+void MCP79410RegisterSnapshot::getPowerDownTime(MCP79410Time &time) const {
+	MCP79410::deviceDecodeTime(&raw[MCP79410::REG_POWER_DOWN], time, MCP79410::TIME_MODE_POWER);
+	time.rawYear = raw[MCP79410::REG_DATE_TIME + 6];
+}
+
+void MCP79410RegisterSnapshot::getPowerUpTime(MCP79410Time &time) const {
+	MCP79410::deviceDecodeTime(&raw[MCP79410::REG_POWER_UP], time, MCP79410::TIME_MODE_POWER);
+	time.rawYear = raw[MCP79410::REG_DATE_TIME + 6];
+}
+
+bool MCP79410RegisterSnapshot::getOscillatorRunning() const {
+	return (raw[MCP79410::REG_RTCWKDAY] & MCP79410::REG_RTCWKDAY_OSCRUN) != 0;
+}
+
+bool MCP79410RegisterSnapshot::getPowerFail() const {
+	return (raw[MCP79410::REG_RTCWKDAY] & MCP79410::REG_RTCWKDAY_PWRFAIL) != 0;
+}
+
+bool MCP79410RegisterSnapshot::getBatteryEnable() const {
+	return (raw[MCP79410::REG_RTCWKDAY] & MCP79410::REG_RTCWKDAY_VBATEN) != 0;
+}
+
+uint8_t MCP79410RegisterSnapshot::getControl() const {
+	return raw[MCP79410::REG_CONTROL];
+}
+
+int8_t MCP79410RegisterSnapshot::getOscTrim() const {
+	return MCP79410::oscTrimFromRaw(raw[MCP79410::REG_OSCTRIM]);
+}
+
+uint8_t MCP79410RegisterSnapshot::getOscTrimRaw() const {
+	return raw[MCP79410::REG_OSCTRIM];
+}
+
+//
+//
+//
+
+#ifndef MCP79410_DISABLE_TWOWIRE
+MCP79410::MCP79410(TwoWire &wire) : wireTransport(new MCP79410TwoWireTransport(wire)), transport(wireTransport), sramObj(this), eepromObj(this) {
+
+}
+#endif
+
+MCP79410::MCP79410(MCP79410Transport &transport) : transport(&transport), sramObj(this), eepromObj(this) {
+
+}
+
+
+MCP79410::~MCP79410() {
+	delete busStats;
+#ifndef MCP79410_DISABLE_TWOWIRE
+	delete wireTransport;
+#endif
+}
+
+MCP79410 &MCP79410::withTimeSyncMode(uint8_t timeSyncMode) {
+	this->timeSyncMode = timeSyncMode;
+	return *this;
+}
+
+MCP79410 &MCP79410::withBusStats(bool value) {
+#ifndef MCP79410_DISABLE_BUS_STATS
+	if (value) {
+		if (!busStats) {
+			busStats = new MCP79410BusStats();
+			resetBusStats();
+		}
+	}
+	else {
+		delete busStats;
+		busStats = NULL;
+	}
+#else
+	(void)value;
+#endif
+	return *this;
+}
+
+bool MCP79410::getBusStats(MCP79410BusStats &stats) const {
+	if (busStats) {
+		stats = *busStats;
+		return true;
+	}
+	else {
+		return false;
+	}
+}
+
+void MCP79410::resetBusStats() {
+	if (busStats) {
+		memset(busStats, 0, sizeof(MCP79410BusStats));
+	}
+}
+
+void MCP79410::setup() {
+	transport->begin();
+
+	if (oscTrimCalibration && oscTrimEEPROMAddr >= 0) {
+		// Restore the calibrated trim, in case the RTC lost power
+		uint8_t buf[OSC_TRIM_EEPROM_SIZE];
+		if (eepromObj.readData((size_t)oscTrimEEPROMAddr, buf, sizeof(buf)) &&
+			buf[0] == OSC_TRIM_EEPROM_MAGIC && buf[2] == (uint8_t)~buf[1] && buf[3] == (uint8_t)~OSC_TRIM_EEPROM_MAGIC) {
+			int8_t trim = (int8_t)buf[1];
+			if (getOscTrim() != trim) {
+				setOscTrim(trim);
+				log.info("restored osc trim %d from EEPROM", trim);
+			}
+		}
+	}
+
+	alarmScheduleRestore();
+
+	if (secondsCounterEnabled) {
+		// Square wave mode overrides the alarm output and setSquareWaveMode() clears the alarm enables,
+		// so don't take over MFP if it's being used for alarms
+		uint8_t control;
+		if (alarmInterruptEnabled) {
+			log.error("seconds counter can't be used with withAlarmInterrupt(), not enabled");
+			secondsCounterEnabled = false;
+		}
+		else
+		if (deviceRead(REG_I2C_ADDR, REG_CONTROL, &control, 1) == 0 &&
+			(control & REG_CONTROL_SQWEN) == 0 && (control & (REG_CONTROL_ALM0EN | REG_CONTROL_ALM1EN)) != 0) {
+			log.error("seconds counter can't be used while an alarm is enabled, not enabled");
+			secondsCounterEnabled = false;
+		}
+	}
+
+	if (secondsCounterEnabled) {
+		setSquareWaveMode(SQUARE_WAVE_1_HZ);
+		pinMode(secondsCounterPin, INPUT_PULLUP);
+		attachInterrupt(secondsCounterPin, &MCP79410::secondsCounterISR, this, RISING);
+	}
+
+	if (alarmInterruptEnabled) {
+		pinMode(alarmInterruptPin, INPUT_PULLUP);
+		attachInterrupt(alarmInterruptPin, &MCP79410::alarmInterruptISR, this, alarmInterruptPolarity ? RISING : FALLING);
+
+		// An alarm that went off before the interrupt was attached won't cause an edge
+		alarmInterruptPending = true;
+	}
+
+	if (!Time.isValid()) {
+		if ((timeSyncMode & TIME_SYNC_RTC_TO_TIME) != 0) {
+			time_t rtcTime = getRTCTime();
+			if (rtcTime != 0) {
+				Time.setTime(rtcTime);
+				log.info("set Time from RTC %s", Time.format(rtcTime, TIME_FORMAT_DEFAULT).c_str());
+			}
+		}
+	}
+
+	setupDone = true;
+}
+
+void MCP79410::loop() {
+	eepromObj.loop();
+
+	if (rtcTimeMsEnabled || cachedClock || setPhasePending) {
+		anchorLoop();
+	}
+
+	if (secondsCounterEnabled) {
+		secondsCounterLoop();
+	}
+
+	if (alarmInterruptEnabled) {
+		alarmInterruptLoop();
+	}
+
+	alarmScheduleLoop();
+
+	systemSecondLoop();
+
+	timeSyncLoop();
+}
+
+void MCP79410::secondsCounterISR() {
+	secondsCounter = secondsCounter + 1;
+	secondsCounterEdgeMs = millis();
+}
+
+void MCP79410::secondsCounterLoop() {
+	uint32_t count = secondsCounter;
+
+	bool newEdge = (count != secondsCounterLastSeen);
+	secondsCounterLastSeen = count;
+
+	if (secondsCounterBaseValid && millis() - secondsCounterVerifyMs < secondsCounterVerifyIntervalMs) {
+		return;
+	}
+
+	// Read the RTC right after an edge, so the edge and the seconds increment are not close to each
+	// other. The relationship between them is the same for every read, so the counter matches the RTC
+	// seconds even if the edge is not exactly at the increment.
+	if (!newEdge || millis() - secondsCounterEdgeMs > SECONDS_COUNTER_READ_WINDOW_MS) {
+		return;
+	}
+
+	MCP79410Time time;
+	if (!getRTCTime(time)) {
+		secondsCounterBaseValid = false;
+		secondsCounterVerifyMs = millis();
+		return;
+	}
+	if (secondsCounter != count) {
+		// Another edge during the read, try again on the next one
+		return;
+	}
+
+	time_t base = time.toUnixTime() - (time_t)count;
+	if (secondsCounterBaseValid && base != secondsCounterBase) {
+		// Read the RTC instead until the counter is matched again on the next edge
+		secondsCounterBaseValid = false;
+		secondsCounterMismatches++;
+		log.info("seconds counter off by %ld seconds", (long)(secondsCounterBase - base));
+
+		if (secondsCounterMismatches >= SECONDS_COUNTER_MAX_MISMATCHES) {
+			log.error("seconds counter mismatched %lu times, disabling it", (unsigned long)secondsCounterMismatches);
+			detachInterrupt(secondsCounterPin);
+			secondsCounterEnabled = false;
+		}
+		return;
+	}
+
+	ATOMIC_BLOCK() {
+		secondsCounterBase = base;
+		secondsCounterBaseValid = true;
+	}
+	secondsCounterVerifyMs = millis();
+}
+
+void MCP79410::alarmInterruptISR() {
+	alarmInterruptPending = true;
+}
+
+void MCP79410::alarmInterruptLoop() {
+	if (!alarmInterruptPending) {
+		return;
+	}
+	// Cleared before reading, so an alarm that goes off while handling this one is handled next time
+	alarmInterruptPending = false;
+
+	// One read gets ALM0WKDAY through ALM1WKDAY (0x0d - 0x14)
+	uint8_t regs[REG_ALARM1 + REG_ALARM_WKDAY_OFFSET - (REG_ALARM0 + REG_ALARM_WKDAY_OFFSET) + 1];
+	uint8_t reg = getAlarmRegister(0, REG_ALARM_WKDAY_OFFSET);
+	if (deviceRead(REG_I2C_ADDR, reg, regs, sizeof(regs)) != 0) {
+		// Try again on the next loop
+		alarmInterruptPending = true;
+		return;
+	}
+
+	uint8_t wkday[2] = { regs[0], regs[sizeof(regs) - 1] };
+	bool fired[2];
+
+	// Clear the flags by writing only the ALMxWKDAY register of each alarm with a flag set, so an alarm that
+	// goes off between the read and the write isn't lost, and the other alarm registers aren't written back
+	// in case setAlarm() changed them in between.
+	for(int alarmNum = 0; alarmNum < 2; alarmNum++) {
+		fired[alarmNum] = (wkday[alarmNum] & REG_ALARM_WKDAY_ALMIF) != 0;
+		if (fired[alarmNum] &&
+			deviceWriteRegisterByte(getAlarmRegister(alarmNum, REG_ALARM_WKDAY_OFFSET), wkday[alarmNum] & ~REG_ALARM_WKDAY_ALMIF) != 0) {
+			// Still set, try again on the next loop
+			fired[alarmNum] = false;
+			alarmInterruptPending = true;
+		}
+	}
+
+	for(int alarmNum = 0; alarmNum < 2; alarmNum++) {
+		if (!fired[alarmNum]) {
+			continue;
+		}
+		// Non-native recurring alarm, set it for the next occurrence now that the flag is cleared
+		if (alarmScheduleNext[alarmNum] != 0 && !setAlarm(alarmSchedule[alarmNum], alarmSchedulePolarity[alarmNum], alarmNum)) {
+			alarmScheduleRetry(alarmNum);
+		}
+	}
+
+	// MFP is asserted while either flag is set. If the other alarm went off between the read and the write,
+	// MFP never deasserted, so there won't be another edge. Handle it on the next loop instead.
+	if (digitalRead(alarmInterruptPin) == (alarmInterruptPolarity ? HIGH : LOW)) {
+		alarmInterruptPending = true;
+	}
+
+	for(int alarmNum = 0; alarmNum < 2; alarmNum++) {
+		if (fired[alarmNum] && alarmCallback[alarmNum]) {
+			alarmCallback[alarmNum](alarmNum);
+		}
+	}
+}
+
+time_t MCP79410::getSecondsCounterTime() const {
+	time_t result = 0;
+
+	ATOMIC_BLOCK() {
+		if (secondsCounterBaseValid && millis() - secondsCounterEdgeMs <= SECONDS_COUNTER_TIMEOUT_MS) {
+			result = secondsCounterBase + (time_t)secondsCounter;
+		}
+	}
+	return result;
+}
+
+void MCP79410::timeSyncLoop() {
+	if (timeSyncState == TIME_SYNC_STATE_IDLE) {
+		// Also check timeSyncedLast, because if we set Time from RTC, then Time will
+		// be valid, but not synchronized yet
+		unsigned long lastSync = Particle.timeSyncedLast();
+		if (Time.isValid() && lastSync != 0 && lastSync != timeSyncedLastSeen) {
+			// Time is valid and was synchronized since last time
+			timeSyncedLastSeen = lastSync;
+
+			if ((timeSyncMode & TIME_SYNC_CLOUD_TO_RTC) == 0) {
+				timeSet = true;
+			}
+			else
+			if (!timeSet) {
+				timeSyncState = TIME_SYNC_STATE_WRITE;
+			}
+			else
+			if (resyncThresholdMs != 0) {
+				timeSyncState = TIME_SYNC_STATE_MEASURE;
+			}
+			timeSyncWaitStartMs = millis();
+		}
+		return;
+	}
+
+	// If loop() is called too infrequently to see Time.now() change, just go ahead after 3 seconds
+	bool waitedTooLong = (millis() - timeSyncWaitStartMs >= 3000);
+
+	if (timeSyncState == TIME_SYNC_STATE_MEASURE) {
+		// With an anchor, the error can be measured any time. Otherwise, read the RTC in the middle of the
+		// system clock second so the whole-second RTC value rounds to the nearest second.
+		if (!hasRTCTimeMsAnchor() && !waitedTooLong &&
+			(!systemSecondEdgeValid || millis() - systemSecondEdgeMs < 500)) {
+			return;
+		}
+
+		int32_t errorMs;
+		bool precise;
+		if (!measureRTCError(errorMs, precise)) {
+			// RTC is not valid, set it
+			timeSyncState = TIME_SYNC_STATE_WRITE;
+			timeSyncWaitStartMs = millis();
+			return;
+		}
+		log.info("RTC error %ld ms (%s)", (long)errorMs, precise ? "precise" : "to the second");
+
+		if ((unsigned long)(errorMs < 0 ? -errorMs : errorMs) > resyncThresholdMs) {
+			addSyncError(errorMs, precise, true);
+			timeSyncState = TIME_SYNC_STATE_WRITE;
+			timeSyncWaitStartMs = millis();
+		}
+		else {
+			addSyncError(errorMs, precise, false);
+			timeSyncState = TIME_SYNC_STATE_IDLE;
+		}
+		return;
+	}
+
+	if (timeSyncState == TIME_SYNC_STATE_WRITE) {
+		// Wait until just before the next Time.now() change so setRTCFromCloud() only blocks briefly
+		if (!waitedTooLong &&
+			(!systemSecondEdgeValid || millis() - systemSecondEdgeMs < 1000 - SET_ALIGN_LEAD_MS)) {
+			return;
+		}
+
+		if (!timeSet) {
+			// Record the error at the first sync as well, if the RTC was valid
+			int32_t errorMs;
+			bool precise;
+			if (measureRTCError(errorMs, precise)) {
+				addSyncError(errorMs, precise, true);
+			}
+		}
+
+		setRTCFromCloud();
+		timeSet = true;
+		timeSyncState = TIME_SYNC_STATE_IDLE;
+	}
+}
+
+bool MCP79410::measureRTCError(int32_t &errorMs, bool &precise) {
+	// Only use the anchor if loop() has been keeping it up to date
+	bool anchorFresh = hasRTCTimeMsAnchor() && (millis() - anchorMs) <= anchorResyncIntervalMs + 5000;
+
+	if (anchorFresh && systemSecondEdgeValid) {
+		uint64_t rtcMs = getRTCTimeMs();
+		uint64_t systemMs = (uint64_t)Time.now() * 1000 + (millis() - systemSecondEdgeMs);
+
+		errorMs = (int32_t)((int64_t)rtcMs - (int64_t)systemMs);
+		precise = true;
+		return true;
+	}
+
+	// Single read. This always reads the chip, even with the cached clock.
+	MCP79410Time time;
+	if (!getRTCTime(time)) {
+		return false;
+	}
+	// Limit to what fits in errorMs, about 24 days
+	int64_t diff = (int64_t)(time.toUnixTime() - Time.now());
+	if (diff > 2000000) {
+		diff = 2000000;
+	}
+	else
+	if (diff < -2000000) {
+		diff = -2000000;
+	}
+	errorMs = (int32_t)diff * 1000;
+	precise = false;
+	return true;
+}
+
+void MCP79410::addSyncError(int32_t errorMs, bool precise, bool corrected) {
+	MCP79410SyncError &entry = syncErrors[syncErrorNext];
+
+	entry.time = Time.now();
+	entry.errorMs = errorMs;
+	entry.residualMs = corrected ? 0 : errorMs;
+	entry.precise = precise;
+	entry.corrected = corrected;
+
+	if (oscTrimCalibration) {
+		oscTrimCalibrationUpdate(entry);
+	}
+
+	syncErrorNext = (syncErrorNext + 1) % SYNC_ERROR_HISTORY;
+	if (syncErrorCount < SYNC_ERROR_HISTORY) {
+		syncErrorCount++;
+	}
 }
 
-// [static]
-uint8_t MCP79410Time::intToBcd(int value) {
-	uint8_t result;
+void MCP79410::oscTrimCalibrationUpdate(const MCP79410SyncError &entry) {
+	// How precisely this measurement of the RTC relative to the system clock is known
+	uint32_t measurementUncertaintyMs = entry.precise ? 2 : 1000;
 
-	result = (uint8_t) (((value / 10) % 10) << 4);
+	if (oscTrimBaseValid && entry.time > oscTrimBaseTime) {
+		// Error accumulated since the starting point with the current trim, adding back any corrections
+		// made by rewriting the RTC
+		int32_t elapsedSec = (int32_t)(entry.time - oscTrimBaseTime);
+		float ppm = (float)(entry.errorMs + oscTrimCorrectionMs - oscTrimBaseErrorMs) * 1000.0f / (float)elapsedSec;
 
-	result |= (uint8_t) (value % 10);
+		// Cloud time is set in whole seconds, so the system clock can be off by up to a second at both
+		// ends of the interval, in addition to the uncertainty of each measurement
+		uint32_t uncertaintyMs = 2 * OSC_TRIM_SYNC_UNCERTAINTY_MS + oscTrimUncertaintyMs + measurementUncertaintyMs;
+		float uncertaintyPpm = (float)uncertaintyMs * 1000.0f / (float)elapsedSec;
 
-	return result;
-}
+		// log.trace("osc trim calibration %.2f ppm +/- %.2f over %ld sec", ppm, uncertaintyPpm, (long)elapsedSec);
 
-//
-//
-//
+		// Adjust once the measurement is accurate, or earlier if the error is large compared to the
+		// uncertainty. In that case the trim converges over several adjustments.
+		if (uncertaintyPpm <= OSC_TRIM_MAX_UNCERTAINTY_PPM || uncertaintyPpm * 4 <= (ppm >= 0 ? ppm : -ppm)) {
+			if (ppm >= OSC_TRIM_PPM_PER_STEP / 2 || ppm <= -OSC_TRIM_PPM_PER_STEP / 2) {
+				calibrateOscTrim(ppm);
+				// Start a new measurement with the new trim
+				oscTrimBaseValid = false;
+			}
+			else {
+				lastOscTrimCalibrationPpm = ppm;
+			}
+		}
+	}
 
-MCP79410::MCP79410(TwoWire &wire) : wire(wire), sramObj(this), eepromObj(this) {
+	if (!oscTrimBaseValid) {
+		// New starting point
+		oscTrimBaseValid = true;
+		oscTrimBaseTime = entry.time;
+		oscTrimBaseErrorMs = entry.residualMs;
+		oscTrimCorrectionMs = 0;
+		oscTrimUncertaintyMs = measurementUncertaintyMs;
+	}
+	else
+	if (entry.corrected) {
+		// Keep the starting point, but remember how much error was removed by rewriting the RTC
+		oscTrimCorrectionMs += entry.errorMs - entry.residualMs;
+		oscTrimUncertaintyMs += measurementUncertaintyMs;
+	}
 
+	// After rewriting the RTC, the remaining error is the set phase error, which is measured a few
+	// seconds later by loop()
+	oscTrimPhasePending = entry.corrected;
 }
 
+int8_t MCP79410::getOscTrim() const {
+	return oscTrimFromRaw(deviceReadRegisterByte(REG_OSCTRIM));
+}
 
-MCP79410::~MCP79410() {
+bool MCP79410::calibrateOscTrim(float measuredPpm) {
+	lastOscTrimCalibrationPpm = measuredPpm;
 
-}
+	// Positive trim adds clocks (speeds up the RTC), so a fast RTC needs a lower trim
+	float steps = measuredPpm / OSC_TRIM_PPM_PER_STEP;
+	int trim = (int)getOscTrim() - (int)((steps >= 0) ? (steps + 0.5f) : (steps - 0.5f));
+	if (trim > 127) {
+		trim = 127;
+	}
+	else
+	if (trim < -127) {
+		trim = -127;
+	}
+	log.info("osc trim calibration %.2f ppm, setting trim to %d", measuredPpm, trim);
 
-void MCP79410::setup() {
-	wire.begin();
+	// Coarse trim is much too coarse for crystal error, make sure it's off
+	if (deviceWriteRegisterFlag(REG_CONTROL, REG_CONTROL_CRSTRIM, false) != 0) {
+		return false;
+	}
+	if (!setOscTrim((int8_t)trim)) {
+		return false;
+	}
 
-	if (!Time.isValid()) {
-		if ((timeSyncMode & TIME_SYNC_RTC_TO_TIME) != 0) {
-			time_t rtcTime = getRTCTime();
-			if (rtcTime != 0) {
-				Time.setTime(rtcTime);
-				log.info("set Time from RTC %s", Time.format(rtcTime, TIME_FORMAT_DEFAULT).c_str());
-			}
+	// The RTC rate changed, so the drift relative to millis() needs to be measured again
+	anchorState = ANCHOR_STATE_NONE;
+	anchorDriftPpm = 0;
+	anchorDriftIntervalMs = 0;
+
+	if (oscTrimEEPROMAddr >= 0) {
+		uint8_t buf[OSC_TRIM_EEPROM_SIZE];
+		buf[0] = OSC_TRIM_EEPROM_MAGIC;
+		buf[1] = (uint8_t)(int8_t)trim;
+		buf[2] = (uint8_t)~buf[1];
+		buf[3] = (uint8_t)~OSC_TRIM_EEPROM_MAGIC;
+
+		if (!eepromObj.writeData((size_t)oscTrimEEPROMAddr, buf, sizeof(buf))) {
+			log.info("failed to store osc trim in EEPROM");
 		}
 	}
-
-	setupDone = true;
+	return true;
 }
 
-void MCP79410::loop() {
-	if (!timeSet) {
-		// Time has not been synchronized from the cloud
-		if (Time.isValid()) {
-			// Also check timeSyncedLast, because if we set Time from RTC, then Time will
-			// be valid, but not synchronized yet
-			unsigned long lastSync = Particle.timeSyncedLast();
-			if (lastSync != 0) {
-				// Time is valid and synchronized
-				if ((timeSyncMode & TIME_SYNC_CLOUD_TO_RTC) != 0) {
-					setRTCFromCloud();
-				}
-				timeSet = true;
-			}
-		}
+void MCP79410::systemSecondLoop() {
+	time_t now = Time.now();
+	if (now != systemSecondLast) {
+		// Only valid if we saw the previous second too, otherwise this is not a change
+		systemSecondEdgeValid = (systemSecondLast != 0 && now == systemSecondLast + 1);
+		systemSecondEdgeMs = millis();
+		systemSecondLast = now;
+	}
+	else
+	if (millis() - systemSecondEdgeMs > 2000) {
+		systemSecondEdgeValid = false;
 	}
 }
 
@@ -430,8 +1858,45 @@ bool MCP79410::setRTCFromCloud() {
 	bool bResult = false;
 
 	if (Time.isValid()) {
-		time_t now = Time.now();
+		// Writing the time registers does not reset the divider chain, so the RTC second would roll over at
+		// the same point as before. Stopping the oscillator first resets it, and the second starts over
+		// when the write below sets ST again.
+		if (deviceStopOscillator() != 0) {
+			log.info("oscillator did not stop, the set phase error may be up to a second");
+		}
+
+		// Wait for the system clock second to change so the RTC starts the second at the same time
+		time_t start = Time.now();
+		time_t now = start;
+		unsigned long startMs = millis();
+		while(now == start && millis() - startMs < 1100) {
+			os_thread_yield();
+			now = Time.now();
+		}
+		unsigned long edgeMs = millis();
+		if (now == start) {
+			// Not aligned, but don't write a time from before the wait
+			log.info("system clock second did not change, setting RTC without aligning");
+			now = Time.now();
+		}
+
+		// setRTCTime writes all of the time registers, starting with the seconds (with ST set), in one transaction
 		bResult = setRTCTime(now);
+		if (!bResult) {
+			// Don't leave the RTC stopped. The time is the old time plus however long it was stopped.
+			if (deviceWriteRegisterFlag(REG_DATE_RTCSEC, REG_DATE_RTCSEC_ST, true) != 0) {
+				log.error("failed to set RTC and to restart the oscillator");
+			}
+		}
+
+		if (bResult && now != start) {
+			// Measure when the RTC seconds roll over from loop(), relative to edgeMs
+			setEdgeMs = edgeMs;
+			setPhasePending = true;
+			setPhaseValid = false;
+			anchorExpectedMs = edgeMs + 1000;
+			anchorState = ANCHOR_STATE_FINE;
+		}
 
 		log.info("set RTC from cloud %s", Time.format(now, TIME_FORMAT_DEFAULT).c_str());
 	}
@@ -441,6 +1906,29 @@ bool MCP79410::setRTCFromCloud() {
 	return bResult;
 }
 
+int MCP79410::deviceStopOscillator() {
+	int stat = deviceWriteRegisterFlag(REG_DATE_RTCSEC, REG_DATE_RTCSEC_ST, false);
+	if (stat != 0) {
+		return stat;
+	}
+
+	unsigned long startMs = millis();
+	while(true) {
+		uint8_t wkday;
+		stat = deviceRead(REG_I2C_ADDR, REG_RTCWKDAY, &wkday, 1);
+		if (stat != 0) {
+			return stat;
+		}
+		if ((wkday & REG_RTCWKDAY_OSCRUN) == 0) {
+			return 0;
+		}
+		if (millis() - startMs >= OSC_STOP_TIMEOUT_MS) {
+			return ERROR_TIMEOUT;
+		}
+		os_thread_yield();
+	}
+}
+
 bool MCP79410::setRTCTime(time_t unixTime) {
 	MCP79410Time time;
 
@@ -457,16 +1945,313 @@ bool MCP79410::setRTCTime(time_t unixTime) {
 		time.rawDayOfWeek &= ~REG_RTCWKDAY_VBATEN;
 	}
 
+	// The seconds rollover moves when the time is set, so the anchor for getRTCTimeMs() and the seconds
+	// counter are no longer valid
+	anchorState = ANCHOR_STATE_NONE;
+	secondsCounterBaseValid = false;
+
+	// Recurring alarms that are not native were set for a time calculated from the old time, so make
+	// loop() set them again
+	for(int alarmNum = 0; alarmNum < 2; alarmNum++) {
+		if (alarmScheduleNext[alarmNum] != 0) {
+			alarmScheduleNext[alarmNum] = 1;
+			alarmScheduleWait(alarmNum, 0);
+		}
+	}
+
 	return deviceWriteRTCTime(REG_DATE_TIME, time) == 0;
 }
 
+bool MCP79410::syncRTCTimeMs(unsigned long timeoutMs) {
+	unsigned long edgeMs;
+
+	if (deviceWaitSecondEdge(timeoutMs, edgeMs) == 0 && anchorSet(edgeMs)) {
+		return true;
+	}
+	else {
+		anchorState = ANCHOR_STATE_NONE;
+		return false;
+	}
+}
+
+uint64_t MCP79410::getRTCTimeMs() const {
+	time_t time;
+	unsigned long ms;
+	float driftPpm;
+
+	if (!hasRTCTimeMsAnchor()) {
+		return 0;
+	}
+
+	// loop() can update the anchor from a different thread
+	ATOMIC_BLOCK() {
+		time = anchorTime;
+		ms = anchorMs;
+		driftPpm = anchorDriftPpm;
+	}
+
+	int64_t elapsed = (int64_t)(millis() - ms);
+	elapsed += (int64_t)((float)elapsed * driftPpm / 1000000.0);
+
+	return (uint64_t)time * 1000 + elapsed;
+}
+
+int MCP79410::deviceWaitSecondEdge(unsigned long timeoutMs, unsigned long &edgeMs) const {
+	uint8_t first, cur;
+
+	unsigned long startMs = millis();
+
+	int stat = deviceRead(REG_I2C_ADDR, REG_DATE_RTCSEC, &first, 1);
+	if (stat != 0) {
+		return stat;
+	}
+
+	while(millis() - startMs < timeoutMs) {
+		unsigned long readMs = millis();
+
+		stat = deviceRead(REG_I2C_ADDR, REG_DATE_RTCSEC, &cur, 1);
+		if (stat != 0) {
+			return stat;
+		}
+		// High bit is ST
+		if ((cur & 0x7f) != (first & 0x7f)) {
+			edgeMs = readMs;
+			return 0;
+		}
+	}
+
+	return ERROR_TIMEOUT;
+}
+
+bool MCP79410::anchorSet(unsigned long edgeMs) {
+	MCP79410Time time;
+
+	if (!getRTCTime(time)) {
+		anchorState = ANCHOR_STATE_NONE;
+		return false;
+	}
+	time_t rtcTime = time.toUnixTime();
+
+	if (hasRTCTimeMsAnchor()) {
+		// Compare the measured rollover to the prediction from the old anchor
+		unsigned long elapsedMs = edgeMs - anchorMs;
+		int64_t rtcElapsedMs = (int64_t)(rtcTime - anchorTime) * 1000;
+
+		int64_t predictedMs = (int64_t)elapsedMs + (int64_t)((float)elapsedMs * anchorDriftPpm / 1000000.0);
+		lastAnchorOffsetMs = (int32_t)(predictedMs - rtcElapsedMs);
+
+		if (elapsedMs >= ANCHOR_MIN_DRIFT_INTERVAL_MS && rtcElapsedMs > 0) {
+			float driftPpm = (float)(rtcElapsedMs - (int64_t)elapsedMs) * 1000000.0f / (float)elapsedMs;
+			if (anchorDriftIntervalMs == 0) {
+				anchorDriftPpm = driftPpm;
+				anchorDriftIntervalMs = elapsedMs;
+			}
+			else {
+				// Average with the previous measurements, weighted by interval. The weight of the previous
+				// measurements is limited so the drift still follows temperature changes.
+				unsigned long prevWeightMs = (anchorDriftIntervalMs < ANCHOR_DRIFT_FILTER_MS) ? anchorDriftIntervalMs : ANCHOR_DRIFT_FILTER_MS;
+				anchorDriftPpm = (anchorDriftPpm * (float)prevWeightMs + driftPpm * (float)elapsedMs) / (float)(prevWeightMs + elapsedMs);
+				anchorDriftIntervalMs = prevWeightMs + elapsedMs;
+			}
+		}
+		// log.trace("anchor offset=%ld ms drift=%.1f ppm", (long)lastAnchorOffsetMs, anchorDriftPpm);
+	}
+
+	bool phaseOnly = false;
+	if (setPhasePending) {
+		phaseOnly = !rtcTimeMsEnabled && !cachedClock;
+
+		// RTC seconds rollover relative to the system clock seconds rollover when the RTC was set
+		int32_t phase = (int32_t)((edgeMs - setEdgeMs) % 1000);
+		lastSetPhaseErrorMs = (phase > 500) ? phase - 1000 : phase;
+		setPhasePending = false;
+		setPhaseValid = true;
+
+		if (oscTrimPhasePending) {
+			// The RTC was left behind the system clock by the phase error, so that much less error
+			// was removed by the correction
+			oscTrimCorrectionMs += lastSetPhaseErrorMs;
+			oscTrimPhasePending = false;
+		}
+		log.info("RTC set phase error %ld ms", (long)lastSetPhaseErrorMs);
+	}
+
+	if (phaseOnly) {
+		// Only measuring the set phase error, loop() won't maintain the anchor
+		anchorState = ANCHOR_STATE_NONE;
+		return true;
+	}
+
+	ATOMIC_BLOCK() {
+		anchorTime = rtcTime;
+		anchorMs = edgeMs;
+	}
+	anchorState = ANCHOR_STATE_VALID;
+
+	return true;
+}
+
+void MCP79410::anchorLoop() {
+	switch(anchorState) {
+	case ANCHOR_STATE_NONE:
+	case ANCHOR_STATE_RESYNC_START:
+		if (anchorState == ANCHOR_STATE_NONE && anchorRetryWait && millis() - anchorCoarseMs < ANCHOR_RETRY_MS) {
+			break;
+		}
+		anchorRetryWait = false;
+
+		anchorCoarseMs = anchorCoarseStartMs = millis();
+		if (deviceRead(REG_I2C_ADDR, REG_DATE_RTCSEC, &anchorCoarseSecond, 1) == 0) {
+			anchorState = (anchorState == ANCHOR_STATE_RESYNC_START) ? ANCHOR_STATE_RESYNC_COARSE : ANCHOR_STATE_COARSE;
+		}
+		else {
+			anchorState = ANCHOR_STATE_NONE;
+			anchorRetryWait = true;
+		}
+		break;
+
+	case ANCHOR_STATE_COARSE:
+	case ANCHOR_STATE_RESYNC_COARSE:
+		if (millis() - anchorCoarseMs >= ANCHOR_COARSE_POLL_MS) {
+			uint8_t second;
+			unsigned long prevMs = anchorCoarseMs;
+
+			anchorCoarseMs = millis();
+			if (deviceRead(REG_I2C_ADDR, REG_DATE_RTCSEC, &second, 1) != 0) {
+				anchorState = ANCHOR_STATE_NONE;
+			}
+			else
+			if (anchorCoarseMs - prevMs > 2 * ANCHOR_COARSE_POLL_MS) {
+				// loop() was not called often enough to locate the rollover, keep polling from here
+				anchorCoarseSecond = second;
+				anchorCoarseStartMs = anchorCoarseMs;
+			}
+			else
+			if ((second & 0x7f) != (anchorCoarseSecond & 0x7f)) {
+				// Rollover was between prevMs and anchorCoarseMs, so the next one is around 1 second later
+				anchorExpectedMs = prevMs + (anchorCoarseMs - prevMs) / 2 + 1000;
+				anchorState = (anchorState == ANCHOR_STATE_RESYNC_COARSE) ? ANCHOR_STATE_RESYNC : ANCHOR_STATE_FINE;
+			}
+			else
+			if (anchorCoarseMs - anchorCoarseStartMs > 1500) {
+				// Seconds did not change, the oscillator is probably not running. Try again later.
+				anchorState = ANCHOR_STATE_NONE;
+				anchorRetryWait = true;
+			}
+		}
+		break;
+
+	case ANCHOR_STATE_FINE:
+	case ANCHOR_STATE_RESYNC: {
+		long untilMs = (long)(anchorExpectedMs - millis());
+		if (untilMs > (long)ANCHOR_FINE_WINDOW_MS) {
+			// Not time yet
+			break;
+		}
+		if (untilMs < 0) {
+			// Missed the window because loop() was not called in time, try the next second
+			if (anchorState == ANCHOR_STATE_RESYNC) {
+				// Predict it from the anchor again, which includes the drift since the last prediction
+				uint64_t rtcMs = getRTCTimeMs();
+				anchorExpectedMs = millis() + (unsigned long)(1000 - (rtcMs % 1000));
+			}
+			else {
+				anchorExpectedMs += 1000;
+			}
+			break;
+		}
+
+		unsigned long edgeMs;
+		if (deviceWaitSecondEdge(untilMs + ANCHOR_FINE_WINDOW_MS, edgeMs) != 0 || !anchorSet(edgeMs)) {
+			// Did not see the rollover where expected, start over
+			log.info("anchor rollover not found, starting over");
+			anchorState = ANCHOR_STATE_NONE;
+			anchorRetryWait = false;
+		}
+		break;
+	}
+
+	case ANCHOR_STATE_VALID: {
+		unsigned long resyncMs = anchorResyncIntervalMs;
+		if (cachedClock) {
+			// Resync early enough that the cached clock stays within its error bound. Finding the
+			// rollover can take up to a second after this.
+			unsigned long maxAgeMs = anchorMaxAgeMs();
+			maxAgeMs = (maxAgeMs > 2000) ? maxAgeMs - 2000 : 0;
+			if (maxAgeMs < resyncMs) {
+				resyncMs = maxAgeMs;
+			}
+		}
+		unsigned long ageMs = millis() - anchorMs;
+		if (ageMs >= resyncMs) {
+			if ((float)ageMs * anchorUncertaintyPpm() / 1000000.0f < (float)(ANCHOR_FINE_WINDOW_MS / 2)) {
+				// Predict when the RTC second will roll over next, using the current anchor
+				uint64_t rtcMs = getRTCTimeMs();
+				anchorExpectedMs = millis() + (unsigned long)(1000 - (rtcMs % 1000));
+				anchorState = ANCHOR_STATE_RESYNC;
+			}
+			else {
+				// The drift is not known well enough to predict the rollover within the fine window
+				// (for example, before it has been measured), so find it by polling first. The anchor
+				// stays valid while doing this.
+				anchorState = ANCHOR_STATE_RESYNC_START;
+			}
+		}
+		break;
+	}
+	}
+}
+
+float MCP79410::anchorUncertaintyPpm() const {
+	// The ms resolution of the drift measurement over the measurement interval, plus a few ppm
+	// for temperature changes
+	if (anchorDriftIntervalMs != 0) {
+		return 2.0f * 1000000.0f / (float)anchorDriftIntervalMs + 2.0f;
+	}
+	else {
+		return (float)ANCHOR_UNKNOWN_DRIFT_PPM;
+	}
+}
+
+unsigned long MCP79410::anchorMaxAgeMs() const {
+	// The anchor itself is accurate to about 1 ms. After that, the error grows with the uncertainty
+	// of the drift.
+	float uncertaintyPpm = anchorUncertaintyPpm();
+
+	if (cachedClockErrorBoundMs <= 1) {
+		return 0;
+	}
+	float maxAgeMs = (float)(cachedClockErrorBoundMs - 1) * 1000000.0f / uncertaintyPpm;
+
+	return (maxAgeMs < 2000000000.0f) ? (unsigned long)maxAgeMs : 2000000000UL;
+}
+
 bool MCP79410::isRTCValid() const {
-	return getRTCTime() != 0;
+	if (secondsCounterEnabled && getSecondsCounterTime() != 0) {
+		// Edges on the 1 Hz output show the oscillator is running
+		return true;
+	}
+
+	// Not served from the cached clock, which doesn't see OSCRUN between resyncs
+	MCP79410Time time;
+	return getRTCTime(time);
 }
 
 time_t MCP79410::getRTCTime() const {
 	MCP79410Time time;
 
+	if (secondsCounterEnabled) {
+		time_t result = getSecondsCounterTime();
+		if (result != 0) {
+			return result;
+		}
+	}
+
+	if (cachedClock && hasRTCTimeMsAnchor() && millis() - anchorMs < anchorMaxAgeMs()) {
+		// Extrapolate from the anchor without accessing the bus
+		return (time_t)(getRTCTimeMs() / 1000);
+	}
+
 	bool bResult = getRTCTime(time);
 	if (bResult) {
 		return time.toUnixTime();
@@ -479,7 +2264,9 @@ time_t MCP79410::getRTCTime() const {
 bool MCP79410::getRTCTime(MCP79410Time &time) const {
 	int stat = deviceReadTime(REG_DATE_TIME, time, TIME_MODE_RTC);
 	if (stat == 0) {
-		if (time.rawYear > 0 && getOscillatorRunning()) {
+		// OSCRUN is in the RTCWKDAY register, which is included in the time read, so there's no
+		// need to read it again using getOscillatorRunning().
+		if (time.rawYear > 0 && time.getOscillatorRunning()) {
 			return true;
 		}
 		else {
@@ -494,6 +2281,10 @@ bool MCP79410::getRTCTime(MCP79410Time &time) const {
 /**
  *
  */
+bool MCP79410::readRegisterSnapshot(MCP79410RegisterSnapshot &snapshot) const {
+	return deviceRead(REG_I2C_ADDR, REG_DATE_TIME, snapshot.raw, sizeof(snapshot.raw)) == 0;
+}
+
 bool MCP79410::getPowerDownTime(MCP79410Time &time) const {
 	return deviceReadTime(REG_POWER_DOWN, time, TIME_MODE_POWER) == 0;
 }
@@ -525,87 +2316,354 @@ bool MCP79410::setBatteryEnable(bool value /* = true */) {
 		return deviceWriteRegisterFlag(REG_RTCWKDAY, REG_RTCWKDAY_VBATEN, value) == 0;
 	}
 	else {
-		return true;
+		return true;
+	}
+}
+
+
+bool MCP79410::clearAlarm(int alarmNum) {
+	if (alarmNum < 0 || alarmNum > 1) {
+		// Invalid alarmNum, must be 0 or 1
+		return false;
+	}
+
+	alarmScheduleStop(alarmNum);
+
+	return deviceWriteRegisterFlag(REG_CONTROL, getAlarmEnableBit(alarmNum), false) == 0;
+}
+
+bool MCP79410::setAlarm(const MCP79410Time &time, bool polarity, int alarmNum) {
+	if (alarmNum < 0 || alarmNum > 1) {
+		// Invalid alarmNum, must be 0 or 1
+		return false;
+	}
+	alarmScheduleStop(alarmNum);
+
+	// One read gets OSCRUN (in RTCWKDAY) and the control register
+	uint8_t regs[REG_CONTROL + 1];
+	if (deviceRead(REG_I2C_ADDR, REG_DATE_TIME, regs, sizeof(regs)) != 0 || (regs[REG_RTCWKDAY] & REG_RTCWKDAY_OSCRUN) == 0) {
+		// RTC is not running, cannot set an alarm
+		return false;
+	}
+
+	return deviceWriteAlarm(time, polarity, alarmNum, regs[REG_CONTROL]) == 0;
+}
+
+bool MCP79410::setAlarm(int secondsFromNow, bool polarity, int alarmNum) {
+	// log.trace("setAlarm secondsFromNow=%d polarity=%d alarmNum=%d", secondsFromNow, polarity, alarmNum);
+	if (alarmNum < 0 || alarmNum > 1) {
+		// Invalid alarmNum, must be 0 or 1
+		return false;
+	}
+	alarmScheduleStop(alarmNum);
+
+	// One read gets the time, OSCRUN, and the control register
+	uint8_t regs[REG_CONTROL + 1];
+	if (deviceRead(REG_I2C_ADDR, REG_DATE_TIME, regs, sizeof(regs)) != 0) {
+		return false;
+	}
+
+	MCP79410Time time;
+	deviceDecodeTime(&regs[REG_DATE_TIME], time, TIME_MODE_RTC);
+	if (time.rawYear == 0 || !time.getOscillatorRunning()) {
+		// RTC is not set or not running, cannot set an alarm
+		return false;
+	}
+
+	// Add directly to the calendar fields, avoiding a round trip through time_t
+	time.addSeconds(secondsFromNow);
+
+	// Set an alarm for month, dayOfMonth, dayOfWeek, hour, minute, second
+	time.alarmMode = time.ALARM_MONTH_DAY_DOW_HMS;
+
+	return deviceWriteAlarm(time, polarity, alarmNum, regs[REG_CONTROL]) == 0;
+}
+
+bool MCP79410::setAlarm(const MCP79410Schedule &schedule, bool polarity, int alarmNum) {
+	if (alarmNum < 0 || alarmNum > 1 || !schedule.isValid()) {
+		// Invalid alarmNum, must be 0 or 1
+		return false;
+	}
+	const MCP79410Schedule &prev = alarmSchedule[alarmNum];
+	if (!alarmSchedulePersisted[alarmNum] || alarmSchedulePolarity[alarmNum] != polarity || prev.kind != schedule.kind ||
+		prev.dayOfMonth != schedule.dayOfMonth || prev.intervalSec != schedule.intervalSec || prev.offsetSec != schedule.offsetSec) {
+		// Not setting the next occurrence of the same schedule, which doesn't need to be stored in SRAM again
+		alarmScheduleStop(alarmNum);
+	}
+
+	// One read gets the time, OSCRUN, and the control register
+	uint8_t regs[REG_CONTROL + 1];
+	if (deviceRead(REG_I2C_ADDR, REG_DATE_TIME, regs, sizeof(regs)) != 0) {
+		return false;
+	}
+
+	MCP79410Time time;
+	deviceDecodeTime(&regs[REG_DATE_TIME], time, TIME_MODE_RTC);
+	if (!time.getOscillatorRunning()) {
+		// RTC is not running, cannot set an alarm
+		return false;
+	}
+
+	MCP79410Time alarmTime;
+	time_t now = 0, next = 0;
+	uint8_t control = regs[REG_CONTROL];
+	bool tooFar = false;
+	if (!schedule.getNativeAlarm(alarmTime)) {
+		if (time.rawYear == 0) {
+			// RTC is not set, cannot calculate the next occurrence
+			return false;
+		}
+		now = time.toUnixTime();
+		next = schedule.nextAfter(now);
+		alarmTime.setAlarmTime(next);
+
+		tooFar = (next - now > (time_t)ALARM_SCHEDULE_MAX_ARM_SEC);
+		if (tooFar) {
+			// Write the alarm registers, which clears ALMxIF, but don't enable the alarm
+			control |= getAlarmEnableBit(alarmNum);
+		}
+	}
+
+	if (deviceWriteAlarm(alarmTime, polarity, alarmNum, control) != 0) {
+		return false;
+	}
+	if (tooFar && (regs[REG_CONTROL] & getAlarmEnableBit(alarmNum)) != 0 &&
+		deviceWriteRegisterByte(REG_CONTROL, regs[REG_CONTROL] & ~getAlarmEnableBit(alarmNum)) != 0) {
+		return false;
+	}
+
+	// For native schedules the hardware repeats the alarm, otherwise it's set again after it's handled
+	alarmSchedule[alarmNum] = schedule;
+	alarmSchedulePolarity[alarmNum] = polarity;
+	alarmScheduleFired[alarmNum] = false;
+	if (next != 0) {
+		if (tooFar) {
+			// loop() sets it once it's close enough
+			alarmScheduleNext[alarmNum] = 1;
+			alarmScheduleWait(alarmNum, next - now - (time_t)ALARM_SCHEDULE_MAX_ARM_SEC);
+		}
+		else {
+			// loop() doesn't need to look at the RTC until then
+			alarmScheduleNext[alarmNum] = next;
+			alarmScheduleWait(alarmNum, next - now);
+		}
+		if (!alarmSchedulePersisted[alarmNum]) {
+			alarmSchedulePersist(alarmNum);
+		}
+	}
+	else {
+		// Native schedules don't need loop(), so they don't need to be stored
+		alarmScheduleStop(alarmNum);
 	}
-}
 
+	return true;
+}
 
-bool MCP79410::clearAlarm(int alarmNum) {
+bool MCP79410::getNextAlarmTime(int alarmNum, time_t &next) const {
 	if (alarmNum < 0 || alarmNum > 1) {
 		// Invalid alarmNum, must be 0 or 1
 		return false;
 	}
 
-	return deviceWriteRegisterFlag(REG_CONTROL, getAlarmEnableBit(alarmNum), false) == 0;
-}
+	MCP79410RegisterSnapshot snapshot;
+	MCP79410Time time, alarmTime;
 
-bool MCP79410::setAlarm(const MCP79410Time &time, bool polarity, int alarmNum) {
-	if (alarmNum < 0 || alarmNum > 1) {
-		// Invalid alarmNum, must be 0 or 1
+	if (!readRegisterSnapshot(snapshot) || !snapshot.getRTCTime(time) || !snapshot.getAlarmEnabled(alarmNum)) {
 		return false;
 	}
+	snapshot.getAlarm(alarmNum, alarmTime);
 
-	if (getOscillatorRunning()) {
-		uint8_t buf[6];
+	return alarmTime.getNextAlarmTime(time.toUnixTime(), next);
+}
 
-		// Clear any existing alarm interrupt, otherwise this one will not fire. Fixed in 0.0.2.
-		clearInterrupt(alarmNum);
+void MCP79410::alarmScheduleLoop() {
+	for(int alarmNum = 0; alarmNum < 2; alarmNum++) {
+		if (alarmScheduleNext[alarmNum] == 0 || alarmScheduleFired[alarmNum]) {
+			continue;
+		}
+		unsigned long waitMs = alarmScheduleWaitMs[alarmNum];
+		if (alarmInterruptEnabled && alarmScheduleNext[alarmNum] != 1) {
+			// alarmInterruptLoop() normally sets it when it goes off, this is only a fallback
+			waitMs += ALARM_SCHEDULE_CHECK_MS;
+		}
+		if (millis() - alarmScheduleCheckMs[alarmNum] < waitMs) {
+			continue;
+		}
 
-		// log.trace("setAlarm %s polarity=%d alarmNum=%d", time.toStringRaw().c_str(), polarity, alarmNum);
+		// One read gets the time, the alarm enables, and the alarm flags
+		MCP79410RegisterSnapshot snapshot;
+		MCP79410Time time;
+		if (!readRegisterSnapshot(snapshot) || !snapshot.getRTCTime(time)) {
+			alarmScheduleRetry(alarmNum);
+			continue;
+		}
 
-		buf[0] = time.rawSecond;
-		buf[1] = time.rawMinute;
-		buf[2] = time.rawHour;
-		buf[3] = time.rawDayOfWeek;
-		buf[4] = time.rawDayOfMonth;
-		buf[5] = time.rawMonth;
+		if (snapshot.getInterrupt(alarmNum)) {
+			// It went off. Setting it again clears ALMxIF, so leave that until it has been handled, by
+			// alarmInterruptLoop() or by clearInterrupt().
+			if (alarmInterruptEnabled) {
+				alarmInterruptPending = true;
+				alarmScheduleRetry(alarmNum);
+			}
+			else {
+				alarmScheduleFired[alarmNum] = true;
+			}
+			continue;
+		}
 
-		if (polarity) {
-			// REG_ALARM_WKDAY_ALMPOL: 1 = alarm triggered, 0 = alarm did not trigger
-			buf[3] |= REG_ALARM_WKDAY_ALMPOL;
+		time_t now = time.toUnixTime();
+		time_t next = alarmScheduleNext[alarmNum];
+		if (next != 1 && snapshot.getAlarmEnabled(alarmNum) && now < next) {
+			// Not yet. millis() ran faster than the RTC, or the wait was limited to ALARM_SCHEDULE_MAX_WAIT_SEC.
+			alarmScheduleWait(alarmNum, next - now);
+			continue;
 		}
-		else {
-			buf[3] &= ~REG_ALARM_WKDAY_ALMPOL;
+
+		// After a failure, a change of the RTC time, or the alarm was disabled. Calculates the next
+		// occurrence from the RTC time, not the system clock.
+		if (!setAlarm(alarmSchedule[alarmNum], alarmSchedulePolarity[alarmNum], alarmNum)) {
+			// Keep the schedule and try again later
+			alarmScheduleRetry(alarmNum);
 		}
-		buf[3] |= (time.alarmMode & 0x7) << 4;
+	}
+}
+
+void MCP79410::alarmScheduleStop(int alarmNum) {
+	alarmScheduleNext[alarmNum] = 0;
+	alarmScheduleFired[alarmNum] = false;
 
-		uint8_t reg = getAlarmRegister(alarmNum);
+	if (alarmSchedulePersisted[alarmNum]) {
+		uint8_t magic = 0;
+		sramObj.writeData((size_t)alarmScheduleSRAMAddr + alarmNum * ALARM_SCHEDULE_SRAM_SIZE, &magic, 1);
+		alarmSchedulePersisted[alarmNum] = false;
+	}
+}
 
-		// log.trace("setAlarm %02x%02x%02x%02x%02x%02x starting at reg=%02x", buf[0], buf[1], buf[2], buf[3], buf[4], buf[5], reg);
+void MCP79410::alarmScheduleWait(int alarmNum, time_t seconds) {
+	if (seconds < 0) {
+		seconds = 0;
+	}
+	if (seconds > (time_t)ALARM_SCHEDULE_MAX_WAIT_SEC) {
+		seconds = (time_t)ALARM_SCHEDULE_MAX_WAIT_SEC;
+	}
+	alarmScheduleCheckMs[alarmNum] = millis();
+	alarmScheduleWaitMs[alarmNum] = (unsigned long)seconds * 1000;
+}
 
-		int stat = deviceWrite(REG_I2C_ADDR, reg, buf, sizeof(buf));
-		if (stat == 0) {
-			deviceWriteRegisterFlag(REG_CONTROL, getAlarmEnableBit(alarmNum), true);
-		}
+void MCP79410::alarmScheduleRetry(int alarmNum) {
+	alarmScheduleNext[alarmNum] = 1;
+	alarmScheduleCheckMs[alarmNum] = millis();
+	alarmScheduleWaitMs[alarmNum] = ALARM_SCHEDULE_CHECK_MS;
+}
 
-		return (stat == 0);
+void MCP79410::alarmSchedulePersist(int alarmNum) {
+	if (alarmScheduleSRAMAddr < 0) {
+		return;
 	}
-	else {
-		return false;
+
+	const MCP79410Schedule &schedule = alarmSchedule[alarmNum];
+	uint8_t buf[ALARM_SCHEDULE_SRAM_SIZE];
+	buf[0] = ALARM_SCHEDULE_SRAM_MAGIC;
+	buf[1] = schedule.kind;
+	buf[2] = schedule.dayOfMonth;
+	buf[3] = alarmSchedulePolarity[alarmNum] ? 1 : 0;
+	for(size_t ii = 0; ii < 4; ii++) {
+		buf[4 + ii] = (uint8_t)(schedule.intervalSec >> (ii * 8));
+		buf[8 + ii] = (uint8_t)(schedule.offsetSec >> (ii * 8));
+	}
+	uint8_t checksum = 0;
+	for(size_t ii = 0; ii < ALARM_SCHEDULE_SRAM_SIZE - 1; ii++) {
+		checksum += buf[ii];
+	}
+	buf[ALARM_SCHEDULE_SRAM_SIZE - 1] = (uint8_t)~checksum;
+
+	if (sramObj.writeData((size_t)alarmScheduleSRAMAddr + alarmNum * ALARM_SCHEDULE_SRAM_SIZE, buf, sizeof(buf))) {
+		alarmSchedulePersisted[alarmNum] = true;
 	}
 }
 
-bool MCP79410::setAlarm(int secondsFromNow, bool polarity, int alarmNum) {
-	// log.trace("setAlarm secondsFromNow=%d polarity=%d alarmNum=%d", secondsFromNow, polarity, alarmNum);
-	if (alarmNum < 0 || alarmNum > 1) {
-		// Invalid alarmNum, must be 0 or 1
-		return false;
+void MCP79410::alarmScheduleRestore() {
+	if (alarmScheduleSRAMAddr < 0) {
+		return;
 	}
 
-	time_t unixTime = getRTCTime();
-	if (unixTime != 0) {
-		unixTime += secondsFromNow;
+	for(int alarmNum = 0; alarmNum < 2; alarmNum++) {
+		uint8_t buf[ALARM_SCHEDULE_SRAM_SIZE];
+		if (!sramObj.readData((size_t)alarmScheduleSRAMAddr + alarmNum * ALARM_SCHEDULE_SRAM_SIZE, buf, sizeof(buf)) ||
+			buf[0] != ALARM_SCHEDULE_SRAM_MAGIC) {
+			continue;
+		}
+		uint8_t checksum = 0;
+		for(size_t ii = 0; ii < ALARM_SCHEDULE_SRAM_SIZE - 1; ii++) {
+			checksum += buf[ii];
+		}
+		if (buf[ALARM_SCHEDULE_SRAM_SIZE - 1] != (uint8_t)~checksum) {
+			log.info("alarm %d schedule in SRAM is not valid", alarmNum);
+			continue;
+		}
 
-		// Set an alarm for month, dayOfMonth, dayOfWeek, hour, minute, second
-		MCP79410Time time;
-		time.setAlarmTime(unixTime);
+		MCP79410Schedule &schedule = alarmSchedule[alarmNum];
+		schedule.kind = buf[1];
+		schedule.dayOfMonth = buf[2];
+		schedule.intervalSec = schedule.offsetSec = 0;
+		for(size_t ii = 0; ii < 4; ii++) {
+			schedule.intervalSec |= ((uint32_t)buf[4 + ii]) << (ii * 8);
+			schedule.offsetSec |= ((uint32_t)buf[8 + ii]) << (ii * 8);
+		}
+		alarmSchedulePolarity[alarmNum] = (buf[3] != 0);
+		alarmSchedulePersisted[alarmNum] = true;
+
+		// If the alarm is still enabled and hasn't gone off, it's set for the next occurrence after now.
+		// Otherwise loop() checks it right away: if it went off during sleep or a reset, it's set for the
+		// following one after it's handled.
+		uint8_t control, wkday;
+		time_t rtcNow = getRTCTime();
+		alarmScheduleNext[alarmNum] = 1;
+		alarmScheduleFired[alarmNum] = false;
+		alarmScheduleWait(alarmNum, 0);
+		if (rtcNow != 0 &&
+			deviceRead(REG_I2C_ADDR, REG_CONTROL, &control, 1) == 0 && (control & getAlarmEnableBit(alarmNum)) != 0 &&
+			deviceRead(REG_I2C_ADDR, getAlarmRegister(alarmNum, REG_ALARM_WKDAY_OFFSET), &wkday, 1) == 0 && (wkday & REG_ALARM_WKDAY_ALMIF) == 0) {
+			alarmScheduleNext[alarmNum] = schedule.nextAfter(rtcNow);
+			alarmScheduleWait(alarmNum, alarmScheduleNext[alarmNum] - rtcNow);
+		}
 
-		return setAlarm(time, polarity, alarmNum);
+		log.info("restored alarm %d schedule from SRAM", alarmNum);
 	}
-	else {
-		// RTC is not set or not running, cannot set an alarm
-		return false;
+}
+
+int MCP79410::deviceWriteAlarm(const MCP79410Time &time, bool polarity, int alarmNum, uint8_t control) {
+	uint8_t buf[6];
+
+	// log.trace("setAlarm %s polarity=%d alarmNum=%d", time.toStringRaw().c_str(), polarity, alarmNum);
+
+	// Mask off the bits that are not part of the alarm value. A time from getRTCTime() has ST,
+	// OSCRUN, PWRFAIL, VBATEN and LPYR set, and OSCRUN would otherwise end up in ALMxMSK.
+	buf[0] = time.rawSecond & 0x7f;
+	buf[1] = time.rawMinute & 0x7f;
+	buf[2] = time.rawHour & 0x7f;
+	buf[3] = time.rawDayOfWeek & 0x07;
+	buf[4] = time.rawDayOfMonth & 0x3f;
+	buf[5] = time.rawMonth & 0x1f;
+
+	if (polarity) {
+		// REG_ALARM_WKDAY_ALMPOL: 1 = alarm triggered, 0 = alarm did not trigger
+		buf[3] |= REG_ALARM_WKDAY_ALMPOL;
+	}
+	buf[3] |= (time.alarmMode & 0x7) << 4;
+
+	// ALMxIF is in the same register and is written as 0 here, which clears any existing alarm
+	// interrupt. Otherwise this one would not fire (fixed in 0.0.2 with a separate clearInterrupt()).
+
+	uint8_t reg = getAlarmRegister(alarmNum);
+
+	// log.trace("setAlarm %02x%02x%02x%02x%02x%02x starting at reg=%02x", buf[0], buf[1], buf[2], buf[3], buf[4], buf[5], reg);
+
+	int stat = deviceWrite(REG_I2C_ADDR, reg, buf, sizeof(buf));
+	if (stat == 0 && (control & getAlarmEnableBit(alarmNum)) == 0) {
+		stat = deviceWriteRegisterByte(REG_CONTROL, control | getAlarmEnableBit(alarmNum));
 	}
+	return stat;
 }
 
 bool MCP79410::getInterrupt(int alarmNum) {
@@ -617,6 +2675,13 @@ bool MCP79410::getInterrupt(int alarmNum) {
 }
 
 void MCP79410::clearInterrupt(int alarmNum) {
+	if (alarmNum >= 0 && alarmNum <= 1 && alarmScheduleNext[alarmNum] != 0) {
+		// Non-native recurring alarm, setting the following occurrence also clears ALMxIF
+		if (setAlarm(alarmSchedule[alarmNum], alarmSchedulePolarity[alarmNum], alarmNum)) {
+			return;
+		}
+		alarmScheduleRetry(alarmNum);
+	}
 	deviceWriteRegisterFlag(getAlarmRegister(alarmNum, REG_ALARM_WKDAY_OFFSET), REG_ALARM_WKDAY_ALMIF, false);
 }
 
@@ -639,18 +2704,95 @@ bool MCP79410::clearSquareWaveMode() {
 	return deviceWriteRegisterFlag(REG_CONTROL, REG_CONTROL_SQWEN, false) == 0;
 }
 
-bool MCP79410::setOscTrim(int8_t trim) {
-	uint8_t value;
+bool MCP79410::measureSquareWave(pin_t pin, uint8_t freq, unsigned long gateMs, MCP79410SquareWaveResult &result) {
+	uint8_t savedControl;
 
-	if (trim < 0) {
-		// sign bit in 0x80: 0 = negative, subtract trim value
-		value = (uint8_t) -trim;
+	if (freq != SQUARE_WAVE_1_HZ && freq != SQUARE_WAVE_4096_HZ) {
+		// At 8192 Hz and 32768 Hz the interrupt rate is too high to reliably count every edge
+		log.info("square wave measurement only supports 1 Hz and 4096 Hz");
+		return false;
 	}
-	else {
-		// sign bit in 0x80: 1 = positive, add trim value
-		value = (uint8_t) trim | 0x80;
+	if (deviceRead(REG_I2C_ADDR, REG_CONTROL, &savedControl, 1) != 0 || !setSquareWaveMode(freq)) {
+		return false;
+	}
+
+	bool shortGate = (gateMs <= SQUARE_WAVE_SHORT_GATE_MS);
+	if (shortGate) {
+		// Digital trimming is applied when the minute rolls over. If that would happen during the gate,
+		// wait for it first so the measurement is of the untrimmed oscillator.
+		// This only happens when fewer than gateMs + 1000 ms are left in the minute, so the wait is never
+		// longer than that.
+		uint8_t sec;
+		if (deviceRead(REG_I2C_ADDR, REG_DATE_RTCSEC, &sec, 1) == 0) {
+			unsigned long secs = (unsigned long)MCP79410Time::bcdToInt(sec & 0x7f);
+			if (secs < 60 && secs * 1000 + 1000 + gateMs > 60000) {
+				unsigned long waitMs = (60 - secs) * 1000;
+				log.info("waiting %lu ms for the minute rollover before measuring", waitMs);
+				delay(waitMs);
+			}
+		}
+	}
+
+	PinMode savedPinMode = getPinMode(pin);
+	pinMode(pin, INPUT_PULLUP);
+
+	result.nominalHz = (freq == SQUARE_WAVE_1_HZ) ? 1.0f : 4096.0f;
+
+	// An interval of more than 1.75 periods between edges means an edge was missed
+	squareWaveMaxIntervalUs = (uint32_t)(1750000.0f / result.nominalHz);
+	squareWaveMissed = 0;
+	squareWaveEdges = 0;
+	attachInterrupt(pin, &MCP79410::squareWaveISR, this, RISING);
+	delay(gateMs);
+	detachInterrupt(pin);
+
+	// The interrupt is detached, so these can't change while reading them
+	result.edges = squareWaveEdges;
+	result.elapsedUs = squareWaveLastUs - squareWaveFirstUs;
+
+	pinMode(pin, savedPinMode);
+	deviceWriteRegisterByte(REG_CONTROL, savedControl);
+
+	if (result.edges < 2 || result.elapsedUs == 0) {
+		log.info("square wave measurement failed, %lu edges", (unsigned long)result.edges);
+		return false;
+	}
+	if (squareWaveMissed != 0) {
+		log.info("square wave measurement failed, %lu edges missed", (unsigned long)squareWaveMissed);
+		return false;
+	}
+
+	result.frequencyHz = (float)((double)(result.edges - 1) * 1000000.0 / (double)result.elapsedUs);
+	result.errorPpm = (float)(((double)result.frequencyHz / (double)result.nominalHz - 1.0) * 1000000.0);
+
+	result.rtcErrorPpm = result.errorPpm;
+	if (shortGate) {
+		// The gate did not include a trim adjustment, so add the trim that's applied to the time
+		result.rtcErrorPpm += (float)getOscTrim() * OSC_TRIM_PPM_PER_STEP;
+	}
+
+	log.info("square wave %.3f Hz, %.2f ppm (%lu edges in %lu us)", result.frequencyHz, result.errorPpm,
+			(unsigned long)result.edges, (unsigned long)result.elapsedUs);
+
+	return true;
+}
+
+void MCP79410::squareWaveISR() {
+	uint32_t now = (uint32_t)micros();
+
+	if (squareWaveEdges == 0) {
+		squareWaveFirstUs = now;
 	}
-	return deviceWriteRegisterByte(REG_OSCTRIM, value) == 0;
+	else
+	if (now - squareWaveLastUs > squareWaveMaxIntervalUs) {
+		squareWaveMissed = squareWaveMissed + 1;
+	}
+	squareWaveLastUs = now;
+	squareWaveEdges = squareWaveEdges + 1;
+}
+
+bool MCP79410::setOscTrim(int8_t trim) {
+	return deviceWriteRegisterByte(REG_OSCTRIM, oscTrimToRaw(trim)) == 0;
 }
 
 
@@ -658,50 +2800,89 @@ int MCP79410::deviceReadTime(uint8_t addr, MCP79410Time &time, int timeMode) con
 	uint8_t buf[8];
 	int stat = -1;
 
-	if (timeMode == TIME_MODE_RTC || timeMode == TIME_MODE_ALARM) {
-		size_t numBytes = (timeMode == TIME_MODE_RTC) ? 7 : 6;
+	size_t numBytes = 0;
+	switch(timeMode) {
+	case TIME_MODE_RTC:
+		numBytes = 7;
+		break;
+
+	case TIME_MODE_ALARM:
+		numBytes = 6;
+		break;
+
+	case TIME_MODE_POWER:
+		numBytes = 4;
+		break;
+	}
+
+	if (numBytes != 0) {
 		stat = deviceRead(REG_I2C_ADDR, addr, buf, numBytes);
 		if (stat == 0) {
-			time.rawSecond = buf[0];
-			time.rawMinute = buf[1];
-			time.rawHour = buf[2];
-			time.rawDayOfWeek = buf[3];
-			time.rawDayOfMonth = buf[4];
-			time.rawMonth = buf[5];
-			if (timeMode == TIME_MODE_RTC) {
-				time.rawYear = buf[6];
-			}
-			else {
-				time.rawYear = MCP79410Time::intToBcd(Time.year());
-			}
+			deviceDecodeTime(buf, time, timeMode);
+		}
+	}
+
+	return stat;
+}
+
+// [static]
+int8_t MCP79410::oscTrimFromRaw(uint8_t value) {
+	// sign bit in 0x80: 1 = positive (add), 0 = negative (subtract)
+	if (value & 0x80) {
+		return (int8_t) (value & 0x7f);
+	}
+	else {
+		return (int8_t) -(value & 0x7f);
+	}
+}
+
+// [static]
+uint8_t MCP79410::oscTrimToRaw(int8_t trim) {
+	if (trim < 0) {
+		// sign bit in 0x80: 0 = negative, subtract trim value
+		return (uint8_t) -trim;
+	}
+	else {
+		// sign bit in 0x80: 1 = positive, add trim value
+		return (uint8_t) trim | 0x80;
+	}
+}
+
+// [static]
+void MCP79410::deviceDecodeTime(const uint8_t *buf, MCP79410Time &time, int timeMode) {
+	if (timeMode == TIME_MODE_RTC || timeMode == TIME_MODE_ALARM) {
+		// Registers are in the same order as MCP79410Time::toRawPacked()
+		uint64_t packed = 0;
+		for(size_t ii = 0; ii < 6; ii++) {
+			packed |= (uint64_t)buf[ii] << (ii * 8);
 		}
+		if (timeMode == TIME_MODE_RTC) {
+			packed |= (uint64_t)buf[6] << 48;
+		}
+		else {
+			packed |= (uint64_t)MCP79410Time::intToBcd(Time.year()) << 48;
+			time.alarmMode = (buf[3] >> 4) & 0x7;
+		}
+		time.fromRawPacked(packed);
 	}
 	else
 	if (timeMode == TIME_MODE_POWER) {
-		stat = deviceRead(REG_I2C_ADDR, addr, buf, 4);
-		if (stat == 0) {
-			time.rawSecond = 0;
-			time.rawMinute = buf[0];
-			time.rawHour = buf[1];
-			time.rawDayOfMonth = buf[2];
-			time.rawMonth = buf[3];
-			time.rawYear = MCP79410Time::intToBcd(Time.year());
-		}
+		time.rawSecond = 0;
+		time.rawMinute = buf[0];
+		time.rawHour = buf[1];
+		time.rawDayOfMonth = buf[2];
+		time.rawMonth = buf[3];
+		time.rawYear = MCP79410Time::intToBcd(Time.year());
 	}
-
-	return stat;
 }
 
 int MCP79410::deviceWriteRTCTime(uint8_t addr, const MCP79410Time &time) {
 	uint8_t buf[7];
 
-	buf[0] = time.rawSecond;
-	buf[1] = time.rawMinute;
-	buf[2] = time.rawHour;
-	buf[3] = time.rawDayOfWeek;
-	buf[4] = time.rawDayOfMonth;
-	buf[5] = time.rawMonth;
-	buf[6] = time.rawYear;
+	uint64_t packed = time.toRawPacked();
+	for(size_t ii = 0; ii < sizeof(buf); ii++) {
+		buf[ii] = (uint8_t)(packed >> (ii * 8));
+	}
 
 	return deviceWrite(REG_I2C_ADDR, addr, buf, sizeof(buf));
 }
@@ -743,7 +2924,19 @@ int MCP79410::deviceWriteRegisterFlag(uint8_t addr, uint8_t value, bool set) {
 
 
 int MCP79410::deviceWriteRegisterByteMask(uint8_t addr, uint8_t andMask, uint8_t orMask) {
-	uint8_t value = deviceReadRegisterByte(addr);
+	uint8_t value;
+
+	int index = registerShadowIndex(addr);
+	if (index >= 0 && (registerShadowValid & (1 << index)) != 0 &&
+		(addr == REG_CONTROL || addr == REG_OSCTRIM || (andMask & REG_ALARM_WKDAY_ALMIF) == 0 || (orMask & REG_ALARM_WKDAY_ALMIF) != 0)) {
+		// Shadowed and valid. For the ALMxWKDAY registers, the shadow can only be used if the ALMxIF
+		// bit is being overwritten, because the hardware sets it. If it's being preserved, we need
+		// to read the current value from the chip.
+		value = registerShadowValue[index];
+	}
+	else {
+		value = deviceReadRegisterByte(addr);
+	}
 
 	value &= andMask;
 	value |= orMask;
@@ -755,35 +2948,136 @@ int MCP79410::deviceWriteRegisterByteMask(uint8_t addr, uint8_t andMask, uint8_t
 
 
 
+unsigned long MCP79410::busStatsStart() const {
+#ifndef MCP79410_DISABLE_BUS_STATS
+	if (busStats) {
+		return micros();
+	}
+#endif
+	return 0;
+}
+
+void MCP79410::busStatsRecord(size_t op, unsigned long startUs, int stat) const {
+#ifndef MCP79410_DISABLE_BUS_STATS
+	if (busStats) {
+		unsigned long elapsed = micros() - startUs;
+
+		size_t bucket = 0;
+		for(unsigned long limit = 32; elapsed >= limit && bucket < MCP79410BusStats::HISTOGRAM_BUCKETS - 1; limit <<= 1) {
+			bucket++;
+		}
+		busStats->latencyHistogram[op][bucket]++;
+	}
+#else
+	(void)op;
+	(void)startUs;
+#endif
+	busStatsError(stat);
+}
+
+void MCP79410::busStatsError(int stat) const {
+#ifndef MCP79410_DISABLE_BUS_STATS
+	if (busStats && stat != 0) {
+		busStats->errors[(stat > 0 && stat < (int)MCP79410BusStats::ERROR_CODES) ? stat : 0]++;
+	}
+#else
+	(void)stat;
+#endif
+}
+
+void MCP79410::busStatsEEPROMTimeout() const {
+#ifndef MCP79410_DISABLE_BUS_STATS
+	if (busStats) {
+		busStats->eepromTimeouts++;
+	}
+#endif
+	busStatsError(ERROR_EEPROM_TIMEOUT);
+}
+
+int MCP79410::registerShadowIndex(uint8_t addr) const {
+	if (!registerShadowEnabled) {
+		return -1;
+	}
+
+	switch(addr) {
+	case REG_CONTROL:
+		return 0;
+
+	case REG_OSCTRIM:
+		return 1;
+
+	case REG_ALARM0 + REG_ALARM_WKDAY_OFFSET:
+		return 2;
+
+	case REG_ALARM1 + REG_ALARM_WKDAY_OFFSET:
+		return 3;
+
+	default:
+		return -1;
+	}
+}
+
+void MCP79410::registerShadowUpdate(uint8_t addr, const uint8_t *buf, size_t bufLen) const {
+	if (!registerShadowEnabled) {
+		return;
+	}
+
+	for(size_t ii = 0; ii < bufLen; ii++) {
+		int index = registerShadowIndex(addr + ii);
+		if (index >= 0) {
+			uint8_t value = buf[ii];
+			if (index >= 2) {
+				// ALMxIF is set by the hardware, so never keep it in the shadow
+				value &= ~REG_ALARM_WKDAY_ALMIF;
+			}
+			registerShadowValue[index] = value;
+			registerShadowValid |= (1 << index);
+		}
+	}
+}
+
 int MCP79410::deviceRead(uint8_t i2cAddr, uint8_t addr, uint8_t *buf, size_t bufLen) const {
 	// log.trace("deviceRead i2cAddr=%02x addr=%02x bufLen=%u", i2cAddr, addr, bufLen);
 
 	int stat = 0;
 	size_t offset = 0;
+	unsigned long startUs = busStatsStart();
 
 	while(offset < bufLen) {
-		wire.beginTransmission(i2cAddr);
-		wire.write(addr + offset);
-		stat = wire.endTransmission(false);
-		if (stat == 0) {
-			// Maximum read is 32 because of the limitation of the Wire implementation
-			size_t count = bufLen - offset;
-			if (count > 32) {
-				count = 32;
-			}
+		uint8_t regAddr = (uint8_t)(addr + offset);
+
+		// Maximum read is limited by the transport (32 for the Wire implementation)
+		size_t count = bufLen - offset;
+		if (count > transport->maxReadLen()) {
+			count = transport->maxReadLen();
+		}
 
-			// log.trace("deviceRead addr=%u count=%u", addr + offset, count);
+		// log.trace("deviceRead addr=%u count=%u", regAddr, count);
 
-			count = wire.requestFrom(i2cAddr, count, (uint8_t) true);
-			for(size_t ii = 0; ii < count; ii++) {
-				buf[ii + offset] = wire.read();
+		stat = transport->writeRead(i2cAddr, &regAddr, 1, &buf[offset], count);
+#ifndef MCP79410_DISABLE_BUS_STATS
+		if (busStats) {
+			busStats->readTransactions++;
+			if (stat == 0) {
+				busStats->bytesRead += count;
 			}
-			offset += count;
 		}
-		else {
+#endif
+		if (stat != 0) {
 			log.info("deviceRead failed stat=%d", stat);
 			break;
 		}
+		offset += count;
+	}
+	busStatsRecord(MCP79410BusStats::OP_READ, startUs, stat);
+
+	if (i2cAddr == REG_I2C_ADDR) {
+		if (stat == 0) {
+			registerShadowUpdate(addr, buf, bufLen);
+		}
+		else {
+			invalidateRegisterShadow();
+		}
 	}
 	return stat;
 }
@@ -793,24 +3087,33 @@ int MCP79410::deviceWrite(uint8_t i2cAddr, uint8_t addr, const uint8_t *buf, siz
 
 	int stat = 0;
 	size_t offset = 0;
+	unsigned long startUs = busStatsStart();
 
 	while(offset < bufLen) {
-		wire.beginTransmission(i2cAddr);
-		wire.write(addr + offset);
+		uint8_t regAddr = (uint8_t)(addr + offset);
 
-		// Maximum write is 31, not 32, because of the address byte
+		// Maximum write is one less than the transport maximum (31 for Wire) because of the address byte
 		size_t count = bufLen - offset;
-		if (count > 31) {
-			count = 31;
+		if (count > transport->maxWriteLen() - 1) {
+			count = transport->maxWriteLen() - 1;
 		}
 
-		// log.trace("deviceWrite addr=%u count=%u", addr + offset, count);
+		// log.trace("deviceWrite addr=%u count=%u", regAddr, count);
 
-		for(size_t ii = 0; ii < count; ii++) {
-			wire.write(buf[ii + offset]);
-		}
+		MCP79410TransportSegment segments[2] = {
+			{ &regAddr, 1 },
+			{ &buf[offset], count }
+		};
 
-		stat = wire.endTransmission(true);
+		stat = transport->writeSegments(i2cAddr, segments, 2);
+#ifndef MCP79410_DISABLE_BUS_STATS
+		if (busStats) {
+			busStats->writeTransactions++;
+			if (stat == 0) {
+				busStats->bytesWritten += count;
+			}
+		}
+#endif
 		if (stat != 0) {
 			log.info("deviceWrite failed stat=%d", stat);
 			break;
@@ -818,6 +3121,16 @@ int MCP79410::deviceWrite(uint8_t i2cAddr, uint8_t addr, const uint8_t *buf, siz
 
 		offset += count;
 	}
+	busStatsRecord(MCP79410BusStats::OP_WRITE, startUs, stat);
+
+	if (i2cAddr == REG_I2C_ADDR) {
+		if (stat == 0) {
+			registerShadowUpdate(addr, buf, bufLen);
+		}
+		else {
+			invalidateRegisterShadow();
+		}
+	}
 
 	return stat;
 }
@@ -827,48 +3140,166 @@ int MCP79410::deviceWriteEEPROM(uint8_t addr, const uint8_t *buf, size_t bufLen)
 
 	int stat = 0;
 	size_t offset = 0;
+	unsigned long startUs = busStatsStart();
 
 	while(offset < bufLen) {
-		wire.beginTransmission(EEPROM_I2C_ADDR);
-		wire.write(addr + offset);
+		uint8_t curAddr = (uint8_t)(addr + offset);
 
-		// Maximum EEPROM write is 7 bytes. However, I get random-ish failures for multi-byte writes
-		// for reasons that are not obvious. Doing single byte writes is inefficient, but works
-		// fine so use that for now. EEPROM writes should be relatively infrequent.
+		// A write cycle can't cross an 8-byte page boundary; data past the end of the page wraps
+		// around to the beginning of the same page. Not taking this into account was the likely cause
+		// of the random-ish failures that caused earlier versions to only write a byte at a time.
 		size_t count = bufLen - offset;
-		if (count > 1) {
-			count = 1;
+		size_t pageLeft = EEPROM_PAGE_SIZE - (curAddr % EEPROM_PAGE_SIZE);
+		if (count > pageLeft) {
+			count = pageLeft;
 		}
 
-		// if (bufLen != 1) {
-		//	log.trace("deviceWriteEEPROM addr=%02x count=%u", addr + offset, count);
-		// }
+		if (eepromPageWrite && count > 1) {
+			stat = deviceWriteEEPROMPage(curAddr, &buf[offset], count);
+			if (stat == 0) {
+				stat = deviceVerifyEEPROM(curAddr, &buf[offset], count);
+			}
+			if (stat != 0) {
+				// Fall back to byte mode for this page only
+				log.info("deviceWriteEEPROM page write failed addr=%02x stat=%d, retrying in byte mode", curAddr, stat);
 
-		for(size_t ii = 0; ii < count; ii++) {
-			wire.write(buf[ii + offset]);
+				stat = deviceWriteEEPROMBytes(curAddr, &buf[offset], count);
+				if (stat == 0) {
+					stat = deviceVerifyEEPROM(curAddr, &buf[offset], count);
+				}
+			}
+		}
+		else {
+			// Byte mode, or a single byte. This is verified too, so a write to a block-protected area fails.
+			stat = deviceWriteEEPROMBytes(curAddr, &buf[offset], count);
+			if (stat == 0) {
+				stat = deviceVerifyEEPROM(curAddr, &buf[offset], count);
+			}
 		}
-
-		stat = wire.endTransmission(true);
 		if (stat != 0) {
-			log.info("deviceWriteEEPROM failed stat=%d", stat);
+			log.info("deviceWriteEEPROM failed addr=%02x stat=%d", curAddr, stat);
 			break;
 		}
 
-		waitForEEPROM();
-
 		offset += count;
 	}
+	// Errors were already counted by the transactions above, so only record the latency
+	busStatsRecord(MCP79410BusStats::OP_EEPROM_WRITE, startUs, 0);
+
+	return stat;
+}
+
+int MCP79410::deviceWriteEEPROMPage(uint8_t addr, const uint8_t *buf, size_t bufLen) {
+	// if (bufLen != 1) {
+	//	log.trace("deviceWriteEEPROMPage addr=%02x count=%u", addr, bufLen);
+	// }
+
+	int stat = deviceWriteEEPROMStart(addr, buf, bufLen);
+	if (stat == 0) {
+		stat = waitForEEPROM();
+	}
 
 	return stat;
 }
 
-void MCP79410::waitForEEPROM() {
-	for(size_t tries = 0; tries < 50; tries++) {
-		wire.beginTransmission(EEPROM_I2C_ADDR);
-		int stat = wire.endTransmission(true);
+int MCP79410::deviceWriteEEPROMStart(uint8_t addr, const uint8_t *buf, size_t bufLen) {
+	MCP79410TransportSegment segments[2] = {
+		{ &addr, 1 },
+		{ buf, bufLen }
+	};
+
+	int stat = transport->writeSegments(EEPROM_I2C_ADDR, segments, 2);
+#ifndef MCP79410_DISABLE_BUS_STATS
+	if (busStats) {
+		busStats->eepromWriteTransactions++;
 		if (stat == 0) {
-			// log.trace("deviceWriteEEPROM got ack after %u tries", tries);
+			busStats->bytesWritten += bufLen;
+		}
+	}
+#endif
+	busStatsError(stat);
+
+	return stat;
+}
+
+int MCP79410::devicePollEEPROM() {
+	// Address-only write; the EEPROM does not ACK its address until the write cycle completes
+	int stat = transport->writeSegments(EEPROM_I2C_ADDR, NULL, 0);
+#ifndef MCP79410_DISABLE_BUS_STATS
+	if (busStats) {
+		busStats->eepromPolls++;
+	}
+#endif
+	return stat;
+}
+
+int MCP79410::deviceWriteEEPROMBytes(uint8_t addr, const uint8_t *buf, size_t bufLen) {
+	int stat = 0;
+
+	for(size_t ii = 0; ii < bufLen; ii++) {
+		stat = deviceWriteEEPROMPage(addr + ii, &buf[ii], 1);
+		if (stat != 0) {
 			break;
 		}
 	}
+	return stat;
+}
+
+int MCP79410::deviceVerifyEEPROM(uint8_t addr, const uint8_t *buf, size_t bufLen) const {
+	uint8_t readBuf[EEPROM_PAGE_SIZE];
+	size_t offset = 0;
+
+	while(offset < bufLen) {
+		size_t count = bufLen - offset;
+		if (count > sizeof(readBuf)) {
+			count = sizeof(readBuf);
+		}
+
+		int stat = deviceRead(EEPROM_I2C_ADDR, addr + offset, readBuf, count);
+		if (stat != 0) {
+			return stat;
+		}
+		if (memcmp(readBuf, &buf[offset], count) != 0) {
+#ifndef MCP79410_DISABLE_BUS_STATS
+			if (busStats) {
+				busStats->eepromVerifyFailures++;
+			}
+#endif
+			busStatsError(ERROR_EEPROM_VERIFY);
+			return ERROR_EEPROM_VERIFY;
+		}
+		offset += count;
+	}
+	return 0;
+}
+
+int MCP79410::waitForEEPROM() {
+	unsigned long startUs = micros();
+	unsigned long startMs = millis();
+	unsigned long statsStartUs = busStatsStart();
+
+	// The write cycle can't complete before the minimum time, so don't tie up the bus polling
+	if (eepromWriteCycleMinMs > 0) {
+		delay(eepromWriteCycleMinMs);
+	}
+
+	while(true) {
+		int stat = devicePollEEPROM();
+		if (stat == 0) {
+			lastEEPROMWriteCycleUs = micros() - startUs;
+			// log.trace("waitForEEPROM got ack after %lu us", lastEEPROMWriteCycleUs);
+			busStatsRecord(MCP79410BusStats::OP_EEPROM_WAIT, statsStartUs, 0);
+			return 0;
+		}
+
+		if (millis() - startMs >= eepromWriteCycleTimeoutMs) {
+			log.info("waitForEEPROM timed out stat=%d", stat);
+			busStatsRecord(MCP79410BusStats::OP_EEPROM_WAIT, statsStartUs, 0);
+			busStatsEEPROMTimeout();
+			return ERROR_EEPROM_TIMEOUT;
+		}
+
+		// Let other threads run (and use the bus) between polls
+		os_thread_yield();
+	}
 }
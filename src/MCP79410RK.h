@@ -3,8 +3,63 @@
 
 #include "Particle.h"
 
+#include "MCP79410Transport.h"
+
 class MCP79410; // Forward declaration
 
+#ifndef MCP79410_DISABLE_TWOWIRE
+/**
+ * @brief MCP79410Transport implementation using a TwoWire object (Wire, Wire1, ...)
+ *
+ * This is what the MCP79410 class uses when you pass a TwoWire object, or nothing, to the constructor.
+ *
+ * Define MCP79410_DISABLE_TWOWIRE to leave this class and the TwoWire constructor out, so the library can
+ * be built without TwoWire, such as on a host computer with the shim in test/host.
+ */
+class MCP79410TwoWireTransport : public MCP79410Transport {
+public:
+	/**
+	 * @brief Constructor
+	 *
+	 * @param wire The I2C interface to use, typically Wire.
+	 */
+	MCP79410TwoWireTransport(TwoWire &wire);
+
+	/**
+	 * @brief Destructor
+	 */
+	virtual ~MCP79410TwoWireTransport();
+
+	/**
+	 * @brief Calls wire.begin()
+	 */
+	virtual void begin();
+
+	/**
+	 * @brief Write bytes, then optionally read bytes after a repeated start. See MCP79410Transport::writeRead().
+	 */
+	virtual int writeRead(uint8_t i2cAddr, const uint8_t *writeBuf, size_t writeLen, uint8_t *readBuf, size_t readLen);
+
+	/**
+	 * @brief Write several buffers as a single transaction. See MCP79410Transport::writeSegments().
+	 */
+	virtual int writeSegments(uint8_t i2cAddr, const MCP79410TransportSegment *segments, size_t numSegments);
+
+	/**
+	 * @brief Maximum read is 32 because of the limitation of the Wire implementation
+	 */
+	virtual size_t maxReadLen() const { return 32; };
+
+	/**
+	 * @brief Maximum write is 32 bytes, including the address byte, because of the limitation of the Wire implementation
+	 */
+	virtual size_t maxWriteLen() const { return 32; };
+
+protected:
+	TwoWire &wire; //!< The I2C interface to use. Typically Wire (the default) but could be Wire1 on some devices.
+};
+#endif /* MCP79410_DISABLE_TWOWIRE */
+
 /**
  * @brief Abstract base class for MCP79410SRAM and MCP79410EEPROM
  *
@@ -146,6 +201,16 @@ public:
 	virtual bool writeData(size_t addr, const uint8_t *data, size_t dataLen);
 };
 
+/**
+ * @brief EEPROM write statistics. See MCP79410EEPROM::getStats().
+ */
+struct MCP79410EEPROMStats {
+	uint32_t bytesRequested; //!< Number of bytes passed to writeData(), put(), etc.
+	uint32_t bytesSkipped; //!< Number of bytes not written because they were unchanged (differential mode)
+	uint32_t writeCycles; //!< Number of page write cycles done, not including byte mode retries
+	uint32_t cyclesSaved; //!< Number of page write cycles skipped because the page was unchanged (differential mode)
+};
+
 /**
  * @brief Class for accessing the MCP79410 EEPROM
  *
@@ -250,6 +315,185 @@ public:
      * @param dataLen Number of bytes to write
      */
 	virtual bool writeData(size_t addr, const uint8_t *data, size_t dataLen);
+
+	/**
+	 * @brief Enables asynchronous (non-blocking) writes
+	 *
+	 * @param value true to enable, false to disable (default is disabled)
+	 *
+	 * In asynchronous mode, writeData(), put(), and erase() copy the data into a RAM buffer and return
+	 * immediately. MCP79410::loop() writes the data to the EEPROM, one page (one write cycle) per call,
+	 * without waiting for the write cycle to complete. With MCP79410::withEEPROMPageWrite(false), each changed
+	 * byte is a separate write cycle instead. A page that fails to verify is rewritten in the same way, one byte
+	 * per call. Writes to the same address that have not been written yet are
+	 * combined, and readData() and get() return the queued data.
+	 *
+	 * You must call rtc.loop() from loop() for the data to be written, and you should call flush() before
+	 * sleep or reset to make sure all of the data has been written.
+	 *
+	 * Disabling asynchronous mode flushes any pending writes first.
+	 */
+	MCP79410EEPROM &withAsyncWrite(bool value = true);
+
+	/**
+	 * @brief Queue a write to be done asynchronously, with an optional completion callback
+	 *
+	 * @param addr Address in the memory block (0 = beginning of block; do not use hardware register address)
+	 * @param data Pointer to buffer containing the data to write to memory. The data is copied so the buffer
+	 * does not need to remain valid after this call returns.
+	 * @param dataLen Number of bytes to write
+	 * @param callback Optional function to call when all of the data has been written. The parameter is true
+	 * if the data was written and verified successfully. The callback is called from loop() or flush().
+	 *
+	 * This works even if withAsyncWrite() is not enabled.
+	 *
+	 * @return true if the data was queued, false if the address is invalid or there are already
+	 * ASYNC_MAX_CALLBACKS writes with callbacks pending.
+	 */
+	bool writeDataAsync(size_t addr, const uint8_t *data, size_t dataLen, std::function<void(bool)> callback = nullptr);
+
+	/**
+	 * @brief Templated accessor to set data at a specific offset asynchronously. See writeDataAsync().
+	 */
+	template <typename T> const T &putAsync(size_t addr, const T &t, std::function<void(bool)> callback = nullptr) {
+		writeDataAsync(addr, (const uint8_t *)&t, sizeof(T), callback);
+		return t;
+	}
+
+	/**
+	 * @brief Write all queued data, waiting for each write cycle to complete
+	 *
+	 * @return true if all of the data was written successfully, false if a write failed or data is still
+	 * queued because the EEPROM could not be read
+	 *
+	 * Call this before sleep or reset if you use asynchronous writes. Completion callbacks are called before
+	 * this returns.
+	 */
+	bool flush();
+
+	/**
+	 * @brief Returns true if there is queued data that has not been completely written yet
+	 */
+	bool hasPendingWrites() const;
+
+	/**
+	 * @brief Writes queued data, called from MCP79410::loop()
+	 *
+	 * If a write cycle is in progress, the EEPROM is polled once and returns if it's still busy. Otherwise,
+	 * the next page with queued data is written, without waiting for the write cycle to complete.
+	 */
+	void loop();
+
+	/**
+	 * @brief Enables differential writes
+	 *
+	 * @param value true to enable, false to disable (default is disabled)
+	 *
+	 * In differential mode, the current contents of the EEPROM are read before writing and only the pages
+	 * that have changed are written. Within a page, only the bytes from the first changed byte to the last
+	 * changed byte are written. This is useful when you put() a structure where only a few fields have
+	 * changed, as it saves both time (about 5 ms per page) and wear on the EEPROM.
+	 *
+	 * Reading is fast compared to writing; reading the whole 128-byte EEPROM takes 4 transactions.
+	 *
+	 * This works with both synchronous and asynchronous writes.
+	 */
+	MCP79410EEPROM &withDifferentialWrite(bool value = true) { differentialWrite = value; return *this; };
+
+	/**
+	 * @brief Gets the write statistics, including how many write cycles were saved by differential mode
+	 */
+	const MCP79410EEPROMStats &getStats() const { return stats; };
+
+	/**
+	 * @brief Clears the write statistics
+	 */
+	void resetStats() { memset(&stats, 0, sizeof(stats)); };
+
+	static const size_t ASYNC_MAX_CALLBACKS = 4; //!< Maximum number of writes with completion callbacks that can be pending at once
+	static const unsigned long ASYNC_RETRY_MS = 100; //!< How long loop() waits before trying a page again after failing to read the EEPROM
+
+protected:
+	/**
+	 * @brief Write data, skipping pages and bytes that are unchanged. Used by writeData() in differential mode.
+	 */
+	bool writeDataDifferential(size_t addr, const uint8_t *data, size_t dataLen);
+
+	bool differentialWrite = false; //!< true if only changed data is written. See withDifferentialWrite().
+	MCP79410EEPROMStats stats; //!< Write statistics. See getStats().
+
+	/**
+	 * @brief Start writing the lowest page that has queued data
+	 *
+	 * @return true if a page was processed (the write was started, or it failed and the page was discarded),
+	 * false if there is nothing to write, or reading the current data failed and the page will be tried again
+	 * after ASYNC_RETRY_MS
+	 */
+	bool asyncStartPage();
+
+	/**
+	 * @brief Start the write cycle for the page being written, or for its next byte in byte mode
+	 *
+	 * @return 0 on success or a non-zero error code
+	 */
+	int asyncWriteStart();
+
+	/**
+	 * @brief Wait for the write cycle in progress, if any, to complete
+	 *
+	 * @param block true to wait for the write cycle to complete, false to poll once and return if still busy
+	 *
+	 * @return true if no write cycle is in progress anymore, false if still busy. Errors are stored in
+	 * asyncInFlightStat.
+	 */
+	bool asyncWaitCycle(bool block);
+
+	/**
+	 * @brief Continue writing the page being written, verify it, and call callbacks
+	 *
+	 * @param block true to wait for each write cycle to complete until the whole page is done, false to start
+	 * at most one write cycle and return if still busy
+	 *
+	 * In byte mode, and when a page write fails to verify in page mode and is retried in byte mode, each byte
+	 * is a separate write cycle, so when not blocking this takes several calls.
+	 *
+	 * @return true if the page was completed (successfully or not), false if still busy
+	 */
+	bool asyncFinishPage(bool block);
+
+	/**
+	 * @brief Record the completion of a page for the pending callbacks, and call any that are done
+	 */
+	void asyncCompletePage(uint8_t page, bool success, uint32_t startSeq);
+
+	/**
+	 * @brief A pending completion callback
+	 */
+	struct AsyncCallback {
+		std::function<void(bool)> callback; //!< Function to call, or empty if this slot is not in use
+		uint16_t pageMask; //!< Pages that still need to be written before calling the callback (bit 0 = page 0)
+		uint32_t seq; //!< Sequence number when the callback was queued
+		bool success; //!< false if any page failed
+	};
+
+	bool asyncWrite = false; //!< true if writeData() queues data. See withAsyncWrite().
+	bool asyncFailed = false; //!< Set if a page write fails, cleared at the start of flush()
+	uint8_t asyncData[128]; //!< Queued data, valid where asyncDirty is set
+	uint8_t asyncDirty[128 / 8]; //!< Bit mask of bytes in asyncData that have not been written yet
+	bool asyncInFlight = false; //!< true if a page write has been started but not completed
+	bool asyncCycleActive = false; //!< true if a write cycle has been started and has not been seen to complete
+	bool asyncInFlightRetry = false; //!< true if the page is being written again in byte mode after it failed to verify
+	int asyncInFlightStat = 0; //!< First error writing the page, 0 if none
+	uint8_t asyncInFlightAddr = 0; //!< EEPROM address of the first byte being written
+	uint8_t asyncInFlightLen = 0; //!< Number of bytes being written
+	uint8_t asyncInFlightData[8]; //!< Copy of the data being written, for verification
+	uint8_t asyncInFlightMask = 0; //!< In byte mode (or retrying), bytes of asyncInFlightData not written yet (bit 0 = asyncInFlightAddr), 0 in page mode
+	uint32_t asyncInFlightSeq = 0; //!< asyncSeq when the write was started
+	unsigned long asyncInFlightStartMs = 0; //!< millis() when the write was started
+	uint32_t asyncSeq = 0; //!< Incremented each time data is queued
+	bool asyncRetryWait = false; //!< true to wait ASYNC_RETRY_MS before trying to start a page again
+	unsigned long asyncRetryMs = 0; //!< millis() when starting a page failed
+	AsyncCallback asyncCallbacks[ASYNC_MAX_CALLBACKS]; //!< Pending completion callbacks
 };
 
 
@@ -293,13 +537,16 @@ public:
 	 * @brief Fill in the fields of this object from a Unix time value (seconds past January 1, 1970) at GMT.
 	 *
 	 * You can set this from the value returned by [Time.now()](https://docs.particle.io/reference/device-os/firmware/#now-), for example.
+	 *
+	 * This does not use gmtime() so it's safe to call from multiple threads.
 	 */
 	void fromUnixTime(time_t unixTime);
 
 	/**
 	 * @brief Convert this object to a Unix time value (seconds past January 1, 1970) at GMT
 	 *
-	 * The rawDayOfWeek field is ignored.
+	 * The rawDayOfWeek field is ignored. This does not use mktime() so the result does not depend on the
+	 * local time zone setting.
 	 */
 	time_t toUnixTime() const;
 
@@ -399,6 +646,79 @@ public:
 	 */
 	void setSecond(int value);
 
+	/**
+	 * @brief Add a number of seconds to this time
+	 *
+	 * @param seconds Number of seconds to add. Can be negative to go back in time.
+	 *
+	 * This carries into minutes, hours, days, months, and years, handling the number of days in each month
+	 * and leap years. The day of week is updated as well. It does not use any C library time functions.
+	 * The hour is stored in 24-hour format afterwards, even if it was in 12-hour format before.
+	 */
+	void addSeconds(int32_t seconds);
+
+	/**
+	 * @brief Add a number of minutes to this time. See addSeconds().
+	 *
+	 * @param minutes Number of minutes to add. Can be negative to go back in time.
+	 */
+	void addMinutes(int32_t minutes);
+
+	/**
+	 * @brief Add a number of days to this time. See addSeconds().
+	 *
+	 * @param days Number of days to add. Can be negative to go back in time.
+	 */
+	void addDays(int32_t days);
+
+	/**
+	 * @brief Returns the number of seconds from other to this time
+	 *
+	 * @param other The time to subtract
+	 *
+	 * @return Positive if this time is after other, negative if before, 0 if they're the same. The day of week
+	 * and status bits are ignored.
+	 */
+	int64_t difference(const MCP79410Time &other) const;
+
+	/**
+	 * @brief Compare this time to other
+	 *
+	 * @return -1 if this time is before other, 0 if they're the same, +1 if this time is after other. The
+	 * day of week and status bits are ignored.
+	 */
+	int compare(const MCP79410Time &other) const;
+
+	bool operator==(const MCP79410Time &other) const { return compare(other) == 0; }; //!< Same time, see compare()
+	bool operator!=(const MCP79410Time &other) const { return compare(other) != 0; }; //!< Different time, see compare()
+	bool operator<(const MCP79410Time &other) const { return compare(other) < 0; }; //!< Earlier time, see compare()
+	bool operator<=(const MCP79410Time &other) const { return compare(other) <= 0; }; //!< Earlier or same time, see compare()
+	bool operator>(const MCP79410Time &other) const { return compare(other) > 0; }; //!< Later time, see compare()
+	bool operator>=(const MCP79410Time &other) const { return compare(other) >= 0; }; //!< Later or same time, see compare()
+
+	/**
+	 * @brief Returns true if the oscillator was running when the time was read (OSCRUN bit)
+	 *
+	 * This is only meaningful for a time read from the RTC using MCP79410::getRTCTime() or deviceReadTime()
+	 * with TIME_MODE_RTC. The status bits are stored in the upper bits of rawDayOfWeek, so they come
+	 * from the same I2C transaction as the time itself and do not require another read.
+	 */
+	bool getOscillatorRunning() const { return (rawDayOfWeek & RTCWKDAY_OSCRUN) != 0; };
+
+	/**
+	 * @brief Returns true if the power failure bit (PWRFAIL) was set when the time was read
+	 *
+	 * Only meaningful for a time read from the RTC. See getOscillatorRunning().
+	 */
+	bool getPowerFail() const { return (rawDayOfWeek & RTCWKDAY_PWRFAIL) != 0; };
+
+	/**
+	 * @brief Returns true if the battery enable bit (VBATEN) was set when the time was read
+	 *
+	 * Only meaningful for a time read from the RTC. See getOscillatorRunning().
+	 */
+	bool getBatteryEnable() const { return (rawDayOfWeek & RTCWKDAY_VBATEN) != 0; };
+
 	/**
 	 * @brief Set the time values for an alarm when second equals alarm
 	 *
@@ -521,6 +841,27 @@ public:
 	 */
 	void setAlarmTime(time_t unixTime);
 
+	/**
+	 * @brief Calculate when an alarm with these settings will go off next
+	 *
+	 * @param after The current time (Unix time, UTC). The result is after (not equal to) this time.
+	 *
+	 * @param next Filled in with the time the alarm goes off next (Unix time, UTC)
+	 *
+	 * The alarm settings are the fields used by alarmMode, as set by setAlarmSecond(), setAlarmMinute(), ...,
+	 * setAlarmTime(), or read from the chip. The alarm goes off on the transition into the matching condition,
+	 * so an ALARM_MINUTE alarm for minute 30 goes off at hh:30:00, and an ALARM_DAY_OF_WEEK alarm at midnight.
+	 * The result is calculated directly, except for ALARM_MONTH_DAY_DOW_HMS, which checks each year for a date
+	 * that's on the right day of week (at most 100 years).
+	 *
+	 * This assumes the RTC day of week is consistent with the date, as it is when the RTC was set by this library.
+	 *
+	 * @return true if the alarm can go off, false if the settings can never match, for example February 30,
+	 * hour 24, a day of week that's never on that date before 2100 (the end of the RTC calendar), or a reserved
+	 * alarmMode
+	 */
+	bool getNextAlarmTime(time_t after, time_t &next) const;
+
 	/**
 	 * @brief Make a reasable representation of this object
 	 *
@@ -545,6 +886,111 @@ public:
 	 */
 	static uint8_t intToBcd(int value);
 
+	/**
+	 * @brief Returns the raw fields packed into a 64-bit value in RTC register order
+	 *
+	 * Byte 0 (least significant) is rawSecond, then rawMinute, rawHour, rawDayOfWeek, rawDayOfMonth,
+	 * rawMonth, and rawYear in byte 6. Byte 7 is 0. This is the same order as registers 0x00 - 0x06.
+	 */
+	uint64_t toRawPacked() const;
+
+	/**
+	 * @brief Sets the raw fields from a 64-bit value in RTC register order. See toRawPacked().
+	 *
+	 * alarmMode is not changed.
+	 */
+	void fromRawPacked(uint64_t packed);
+
+	/**
+	 * @brief Convert up to 8 packed BCD bytes to binary at once
+	 *
+	 * @param value Packed BCD bytes, each 0x00 - 0x99. Mask off any mode bits first, for example using
+	 * RAW_PACKED_VALUE_MASK.
+	 *
+	 * @return Packed binary bytes, each 0 - 99
+	 *
+	 * This is the same as calling bcdToInt() on each byte, but does all of the bytes in a few 64-bit
+	 * operations (SWAR, SIMD within a register).
+	 */
+	static uint64_t bcdToIntPacked(uint64_t value);
+
+	/**
+	 * @brief Convert up to 8 packed binary bytes to BCD at once
+	 *
+	 * @param value Packed binary bytes, each 0 - 99
+	 *
+	 * @return Packed BCD bytes
+	 *
+	 * This is the same as calling intToBcd() on each byte, but avoids the divide and modulo for each
+	 * field. The divide by 10 is done for four 16-bit lanes at a time by multiplying by 103 and shifting
+	 * right by 10, which is exact for 0 - 99.
+	 */
+	static uint64_t intToBcdPacked(uint64_t value);
+
+	/**
+	 * @brief Mask for toRawPacked() that removes the mode and status bits, leaving only BCD digits
+	 *
+	 * Removes ST (seconds), 12/24 hour (hour), OSCRUN, PWRFAIL, VBATEN (day of week), and LPYR (month).
+	 * The AM/PM bit is not removed in 12-hour mode, so check rawHour for 12-hour mode separately.
+	 */
+	static const uint64_t RAW_PACKED_VALUE_MASK = 0x00ff1f3f073f7f7fULL;
+
+	/**
+	 * @brief Number of days since January 1, 1970 for a date in the proleptic Gregorian calendar
+	 *
+	 * @param year The year, for example 2026
+	 *
+	 * @param month The month, 1 = January, 2 = February, ..., 12 = December
+	 *
+	 * @param dayOfMonth The day of the month, 1 - 31
+	 *
+	 * @return Number of days since January 1, 1970. Negative for earlier dates.
+	 *
+	 * This is the days-from-civil algorithm by Howard Hinnant. It does not depend on the time zone or
+	 * any C library state, has no loops, and is constexpr so it can be evaluated at compile time.
+	 */
+	static constexpr int32_t daysFromCivil(int year, int month, int dayOfMonth) {
+		return daysFromCivilMarch(year - (month <= 2 ? 1 : 0), month, dayOfMonth);
+	}
+
+	/**
+	 * @brief Converts a number of days since January 1, 1970 to a date. The inverse of daysFromCivil().
+	 *
+	 * @param days Number of days since January 1, 1970
+	 *
+	 * @param year Filled in with the year, for example 2026
+	 *
+	 * @param month Filled in with the month, 1 - 12
+	 *
+	 * @param dayOfMonth Filled in with the day of the month, 1 - 31
+	 */
+	static void civilFromDays(int32_t days, int &year, int &month, int &dayOfMonth);
+
+	/**
+	 * @brief Returns true if year is a leap year in the Gregorian calendar
+	 */
+	static constexpr bool isLeapYear(int year) {
+		return (year % 4 == 0) && (year % 100 != 0 || year % 400 == 0);
+	}
+
+	/**
+	 * @brief Number of days in a month
+	 *
+	 * @param year The year, for example 2026 (needed for February)
+	 *
+	 * @param month The month, 1 = January, 2 = February, ..., 12 = December
+	 */
+	static constexpr int daysInMonth(int year, int month) {
+		return (month == 2) ? (isLeapYear(year) ? 29 : 28) : (30 + ((month + (month >> 3)) & 1));
+	}
+
+	/**
+	 * @brief Day of week for a number of days since January 1, 1970: 0 = Sunday, 1 = Monday, ..., 6 = Saturday
+	 */
+	static constexpr int weekdayFromDays(int32_t days) {
+		return (days >= -4) ? (int)((days + 4) % 7) : (int)((days + 5) % 7 + 6);
+	}
+
 	const uint8_t ALARM_SECOND = 0; //!< ALMxMSK value stored in ALMxWKDAY. This is set automatically when using setAlarmSecond().
 	const uint8_t ALARM_MINUTE = 1; //!< ALMxMSK value stored in ALMxWKDAY. This is set automatically when using setAlarmMinute().
 	const uint8_t ALARM_HOUR = 2; //!< ALMxMSK value stored in ALMxWKDAY. This is set automatically when using setAlarmHour().
@@ -560,6 +1006,10 @@ public:
 	 */
 	const uint8_t ALARM_MONTH_DAY_DOW_HMS = 7;
 
+	static const uint8_t RTCWKDAY_OSCRUN = 0x20; //!< Oscillator running status bit in rawDayOfWeek (RTC time only)
+	static const uint8_t RTCWKDAY_PWRFAIL = 0x10; //!< Power failure status bit in rawDayOfWeek (RTC time only)
+	static const uint8_t RTCWKDAY_VBATEN = 0x08; //!< Battery enabled bit in rawDayOfWeek (RTC time only)
+
 	uint8_t rawYear; //!< MCP79410 raw year value, BCD 0 <= year <= 99. Not used for alarms.
 
 	uint8_t rawMonth; //!< MCP79410 raw month value, BCD 1 <= month <= 12. Also contains leap year bit when reading the time.
@@ -570,8 +1020,8 @@ public:
 	 * @brief MCP79410 raw day of week value, BCD 1 <= dayOfWeek <= 7.
 	 *
 	 * The RTC does not enforce a day of week convention but this library does. 1 = Sunday, 7 = Saturday.
-	 * This is because of how it's set based on the Unix mktime/gmtime functions. However, mktime is zero
-	 * based, so be careful of that.
+	 * This matches the Unix struct tm convention plus one, because tm_wday is zero based (0 = Sunday), so
+	 * be careful of that.
 	 */
 	uint8_t rawDayOfWeek; // BCD see code for warnings!
 
@@ -592,49 +1042,374 @@ public:
 	 * Note that these values are 0-7 and are shifted when storing in the ALxMSK value in the ALMxWKDAY register.
 	 */
 	uint8_t alarmMode = 0;
+
+protected:
+	/**
+	 * @brief Helper for daysFromCivil(). year has already been adjusted so the year starts in March.
+	 */
+	static constexpr int32_t daysFromCivilMarch(int year, int month, int dayOfMonth) {
+		return daysFromCivilEra((year >= 0 ? year : year - 399) / 400, year, month, dayOfMonth);
+	}
+
+	/**
+	 * @brief Helper for daysFromCivil(). era is the 400-year cycle containing year.
+	 */
+	static constexpr int32_t daysFromCivilEra(int era, int year, int month, int dayOfMonth) {
+		return era * 146097
+			+ (year - era * 400) * 365 + (year - era * 400) / 4 - (year - era * 400) / 100
+			+ (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + dayOfMonth - 1
+			- 719468;
+	}
 };
 
 /**
- * @brief Class for managing the MCP79410 real-time clock chip with SRAM and EEPROM
+ * @brief A recurring alarm schedule, like "every day at 02:30" or "every 15 minutes". See MCP79410::setAlarm().
  *
- * You typically instantiate one of these as a global variable in your program.
+ * All times are UTC. Use the static methods to create one:
  *
  * ```
- * #include "MCP79410RK.h"
- *
- * MCP79410 rtc;
- *
- * void setup() {
- * 	rtc.setup();
- * }
- *
- * void loop() {
- * 	rtc.loop();
- * }
+ * rtc.setAlarm(MCP79410Schedule::everyDay(2, 30));
+ * rtc.setAlarm(MCP79410Schedule::every(15 * 60));
  * ```
+ *
+ * The hardware alarm only matches one field at a time (second, minute, hour, day of week, or day of month)
+ * with all of the lower fields zero, or the whole date and time. When the schedule can be expressed that way,
+ * for example "every hour at :30" or "every day at 02:00", isNative() is true and the hardware repeats the
+ * alarm by itself. Otherwise, the alarm is set for the next occurrence and MCP79410::loop() sets it for the
+ * following one after it goes off.
  */
-class MCP79410 {
+class MCP79410Schedule {
 public:
 	/**
-	 * @brief Constructor for MCP79410 objects.
+	 * @brief Default constructor. The schedule is not valid until set using one of the static methods.
+	 */
+	MCP79410Schedule() {};
+
+	/**
+	 * @brief Every intervalSec seconds, at times where (Unix time - offsetSec) is a multiple of intervalSec
 	 *
-	 * @param wire The I2C interface to use. Optional, default is Wire. On some devices you can use Wire1.
+	 * @param intervalSec Interval in seconds (at least 1)
+	 *
+	 * @param offsetSec Offset in seconds (default: 0). Intervals that divide evenly into a day are aligned
+	 * to midnight UTC plus this offset.
+	 *
+	 * For example, every(15 * 60) is at :00, :15, :30, and :45 every hour.
 	 */
-	MCP79410(TwoWire &wire = Wire);
+	static MCP79410Schedule every(uint32_t intervalSec, uint32_t offsetSec = 0);
 
 	/**
-	 * @brief Destructor. Not typically deleted as it's normally instantiated as a global variable.
+	 * @brief Every minute at the given second (0 - 59). This is always native (ALMxMSK second match).
+	 *
+	 * The schedule is not valid if second is out of range.
 	 */
-	virtual ~MCP79410();
+	static MCP79410Schedule everyMinute(int second = 0);
 
+	/**
+	 * @brief Every hour at the given minute (0 - 59) and second (0 - 59). Native (minute match) if second is 0.
+	 *
+	 * The schedule is not valid if minute or second is out of range.
+	 */
+	static MCP79410Schedule everyHour(int minute = 0, int second = 0);
 
 	/**
-	 * @brief Sets the time synchronization mode
+	 * @brief Every day at the given time (hour 0 - 23). Native (hour match) if minute and second are 0.
 	 *
-	 * | Constant | Value | Description |
-	 * | -------- | ----- | ----------- |
-	 * | TIME_SYNC_NONE | 0b00 | No automatic time synchronization |
-	 * | TIME_SYNC_CLOUD_TO_RTC | 0b01 | RTC is set from cloud time at startup |
+	 * The schedule is not valid if hour, minute, or second is out of range.
+	 */
+	static MCP79410Schedule everyDay(int hour, int minute = 0, int second = 0);
+
+	/**
+	 * @brief Every week on the given day (0 = Sunday, ..., 6 = Saturday) and time. Native (day of week match) if
+	 * the time is midnight.
+	 *
+	 * The schedule is not valid if any of the parameters is out of range.
+	 */
+	static MCP79410Schedule everyWeek(int dayOfWeek, int hour = 0, int minute = 0, int second = 0);
+
+	/**
+	 * @brief Every month on the given day (1 - 31) and time. Native (day of month match) if the time is midnight.
+	 *
+	 * Months that don't have that day are skipped. The schedule is not valid if any of the parameters is out
+	 * of range.
+	 */
+	static MCP79410Schedule everyMonth(int dayOfMonth, int hour = 0, int minute = 0, int second = 0);
+
+	/**
+	 * @brief Returns true if this was set using one of the static methods with valid parameters
+	 */
+	bool isValid() const { return kind != KIND_NONE; };
+
+	/**
+	 * @brief Returns true if the hardware alarm can repeat this schedule by itself
+	 */
+	bool isNative() const;
+
+	/**
+	 * @brief Gets the hardware alarm setting for a native schedule
+	 *
+	 * @param time Filled in with the alarm values and alarmMode, for MCP79410::setAlarm()
+	 *
+	 * @return true if this schedule is native, false if not (time is not modified)
+	 */
+	bool getNativeAlarm(MCP79410Time &time) const;
+
+	/**
+	 * @brief Returns the first time in this schedule after (not equal to) time, or 0 if the schedule is not valid
+	 */
+	time_t nextAfter(time_t time) const;
+
+	static const uint8_t KIND_NONE = 0; //!< Not set
+	static const uint8_t KIND_INTERVAL = 1; //!< Every intervalSec, offset by offsetSec
+	static const uint8_t KIND_MONTHLY = 2; //!< Every month on dayOfMonth, at offsetSec seconds after midnight
+
+protected:
+	/**
+	 * @brief Returns true if hour is 0 - 23 and minute and second are 0 - 59
+	 */
+	static bool isValidTimeOfDay(int hour, int minute, int second);
+
+	uint8_t kind = KIND_NONE; //!< KIND_NONE, KIND_INTERVAL, or KIND_MONTHLY
+	uint8_t dayOfMonth = 0; //!< For KIND_MONTHLY, day of month 1 - 31
+	uint32_t intervalSec = 0; //!< For KIND_INTERVAL, the interval in seconds
+	uint32_t offsetSec = 0; //!< For KIND_INTERVAL, offset less than intervalSec. For KIND_MONTHLY, seconds after midnight.
+
+	friend class MCP79410;
+};
+
+/**
+ * @brief The RTC error measured at a cloud time sync. See MCP79410::getSyncError().
+ */
+struct MCP79410SyncError {
+	time_t time; //!< Cloud time (Time.now()) when the error was measured
+	int32_t errorMs; //!< RTC time minus cloud time in milliseconds. Positive if the RTC is ahead.
+	int32_t residualMs; //!< Error remaining after this sync: errorMs if the RTC was not rewritten, otherwise 0
+	bool precise; //!< true if errorMs was measured to the millisecond, false if only to the second
+	bool corrected; //!< true if the RTC was rewritten because the error exceeded the threshold
+};
+
+/**
+ * @brief Result of measuring the square wave output on MFP. See MCP79410::measureSquareWave().
+ */
+struct MCP79410SquareWaveResult {
+	uint32_t edges; //!< Number of rising edges counted during the gate time
+	uint32_t elapsedUs; //!< micros() from the first to the last rising edge
+	float nominalHz; //!< Frequency selected by the freq parameter
+	float frequencyHz; //!< Measured frequency: (edges - 1) cycles over elapsedUs
+	float errorPpm; //!< Error of the measured frequency in ppm. Positive if the RTC oscillator is fast.
+	float rtcErrorPpm; //!< Estimated error of RTC timekeeping with the current trim, in ppm. Positive if the RTC is fast.
+};
+
+/**
+ * @brief Bus transaction counters and latency histograms. See MCP79410::withBusStats().
+ */
+struct MCP79410BusStats {
+	static const size_t OP_READ = 0; //!< Index into latencyHistogram for deviceRead()
+	static const size_t OP_WRITE = 1; //!< Index into latencyHistogram for deviceWrite()
+	static const size_t OP_EEPROM_WRITE = 2; //!< Index into latencyHistogram for deviceWriteEEPROM(), including write cycles
+	static const size_t OP_EEPROM_WAIT = 3; //!< Index into latencyHistogram for waitForEEPROM()
+	static const size_t OP_COUNT = 4; //!< Number of operation types
+
+	/**
+	 * @brief Number of histogram buckets.
+	 *
+	 * Bucket 0 is < 32 microseconds, bucket 1 is 32 - 63 microseconds, bucket 2 is 64 - 127 microseconds, ...
+	 * doubling each time, and the last bucket (11) is >= 32768 microseconds.
+	 */
+	static const size_t HISTOGRAM_BUCKETS = 12;
+
+	static const size_t ERROR_CODES = 8; //!< Size of the errors array
+
+	uint32_t readTransactions; //!< Number of read transactions (register address write + read)
+	uint32_t writeTransactions; //!< Number of register and SRAM write transactions
+	uint32_t eepromWriteTransactions; //!< Number of EEPROM write transactions (each starts a write cycle)
+	uint32_t eepromPolls; //!< Number of EEPROM ACK polls while waiting for the write cycle to complete
+	uint32_t eepromTimeouts; //!< Number of times waitForEEPROM() timed out
+	uint32_t eepromVerifyFailures; //!< Number of EEPROM pages that did not verify after writing
+	uint32_t bytesRead; //!< Number of data bytes read, not including addresses
+	uint32_t bytesWritten; //!< Number of data bytes written, not including addresses
+
+	/**
+	 * @brief Number of failed operations by error code
+	 *
+	 * errors[1] to errors[7] are the transport error codes 1 - 7 (2 = address NACK, for example). errors[0]
+	 * counts all other errors, such as ERROR_EEPROM_VERIFY and ERROR_EEPROM_TIMEOUT.
+	 */
+	uint32_t errors[ERROR_CODES];
+
+	uint32_t latencyHistogram[OP_COUNT][HISTOGRAM_BUCKETS]; //!< Number of operations by latency. See HISTOGRAM_BUCKETS.
+};
+
+/**
+ * @brief Copy of the whole timekeeping, alarm, and power-fail register block (0x00 - 0x1f)
+ *
+ * This is filled in by MCP79410::readRegisterSnapshot() in a single 32-byte I2C transaction. All of the
+ * accessors decode from the copy in RAM, so you get a coherent view of the registers at a single instant
+ * and calling the accessors does not access the bus.
+ *
+ * ```
+ * MCP79410RegisterSnapshot snapshot;
+ * if (rtc.readRegisterSnapshot(snapshot)) {
+ *     MCP79410Time t;
+ *     bool valid = snapshot.getRTCTime(t);
+ *     bool powerFail = snapshot.getPowerFail();
+ *     bool alarm0 = snapshot.getInterrupt(0);
+ * }
+ * ```
+ */
+class MCP79410RegisterSnapshot {
+public:
+	/**
+	 * @brief Constructor. The register data is cleared to 0.
+	 */
+	MCP79410RegisterSnapshot();
+
+	/**
+	 * @brief Destructor
+	 */
+	virtual ~MCP79410RegisterSnapshot();
+
+	/**
+	 * @brief Get the RTC time from the snapshot
+	 *
+	 * @param time Filled in with the RTC time, including the status bits in rawDayOfWeek.
+	 *
+	 * @return true if the time is valid (year is set and the oscillator is running). This works the same
+	 * as MCP79410::getRTCTime().
+	 */
+	bool getRTCTime(MCP79410Time &time) const;
+
+	/**
+	 * @brief Get the alarm settings from the snapshot
+	 *
+	 * @param alarmNum 0 or 1
+	 *
+	 * @param time Filled in with the alarm time. alarmMode is set from the ALMxMSK bits. rawYear is the RTC year.
+	 */
+	void getAlarm(int alarmNum, MCP79410Time &time) const;
+
+	/**
+	 * @brief Returns true if the ALMxIF bit was set for the given alarm
+	 *
+	 * @param alarmNum 0 or 1
+	 */
+	bool getInterrupt(int alarmNum) const;
+
+	/**
+	 * @brief Returns true if the given alarm was enabled in the control register
+	 *
+	 * @param alarmNum 0 or 1
+	 */
+	bool getAlarmEnabled(int alarmNum) const;
+
+	/**
+	 * @brief Get the power down time from the snapshot
+	 *
+	 * The power failure times do not include a year, so rawYear is set to the RTC year from the same snapshot.
+	 */
+	void getPowerDownTime(MCP79410Time &time) const;
+
+	/**
+	 * @brief Get the power up time from the snapshot
+	 *
+	 * The power failure times do not include a year, so rawYear is set to the RTC year from the same snapshot.
+	 */
+	void getPowerUpTime(MCP79410Time &time) const;
+
+	/**
+	 * @brief Returns true if the oscillator was running (OSCRUN)
+	 */
+	bool getOscillatorRunning() const;
+
+	/**
+	 * @brief Returns true if the power failure bit was set (PWRFAIL)
+	 */
+	bool getPowerFail() const;
+
+	/**
+	 * @brief Returns true if the battery was enabled (VBATEN)
+	 */
+	bool getBatteryEnable() const;
+
+	/**
+	 * @brief Returns the raw value of the control register (REG_CONTROL, 0x07)
+	 */
+	uint8_t getControl() const;
+
+	/**
+	 * @brief Returns the oscillator trim value as a signed value, the same format as MCP79410::setOscTrim()
+	 */
+	int8_t getOscTrim() const;
+
+	/**
+	 * @brief Returns the raw value of the oscillator trim register (REG_OSCTRIM, 0x08), including the sign bit
+	 */
+	uint8_t getOscTrimRaw() const;
+
+	static const size_t SNAPSHOT_SIZE = 32; //!< Number of bytes in the snapshot (registers 0x00 - 0x1f)
+
+	uint8_t raw[SNAPSHOT_SIZE]; //!< Raw register values. raw[0] is register 0x00 (RTCSEC).
+};
+
+/**
+ * @brief Class for managing the MCP79410 real-time clock chip with SRAM and EEPROM
+ *
+ * You typically instantiate one of these as a global variable in your program.
+ *
+ * ```
+ * #include "MCP79410RK.h"
+ *
+ * MCP79410 rtc;
+ *
+ * void setup() {
+ * 	rtc.setup();
+ * }
+ *
+ * void loop() {
+ * 	rtc.loop();
+ * }
+ * ```
+ */
+class MCP79410 {
+public:
+#ifndef MCP79410_DISABLE_TWOWIRE
+	/**
+	 * @brief Constructor for MCP79410 objects.
+	 *
+	 * @param wire The I2C interface to use. Optional, default is Wire. On some devices you can use Wire1.
+	 */
+	MCP79410(TwoWire &wire = Wire);
+#endif
+
+	/**
+	 * @brief Constructor for MCP79410 objects using a custom bus transport
+	 *
+	 * @param transport The bus transport to use. This object is not copied and must remain valid for the
+	 * lifetime of the MCP79410 object, so it's typically a global variable as well.
+	 *
+	 * Use this to access the chip through something other than a TwoWire object, such as an I2C
+	 * multiplexer, DMA-based I2C driver, or simulator. See MCP79410Transport. No TwoWire adapter is
+	 * created, so Wire is not used.
+	 */
+	MCP79410(MCP79410Transport &transport);
+
+	/**
+	 * @brief Gets the bus transport used by this object
+	 */
+	MCP79410Transport &getTransport() { return *transport; };
+
+	/**
+	 * @brief Destructor. Not typically deleted as it's normally instantiated as a global variable.
+	 */
+	virtual ~MCP79410();
+
+
+	/**
+	 * @brief Sets the time synchronization mode
+	 *
+	 * | Constant | Value | Description |
+	 * | -------- | ----- | ----------- |
+	 * | TIME_SYNC_NONE | 0b00 | No automatic time synchronization |
+	 * | TIME_SYNC_CLOUD_TO_RTC | 0b01 | RTC is set from cloud time at startup |
 	 * | TIME_SYNC_RTC_TO_TIME | 0b10 | Time object is set from RTC at startup (if RTC appears valid) |
 	 * | TIME_SYNC_AUTOMATIC | 0b11 | Time is synchronized in both directions (default value) |
 	 *
@@ -662,6 +1437,96 @@ public:
 	 */
 	MCP79410 &withBatteryEnable(bool value) { setBatteryEnable(value); return *this; }
 
+	/**
+	 * @brief Sets whether EEPROM writes use 8-byte page writes (default: true)
+	 *
+	 * @param value true to write up to 8 bytes per write cycle, false to write one byte per write cycle
+	 *
+	 * In page write mode, data is split on the 8-byte EEPROM page boundaries and each page is written in a
+	 * single write cycle (about 5 ms), then read back to verify. If a page does not verify, that page only
+	 * is rewritten one byte at a time. This makes writing the whole 128-byte EEPROM about 8 times faster
+	 * than byte mode.
+	 *
+	 * In byte mode, each byte is a separate write cycle, which is how versions 0.0.4 and earlier worked. The
+	 * data is still read back to verify it, so writes to a block-protected area fail in both modes.
+	 *
+	 * The withXXX() syntax allows you to chain multiple options, fluent-style.
+	 */
+	MCP79410 &withEEPROMPageWrite(bool value = true) { eepromPageWrite = value; return *this; }
+
+	/**
+	 * @brief Sets the EEPROM write cycle timing used by waitForEEPROM()
+	 *
+	 * @param minMs Time to wait after a write before polling the EEPROM, in milliseconds (default: 2). No
+	 * I2C transactions are done during this time.
+	 *
+	 * @param timeoutMs Maximum time to wait for the write cycle to complete, in milliseconds (default: 10).
+	 * The datasheet maximum write cycle time is 5 ms.
+	 *
+	 * The withXXX() syntax allows you to chain multiple options, fluent-style.
+	 */
+	MCP79410 &withEEPROMWriteCycleTiming(unsigned long minMs, unsigned long timeoutMs) { eepromWriteCycleMinMs = minMs; eepromWriteCycleTimeoutMs = timeoutMs; return *this; }
+
+	/**
+	 * @brief Enables bus transaction counters and latency histograms
+	 *
+	 * @param value true to enable, false to disable (default is disabled)
+	 *
+	 * When enabled, deviceRead(), deviceWrite(), deviceWriteEEPROM() and waitForEEPROM() count transactions,
+	 * bytes, errors by code, EEPROM polls, and record the latency of each call in a histogram. Use
+	 * getBusStats() to get a copy of the counters. This allocates a MCP79410BusStats structure on the heap
+	 * when enabled. Asynchronous EEPROM writes (MCP79410EEPROM::withAsyncWrite()) are included in the
+	 * counters. Each error is counted once, by the transaction that failed.
+	 *
+	 * When disabled, the overhead is one pointer check per call. To remove the code entirely, define
+	 * MCP79410_DISABLE_BUS_STATS when compiling MCP79410RK.cpp. Then this does nothing and getBusStats()
+	 * returns false.
+	 *
+	 * The withXXX() syntax allows you to chain multiple options, fluent-style.
+	 */
+	MCP79410 &withBusStats(bool value = true);
+
+	/**
+	 * @brief Gets a copy of the bus transaction counters
+	 *
+	 * @param stats Filled in with the counters
+	 *
+	 * @return true on success, false if withBusStats() has not been enabled
+	 */
+	bool getBusStats(MCP79410BusStats &stats) const;
+
+	/**
+	 * @brief Clears the bus transaction counters
+	 */
+	void resetBusStats();
+
+	/**
+	 * @brief Enables a write-through shadow of the host-owned configuration registers
+	 *
+	 * @param value true to enable the shadow, false to disable (default is disabled)
+	 *
+	 * The control register (REG_CONTROL), oscillator trim register (REG_OSCTRIM), and the configuration bits of
+	 * the two ALMxWKDAY registers are only changed by this library, not by the hardware. When the shadow
+	 * is enabled, the values are remembered from the first time they are read or written, and setting or
+	 * clearing a flag (setAlarm(), clearAlarm(), clearInterrupt(), setSquareWaveMode(), ...) becomes a single
+	 * I2C write instead of a read followed by a write.
+	 *
+	 * Hardware-volatile bits (ALMxIF, OSCRUN, PWRFAIL, and the time registers) are always read from the chip.
+	 * The shadow is discarded on any I2C error. If something other than this object modifies the registers
+	 * (another MCU, or another MCP79410 object), do not enable the shadow, or call invalidateRegisterShadow()
+	 * after the change.
+	 *
+	 * The withXXX() syntax allows you to chain multiple options, fluent-style.
+	 */
+	MCP79410 &withRegisterShadow(bool value = true) { registerShadowEnabled = value; invalidateRegisterShadow(); return *this; }
+
+	/**
+	 * @brief Discard the shadowed register values so they will be read from the chip again
+	 *
+	 * This is done automatically if an I2C error occurs. See withRegisterShadow().
+	 */
+	void invalidateRegisterShadow() const { registerShadowValid = 0; };
+
 
 	/**
 	 * @brief setup call, call during setup()
@@ -677,9 +1542,78 @@ public:
 	 * @brief Set the RTC from the cloud time (if valid)
 	 *
 	 * You normally don't need to do this, as it's done automatically from loop().
+	 *
+	 * To avoid up to a second of error, the write is aligned to the system clock's second boundary. Writing
+	 * the time registers does not reset the RTC's divider chain, so first the oscillator is stopped (ST
+	 * cleared, then waiting for OSCRUN to clear), which resets it. Then this waits (blocking, up to about
+	 * 1 second, yielding to other threads) for Time.now() to change, and writes all of the time registers
+	 * with ST set in a single I2C transaction, which starts the second at that moment. When called
+	 * automatically from loop(), the wait is only a few milliseconds because loop() keeps track of when
+	 * Time.now() changes and only calls this just before the next change.
+	 *
+	 * The remaining error is mostly the oscillator start-up time.
+	 *
+	 * After the write, loop() measures when the RTC seconds actually roll over, relative to the system
+	 * clock. See getLastSetPhaseErrorMs().
+	 *
+	 * If the write fails, the oscillator is started again, so the RTC keeps running with its old time. If
+	 * Time.now() does not change within the wait, the RTC is set to the current time without aligning it.
+	 *
+	 * @return true on success, false if the cloud time is not valid or the RTC could not be written
 	 */
 	bool setRTCFromCloud();
 
+	/**
+	 * @brief Sets how far off the RTC can be before it's rewritten on a later cloud time sync
+	 *
+	 * @param thresholdMs Maximum error in milliseconds (default: 500). 0 disables checking on later syncs.
+	 *
+	 * The RTC is always set from the cloud at the first cloud time sync (if TIME_SYNC_CLOUD_TO_RTC is
+	 * enabled). On each later sync (when Particle.timeSyncedLast() changes), loop() compares the RTC time
+	 * to the cloud time and only rewrites the RTC if the error is larger than thresholdMs. Each
+	 * measurement is recorded; see getSyncError().
+	 *
+	 * The comparison uses the getRTCTimeMs() anchor if there is one (see withRTCTimeMs() and withCachedClock()),
+	 * which measures the error to the millisecond. Otherwise it's a single read of the RTC in the middle of the
+	 * system clock second, which measures the error to the nearest second, so with the default threshold the
+	 * RTC is rewritten when it's off by more than half a second.
+	 *
+	 * The withXXX() syntax allows you to chain multiple options, fluent-style.
+	 */
+	MCP79410 &withResyncThreshold(unsigned long thresholdMs) { resyncThresholdMs = thresholdMs; return *this; }
+
+	/**
+	 * @brief Gets the number of recorded sync errors, up to SYNC_ERROR_HISTORY
+	 */
+	size_t getSyncErrorCount() const { return syncErrorCount; };
+
+	/**
+	 * @brief Gets a recorded sync error
+	 *
+	 * @param index 0 is the most recent, 1 the one before that, ..., up to getSyncErrorCount() - 1
+	 *
+	 * The first sync, which always sets the RTC, is recorded too if the RTC was valid before it.
+	 */
+	const MCP79410SyncError &getSyncError(size_t index = 0) const { return syncErrors[(syncErrorNext + SYNC_ERROR_HISTORY - 1 - (index % SYNC_ERROR_HISTORY)) % SYNC_ERROR_HISTORY]; };
+
+	/**
+	 * @brief Gets the phase error of the last setRTCFromCloud(), in milliseconds
+	 *
+	 * This is the difference between when the RTC seconds rolled over after the RTC was set and when the
+	 * system clock seconds rolled over, in the range -499 to 500. Positive means the RTC is behind the
+	 * system clock. It's measured by loop() within a few seconds of setting the RTC. Whether the RTC restarts
+	 * its sub-second count when the seconds register is written is not documented, so this is measured
+	 * rather than assumed.
+	 *
+	 * This includes the error in detecting the change in Time.now(), which is the resolution of millis().
+	 */
+	int32_t getLastSetPhaseErrorMs() const { return lastSetPhaseErrorMs; };
+
+	/**
+	 * @brief Returns true if getLastSetPhaseErrorMs() has been measured since the last setRTCFromCloud()
+	 */
+	bool hasSetPhaseError() const { return setPhaseValid; };
+
 	/**
 	 * @brief Set the RTC to a specific unixTime
 	 *
@@ -691,22 +1625,186 @@ public:
 
 	/**
 	 * @brief Returns true if the RTC time is believed to be valid.
+	 *
+	 * This reads the RTC to check the oscillator, even when withCachedClock() is enabled, because the cached
+	 * clock doesn't notice the oscillator stopping until the next resync. With withSecondsCounter(), it
+	 * doesn't read the RTC while the 1 Hz edges are being counted.
+	 */
+	bool isRTCValid() const;
+
+	/**
+	 * @brief Get the RTC time as a Unix time value
+	 *
+	 * The Unix time, seconds from January 1, 1970, at UTC. This has the same semantics as [Time.now()](https://docs.particle.io/reference/device-os/firmware/#now-).
+	 */
+	time_t getRTCTime() const;
+
+	/**
+	 * @brief Get the RTC time as a MCP79410Time object
+	 *
+	 * This is handy if you want to get the second, hour, minute, dayOfMonth, etc..
+	 *
+	 * This is a single I2C transaction. The oscillator running, power failure, and battery enable status
+	 * bits are returned in the same read and can be checked using time.getOscillatorRunning(),
+	 * time.getPowerFail(), and time.getBatteryEnable() without accessing the bus again.
+	 *
+	 * @return true if the time is valid (year is set and the oscillator is running). If false is returned
+	 * because the RTC is not valid, time is still filled in with the values read from the chip so the
+	 * status bits can be examined.
+	 */
+	bool getRTCTime(MCP79410Time &time) const;
+
+	/**
+	 * @brief Enables millisecond RTC time from getRTCTimeMs()
+	 *
+	 * @param value true to enable, false to disable (default is disabled)
+	 *
+	 * @param resyncIntervalMs How often to measure the seconds rollover again, in milliseconds (default: 10 minutes)
+	 *
+	 * The MCP79410 only counts whole seconds. When this is enabled, loop() finds the moment the RTC
+	 * seconds register changes and remembers the millis() value at that moment (the anchor). After that,
+	 * getRTCTimeMs() calculates the time from millis() without any I2C transactions.
+	 *
+	 * Finding the rollover is done in two steps so loop() never blocks for long. First, the seconds register
+	 * is read every 20 milliseconds until it changes, which locates the rollover to within 20 ms. Then, just
+	 * before the next expected rollover, the seconds register is read continuously until it changes, which
+	 * blocks for at most about 60 ms. The same short measurement is repeated every resyncIntervalMs to
+	 * measure how much millis() and the RTC drift relative to each other. See getAnchorDriftPpm().
+	 *
+	 * You can also call syncRTCTimeMs() to set the anchor immediately, blocking for up to a second.
+	 *
+	 * The withXXX() syntax allows you to chain multiple options, fluent-style.
+	 */
+	MCP79410 &withRTCTimeMs(bool value = true, unsigned long resyncIntervalMs = 600000) { rtcTimeMsEnabled = value; anchorResyncIntervalMs = resyncIntervalMs; return *this; }
+
+	/**
+	 * @brief Enables the cached clock, which serves getRTCTime() without I2C transactions
+	 *
+	 * @param value true to enable, false to disable (default is disabled)
+	 *
+	 * @param errorBoundMs The maximum error in milliseconds allowed for a cached time (default: 100)
+	 *
+	 * This uses the same anchor as getRTCTimeMs() (see withRTCTimeMs()), which loop() maintains while this
+	 * is enabled. getRTCTime() extrapolates from the anchor using millis() and the measured
+	 * drift. The possible error grows with the age of the anchor: 200 ppm is assumed until the drift has
+	 * been measured, and after that the uncertainty of the drift measurement. When the possible error would
+	 * exceed errorBoundMs, loop() measures the rollover again, and until it does, getRTCTime() reads the
+	 * RTC as usual.
+	 *
+	 * getRTCTime(MCP79410Time &) always reads the RTC because it returns the status bits as well. So does
+	 * isRTCValid(), because between resyncs the cached clock can't tell if the oscillator has stopped.
+	 *
+	 * The withXXX() syntax allows you to chain multiple options, fluent-style.
+	 */
+	MCP79410 &withCachedClock(bool value = true, unsigned long errorBoundMs = 100) { cachedClock = value; cachedClockErrorBoundMs = errorBoundMs; return *this; }
+
+	/**
+	 * @brief Find the RTC seconds rollover and set the anchor for getRTCTimeMs(), blocking
+	 *
+	 * @param timeoutMs Maximum time to wait for the rollover in milliseconds (default: 1100)
+	 *
+	 * This reads the seconds register continuously until it changes, which takes up to 1 second. The
+	 * resulting anchor is accurate to about the duration of one I2C transaction (less than 1 ms at
+	 * 100 kHz).
+	 *
+	 * @return true on success, false if the RTC is not valid or the rollover was not found in time
+	 */
+	bool syncRTCTimeMs(unsigned long timeoutMs = 1100);
+
+	/**
+	 * @brief Get the RTC time in milliseconds since January 1, 1970, at UTC
+	 *
+	 * This does not access the I2C bus. The time is calculated from the anchor found by loop() (see
+	 * withRTCTimeMs()) or syncRTCTimeMs(), the elapsed millis(), and the measured drift between
+	 * millis() and the RTC. It's safe to call from other threads.
+	 *
+	 * @return The time in milliseconds, or 0 if there is no anchor yet
+	 */
+	uint64_t getRTCTimeMs() const;
+
+	/**
+	 * @brief Returns true if getRTCTimeMs() has an anchor and will return a time
+	 */
+	bool hasRTCTimeMsAnchor() const { return anchorState >= ANCHOR_STATE_VALID; };
+
+	/**
+	 * @brief Difference between the predicted and measured time of the seconds rollover at the last resync
+	 *
+	 * @return Milliseconds. Positive if the rollover happened later than predicted (the RTC is slow
+	 * relative to millis() after drift correction), negative if it happened earlier.
+	 *
+	 * This is the drift detection for getRTCTimeMs(): it shows how far off the interpolated time was just
+	 * before the anchor was updated.
+	 */
+	int32_t getLastAnchorOffsetMs() const { return lastAnchorOffsetMs; };
+
+	/**
+	 * @brief Gets the measured rate difference between the RTC and millis(), in parts per million
+	 *
+	 * Positive if the RTC runs faster than millis(). This is measured between resyncs at least
+	 * one minute apart, and 0 until then. Each measurement is averaged with the previous ones, weighted by
+	 * interval, over about the last ANCHOR_DRIFT_FILTER_MS (1 hour). It's used to correct the interpolated time.
+	 */
+	float getAnchorDriftPpm() const { return anchorDriftPpm; };
+
+	/**
+	 * @brief Enables the seconds counter, which counts the 1 Hz square wave on MFP with a pin interrupt
+	 *
+	 * @param pin The pin MFP is connected to. MFP is open-drain, so it needs a pull-up; the pin is set to
+	 * INPUT_PULLUP.
+	 *
+	 * @param verifyIntervalMs How often loop() compares the counter to the RTC, in milliseconds (default:
+	 * 3600000, 1 hour)
+	 *
+	 * setup() puts MFP in 1 Hz square wave mode and attaches an interrupt handler that increments a counter
+	 * on each rising edge. loop() reads the RTC once, right after an edge, to find the time that corresponds
+	 * to the counter, and again every verifyIntervalMs to make sure they still agree. After that,
+	 * getRTCTime() and isRTCValid() are served from the counter without accessing the I2C bus, and since the
+	 * counter is driven by the RTC oscillator, there's no drift to correct for. getSecondsCounterTime() can
+	 * be called from an interrupt handler to time stamp events.
+	 *
+	 * While this is enabled, MFP can't be used for alarm output (square wave mode overrides the alarm
+	 * enables), so you can't use setAlarm() to wake from sleep. For the same reason, setup() logs an error
+	 * and leaves the seconds counter off if withAlarmInterrupt() is also used, or if an alarm is enabled
+	 * in the RTC. If the edges stop, for example because square wave mode was turned off, getRTCTime()
+	 * goes back to reading the RTC.
+	 *
+	 * If a verification finds the counter doesn't match the RTC, getRTCTime() reads the RTC until the counter
+	 * is matched again on the next edge. After SECONDS_COUNTER_MAX_MISMATCHES mismatches, the seconds counter
+	 * is disabled.
+	 *
+	 * The withXXX() syntax allows you to chain multiple options, fluent-style.
+	 */
+	MCP79410 &withSecondsCounter(pin_t pin, unsigned long verifyIntervalMs = 3600000) { secondsCounterEnabled = true; secondsCounterPin = pin; secondsCounterVerifyIntervalMs = verifyIntervalMs; return *this; }
+
+	/**
+	 * @brief Get the RTC time from the seconds counter. Safe to call from an interrupt handler.
+	 *
+	 * @return The time as a Unix time, or 0 if the seconds counter is not enabled, has not been matched
+	 * to the RTC yet, or the edges have stopped. See withSecondsCounter().
 	 */
-	bool isRTCValid() const;
+	time_t getSecondsCounterTime() const;
 
 	/**
-	 * @brief Get the RTC time as a Unix time value
+	 * @brief Returns the number of times loop() found the seconds counter did not match the RTC
 	 *
-	 * The Unix time, seconds from January 1, 1970, at UTC. This has the same semantics as [Time.now()](https://docs.particle.io/reference/device-os/firmware/#now-).
+	 * This is caused by missed or extra edges, for example from noise on the pin. Each mismatch makes
+	 * getRTCTime() read the RTC until the counter is matched again. Setting the RTC time with
+	 * setRTCTime() is not counted; the counter is matched to the RTC again after that.
 	 */
-	time_t getRTCTime() const;
+	uint32_t getSecondsCounterMismatches() const { return secondsCounterMismatches; };
 
 	/**
-	 * @brief Get the RTC time as a MCP79410Time object
+	 * @brief Read the whole timekeeping, alarm, and power-fail register block in one transaction
 	 *
-	 * This is handy if you want to get the second, hour, minute, dayOfMonth, etc..
+	 * @param snapshot Filled in with registers 0x00 - 0x1f
+	 *
+	 * This is much more efficient than calling getRTCTime(), getPowerFail(), getInterrupt(), getPowerDownTime(),
+	 * etc. separately, as each of those is at least one I2C transaction. See MCP79410RegisterSnapshot.
+	 *
+	 * @return true on success or false if the I2C read failed
 	 */
-	bool getRTCTime(MCP79410Time &time) const;
+	bool readRegisterSnapshot(MCP79410RegisterSnapshot &snapshot) const;
 
 	/**
 	 * @brief Get the power down time
@@ -794,6 +1892,10 @@ public:
 	 *
 	 * @param alarmNum Default is 0 if this parameter is omitted. Otherwise, must be 0 or 1.
 	 *
+	 * This takes 3 I2C transactions (2 if the alarm is already enabled): one read of the time and control
+	 * registers, one write of the alarm registers that also clears the alarm interrupt, and one write of
+	 * the control register.
+	 *
 	 * @return true on success. This call will fail and return false if the RTC has not been set or alarmNum is not valid.
 	 */
 	bool setAlarm(const MCP79410Time &time, bool polarity = true, int alarmNum = 0);
@@ -809,10 +1911,77 @@ public:
 	 *
 	 * @param alarmNum Default is 0 if this parameter is omitted. Otherwise, must be 0 or 1.
 	 *
+	 * The current time comes from the same read as the control register, so this also takes 3 I2C transactions
+	 * (2 if the alarm is already enabled).
+	 *
 	 * @return true on success. This call will fail and return false if the RTC has not been set or alarmNum is not valid.
 	 */
 	bool setAlarm(int secondsFromNow, bool polarity = true, int alarmNum = 0);
 
+	/**
+	 * @brief Set a recurring alarm
+	 *
+	 * @param schedule When the alarm should go off, for example MCP79410Schedule::everyDay(2, 30)
+	 *
+	 * @param polarity Pass true (the default) for compatibility with D8 to wake from SLEEP_MODE_DEEP.
+	 * false = active low, falling to wake. true = active high, rising to wake.
+	 *
+	 * @param alarmNum Default is 0 if this parameter is omitted. Otherwise, must be 0 or 1.
+	 *
+	 * If the schedule is native (see MCP79410Schedule::isNative()), the alarm mask repeats it without any help.
+	 * As with the other alarm modes, you need to clear the interrupt with clearInterrupt() after each alarm.
+	 *
+	 * Otherwise, the alarm is set for the next occurrence, and it's set for the following one only after the
+	 * alarm has been handled, because setting it clears the interrupt:
+	 *
+	 * - With withAlarmInterrupt(), loop() sets it after clearing the interrupt, before calling the callback.
+	 * - Otherwise, clearInterrupt() sets it, so check getInterrupt() and call clearInterrupt() as you would for
+	 *   any other alarm. Until then, the alarm stays in alarm state.
+	 *
+	 * The following occurrence is calculated from the RTC time, so it doesn't depend on the system clock.
+	 * loop() also checks the RTC (at most once a day while waiting) after each occurrence is due, and sets the
+	 * alarm again if it was missed because the RTC time was changed or the alarm was disabled. Occurrences more
+	 * than ALARM_SCHEDULE_MAX_ARM_SEC (300 days) away are not armed until they're closer, because the alarm
+	 * doesn't compare the year and would go off early.
+	 *
+	 * To keep the schedule across SLEEP_MODE_DEEP and resets, use withAlarmScheduleSRAM(); otherwise call this
+	 * again after waking up to set the next occurrence. Calling setAlarm() with a time, or clearAlarm(), for the
+	 * same alarmNum stops the schedule.
+	 *
+	 * @return true on success. This call will fail and return false if the RTC has not been set, or the schedule
+	 * or alarmNum is not valid.
+	 */
+	bool setAlarm(const MCP79410Schedule &schedule, bool polarity = true, int alarmNum = 0);
+
+	/**
+	 * @brief Store recurring alarm schedules in SRAM so they survive SLEEP_MODE_DEEP and resets
+	 *
+	 * @param addr SRAM address to store the schedules at. It uses 2 * ALARM_SCHEDULE_SRAM_SIZE (26) bytes.
+	 *
+	 * Schedules that are not native (see setAlarm(const MCP79410Schedule &, bool, int)) are written to SRAM
+	 * when set and invalidated when stopped. setup() restores them. If the alarm went off while the device
+	 * was asleep or resetting, it's set for the following occurrence once it has been handled, as usual.
+	 *
+	 * The withXXX() syntax allows you to chain multiple options, fluent-style.
+	 */
+	MCP79410 &withAlarmScheduleSRAM(size_t addr) { alarmScheduleSRAMAddr = (int)addr; return *this; };
+
+	/**
+	 * @brief Calculate when an alarm will go off next, from the settings in the chip
+	 *
+	 * @param alarmNum 0 or 1
+	 *
+	 * @param next Filled in with the time the alarm goes off next (Unix time, UTC)
+	 *
+	 * This reads the RTC time and alarm registers in one I2C transaction and uses
+	 * MCP79410Time::getNextAlarmTime(). It's useful to check how long you'll sleep for, and to make
+	 * sure the alarm is set correctly, before going to sleep.
+	 *
+	 * @return true if the alarm is enabled and will go off, false if the RTC is not valid, the alarm is not
+	 * enabled, or its settings can never match
+	 */
+	bool getNextAlarmTime(int alarmNum, time_t &next) const;
+
 	/**
 	 * @brief Returns true if the given alarmNum is in alarm state
 	 *
@@ -829,9 +1998,56 @@ public:
 	 * @param alarmNum Default is 0 if this parameter is omitted. Otherwise, must be 0 or 1.
 	 *
 	 * You must clear the alarm using clearInterrupt() or it won't fire again!
+	 *
+	 * For a recurring alarm that's not native (see setAlarm(const MCP79410Schedule &, bool, int)), this sets
+	 * the alarm for the following occurrence, which also clears the interrupt.
 	 */
 	void clearInterrupt(int alarmNum = 0);
 
+	/**
+	 * @brief Detect alarms with a pin interrupt on MFP instead of polling getInterrupt()
+	 *
+	 * @param pin The pin MFP is connected to. MFP is open-drain, so it needs a pull-up; the pin is set to
+	 * INPUT_PULLUP.
+	 *
+	 * @param polarity The alarm polarity, as passed to setAlarm() (default: true, active high). The interrupt
+	 * is attached to the rising edge for active high, falling edge for active low.
+	 *
+	 * setup() attaches an interrupt handler that only sets a pending flag. When the flag is set, loop() reads
+	 * both ALMxIF flags in one transaction, clears the ones that are set in one write, and calls the callbacks
+	 * set with withAlarmCallback(). There's no I2C traffic between alarms. setup() also checks once, in case
+	 * an alarm went off before the interrupt was attached, such as the one that woke the device from
+	 * SLEEP_MODE_DEEP.
+	 *
+	 * If MFP is still asserted after the flags are cleared, because the other alarm went off in between,
+	 * loop() checks again instead of waiting for an edge that won't come.
+	 *
+	 * A non-native recurring alarm (see setAlarm(const MCP79410Schedule &, bool, int)) is set for its next
+	 * occurrence right away when it goes off, instead of from loop() when it's due.
+	 *
+	 * This can't be used with withSecondsCounter() or square wave mode, which use MFP for the square wave.
+	 *
+	 * The withXXX() syntax allows you to chain multiple options, fluent-style.
+	 */
+	MCP79410 &withAlarmInterrupt(pin_t pin, bool polarity = true) { alarmInterruptEnabled = true; alarmInterruptPin = pin; alarmInterruptPolarity = polarity; return *this; };
+
+	/**
+	 * @brief Function to call from loop() when an alarm goes off. Requires withAlarmInterrupt().
+	 *
+	 * @param alarmNum 0 or 1
+	 *
+	 * @param callback Function to call. Its parameter is the alarm number. The interrupt flag has already
+	 * been cleared when it's called, so the callback can set the alarm again.
+	 *
+	 * The withXXX() syntax allows you to chain multiple options, fluent-style.
+	 */
+	MCP79410 &withAlarmCallback(int alarmNum, std::function<void(int alarmNum)> callback) { if (alarmNum >= 0 && alarmNum <= 1) { alarmCallback[alarmNum] = callback; } return *this; };
+
+	/**
+	 * @brief Returns true if alarms are detected with a pin interrupt. See withAlarmInterrupt().
+	 */
+	bool hasAlarmInterrupt() const { return alarmInterruptEnabled; };
+
 	/**
 	 * @brief Returns true if the given alarm is currently enabled
 	 *
@@ -887,6 +2103,46 @@ public:
 	 */
 	bool clearSquareWaveMode();
 
+	/**
+	 * @brief Measure the frequency of the square wave output on MFP using a pin interrupt
+	 *
+	 * @param pin The pin MFP is connected to. MFP is open-drain, so it needs a pull-up; the pin is set to
+	 * INPUT_PULLUP during the measurement, but an external pull-up is better at 4096 Hz. The previous pin
+	 * mode is restored afterwards.
+	 *
+	 * @param freq Frequency to output, SQUARE_WAVE_1_HZ or SQUARE_WAVE_4096_HZ. The 8192 Hz and 32768 Hz
+	 * outputs are rejected because an interrupt per edge can't keep up with them reliably.
+	 *
+	 * @param gateMs How long to count edges for, in milliseconds. This blocks for that long. For gates of up
+	 * to SQUARE_WAVE_SHORT_GATE_MS, it can first block until the next minute rollover (see below), which is
+	 * at most gateMs + 1000 ms, so the whole call blocks for at most 2 * gateMs + 1000 ms. A 2 second gate
+	 * blocks for 2 seconds most of the time and at most 5 seconds. Don't call this from a thread that can't
+	 * block that long.
+	 *
+	 * @param result Filled in with the measurement
+	 *
+	 * This puts the RTC in square wave mode, counts rising edges in an interrupt handler, and records the
+	 * micros() value of the first and last edge. The frequency is calculated from the number of whole cycles
+	 * between those two edges, so the result does not depend on where the gate starts and stops; the
+	 * resolution is about 1 microsecond (plus interrupt latency jitter) over the gate time, 0.5 ppm for a
+	 * 2 second gate. If the interval between two edges is more than 1.75 periods, an edge was missed and
+	 * the measurement fails. The measurement is relative to the MCU clock that micros() is derived from, so
+	 * it can't be more accurate than that clock.
+	 *
+	 * Both outputs include digital trimming, but the trim is only applied when the minute rolls over. For
+	 * gates of up to SQUARE_WAVE_SHORT_GATE_MS, the gate is started after the rollover if it would otherwise
+	 * include it, so the result is the untrimmed oscillator and rtcErrorPpm adds the current trim. Longer
+	 * gates should be a multiple of 60 seconds so they include a whole number of trim adjustments; for
+	 * those, rtcErrorPpm is the measured error. Either way rtcErrorPpm can be passed directly to
+	 * calibrateOscTrim().
+	 *
+	 * The previous contents of the control register (alarm enables, square wave mode, OUT) are restored
+	 * afterwards.
+	 *
+	 * @return true if at least two edges were seen, no edges were missed, and the result is valid
+	 */
+	bool measureSquareWave(pin_t pin, uint8_t freq, unsigned long gateMs, MCP79410SquareWaveResult &result);
+
 	/**
 	 * @brief Sets the oscillator trim value
 	 *
@@ -894,6 +2150,61 @@ public:
 	 */
 	bool setOscTrim(int8_t trim);
 
+	/**
+	 * @brief Gets the oscillator trim value, the same format as setOscTrim()
+	 */
+	int8_t getOscTrim() const;
+
+	/**
+	 * @brief Enables automatic oscillator trim calibration from cloud time syncs
+	 *
+	 * @param value true to enable, false to disable (default is disabled)
+	 *
+	 * @param eepromAddr EEPROM address to store the trim value at so it can be restored by setup() after
+	 * the RTC loses power. It uses OSC_TRIM_EEPROM_SIZE (4) bytes. Pass -1 (the default) to not store it.
+	 *
+	 * Each RTC error measured at a cloud time sync (see withResyncThreshold()) is compared to the error at an
+	 * earlier sync to calculate how fast or slow the crystal is, in ppm, taking into account any times the RTC was
+	 * rewritten in between. Cloud time is only set to the second, so the system clock is assumed to be off by up
+	 * to OSC_TRIM_SYNC_UNCERTAINTY_MS at each end of the interval. The trim is adjusted using calibrateOscTrim()
+	 * when the error is at least 4 times the uncertainty (about 1.5 days for a 60 ppm error), and again when the
+	 * remaining error is known to OSC_TRIM_MAX_UNCERTAINTY_PPM (about 23 days). The measurement starts over after
+	 * each adjustment.
+	 *
+	 * This works best with withRTCTimeMs() or withCachedClock() enabled, because then the RTC error at each
+	 * sync is measured to the millisecond. Otherwise it's only measured to the second, and each time the RTC
+	 * is rewritten adds another second of uncertainty, so you should also increase withResyncThreshold() so
+	 * that happens less often.
+	 *
+	 * The withXXX() syntax allows you to chain multiple options, fluent-style.
+	 */
+	MCP79410 &withOscTrimCalibration(bool value = true, int eepromAddr = -1) { oscTrimCalibration = value; oscTrimEEPROMAddr = eepromAddr; return *this; }
+
+	/**
+	 * @brief Adjust the oscillator trim to correct a measured frequency error
+	 *
+	 * @param measuredPpm How fast the RTC is running with the current trim, in parts per million. Positive
+	 * if the RTC is fast. This can come from cloud time syncs (see withOscTrimCalibration()), from
+	 * measureSquareWave() (rtcErrorPpm), or from your own measurement against a reference.
+	 *
+	 * Each OSCTRIM step adds or subtracts 2 clock cycles per minute, about 1.017 ppm. The new trim is the
+	 * current trim minus the error in steps, rounded, and limited to -127 to +127 (about +/- 129 ppm).
+	 *
+	 * Coarse trim mode (CRSTRIM) applies the trim 128 times per second instead of once per minute, which
+	 * makes each step about 7800 ppm. That's far too large to correct crystal error, so it's always
+	 * turned off here.
+	 *
+	 * If an EEPROM address was set using withOscTrimCalibration(), the new trim is stored there.
+	 *
+	 * @return true on success
+	 */
+	bool calibrateOscTrim(float measuredPpm);
+
+	/**
+	 * @brief Gets the frequency error measured by the last calibration, in ppm. 0 if not measured yet.
+	 */
+	float getLastOscTrimCalibrationPpm() const { return lastOscTrimCalibrationPpm; };
+
 	/**
 	 * @brief Read a time value (RTC time, alarm time, or power failure or restore time)
 	 *
@@ -1013,6 +2324,9 @@ public:
 	 *
 	 * This is a separate function from deviceWrite because writing bulk EEPROM data requires special handling.
 	 * The number of bytes you can write at once is limited, and you need to check for completion before continuing.
+	 *
+	 * The data is read back after writing. If it does not match, for example because the area is
+	 * block-protected, ERROR_EEPROM_VERIFY is returned.
 	 */
 	int deviceWriteEEPROM(uint8_t addr, const uint8_t *buf, size_t bufLen);
 
@@ -1020,8 +2334,22 @@ public:
 	 * @brief Function to wait for an EEPROM write to complete
 	 *
 	 * This is used by setBlockProtection() and deviceWriteEEPROM(). It's unlikely that you would ever call it manually.
+	 *
+	 * The EEPROM does not acknowledge its I2C address during a write cycle. This first delays for the minimum
+	 * write cycle time without accessing the bus, then polls until the EEPROM acknowledges, yielding the
+	 * thread between polls so other threads can use the bus. See withEEPROMWriteCycleTiming().
+	 *
+	 * @return 0 on success or ERROR_EEPROM_TIMEOUT if the EEPROM did not become ready in time.
 	 */
-	void waitForEEPROM();
+	int waitForEEPROM();
+
+	/**
+	 * @brief Returns how long the last EEPROM write cycle took in microseconds
+	 *
+	 * This is measured from the end of the write to the first successful poll by waitForEEPROM(), so it
+	 * can be slightly longer than the actual write cycle.
+	 */
+	unsigned long getLastEEPROMWriteCycleUs() const { return lastEEPROMWriteCycleUs; };
 
 
 #ifdef MCP79410_ENABLE_PROTECTED_WRITE
@@ -1047,7 +2375,7 @@ public:
 		// Use deviceWrite because the whole write needs to be done in one transaction
 		int stat = deviceWrite(EEPROM_I2C_ADDR, EEPROM_PROTECTED, buf, EEPROM_PROTECTED_BLOCK_SIZE);
 		if (stat == 0) {
-			waitForEEPROM();
+			stat = waitForEEPROM();
 		}
 
 		return (stat == 0);
@@ -1059,9 +2387,53 @@ public:
 	static const uint8_t TIME_SYNC_RTC_TO_TIME = 0b10; //!< Time object is set from RTC at startup (if RTC appears valid)
 	static const uint8_t TIME_SYNC_AUTOMATIC = 0b11; //!< Time is synchronized in both directions (the default value)
 
+	static const size_t SYNC_ERROR_HISTORY = 8; //!< Number of sync errors kept. See getSyncError().
+
+	static const size_t OSC_TRIM_EEPROM_SIZE = 4; //!< Number of EEPROM bytes used to store the trim. See withOscTrimCalibration().
+	static const uint8_t OSC_TRIM_EEPROM_MAGIC = 0xa7; //!< First byte of the stored trim
+	static constexpr float OSC_TRIM_PPM_PER_STEP = 1.017f; //!< 2 clock cycles per minute at 32768 Hz: 2 / (32768 * 60)
+	static const unsigned long SQUARE_WAVE_SHORT_GATE_MS = 55000; //!< measureSquareWave() gates up to this long avoid the minute rollover
+	static constexpr float OSC_TRIM_MAX_UNCERTAINTY_PPM = 1.0f; //!< Maximum uncertainty to adjust the trim from cloud time syncs
+	static const uint32_t OSC_TRIM_SYNC_UNCERTAINTY_MS = 1000; //!< Uncertainty of each RTC error measured at a cloud time sync
+
+	static const uint8_t TIME_SYNC_STATE_IDLE = 0; //!< Waiting for a cloud time sync
+	static const uint8_t TIME_SYNC_STATE_WRITE = 1; //!< Waiting for the right time to set the RTC from the cloud
+	static const uint8_t TIME_SYNC_STATE_MEASURE = 2; //!< Waiting for the right time to measure the RTC error
+
 
 	static const uint8_t EEPROM_PROTECTED_BLOCK_SIZE = 8; //!< EEPROM protected block size in bytes
 
+	static const uint8_t EEPROM_PAGE_SIZE = 8; //!< EEPROM page size in bytes. A single write cycle cannot cross a page boundary.
+
+	static const int ERROR_EEPROM_VERIFY = -2; //!< Error code returned by deviceWriteEEPROM() if data read back does not match
+	static const int ERROR_EEPROM_TIMEOUT = -3; //!< Error code returned by waitForEEPROM() if the write cycle did not complete in time
+	static const int ERROR_TIMEOUT = -4; //!< Error code returned by deviceWaitSecondEdge() if the seconds did not change in time
+
+	static const uint8_t ANCHOR_STATE_NONE = 0; //!< No anchor, start looking for the seconds rollover
+	static const uint8_t ANCHOR_STATE_COARSE = 1; //!< Reading the seconds every ANCHOR_COARSE_POLL_MS to find the rollover
+	static const uint8_t ANCHOR_STATE_FINE = 2; //!< Rollover time known approximately, waiting to measure it precisely
+	static const uint8_t ANCHOR_STATE_VALID = 3; //!< Anchor is valid
+	static const uint8_t ANCHOR_STATE_RESYNC = 4; //!< Anchor is valid, waiting to measure the rollover precisely again
+	static const uint8_t ANCHOR_STATE_RESYNC_START = 5; //!< Anchor is valid, start looking for the rollover by polling
+	static const uint8_t ANCHOR_STATE_RESYNC_COARSE = 6; //!< Anchor is valid, reading the seconds every ANCHOR_COARSE_POLL_MS to find the rollover
+
+	static const unsigned long ANCHOR_COARSE_POLL_MS = 20; //!< Period for reading the seconds in ANCHOR_STATE_COARSE
+	static const unsigned long ANCHOR_FINE_WINDOW_MS = 30; //!< How long before and after the expected rollover to read continuously
+	static const unsigned long ANCHOR_MIN_DRIFT_INTERVAL_MS = 60000; //!< Minimum time between anchors to update the drift
+	static const unsigned long ANCHOR_DRIFT_FILTER_MS = 3600000; //!< Maximum weight of the previous drift measurements when averaging in a new one
+	static const unsigned long ANCHOR_UNKNOWN_DRIFT_PPM = 200; //!< Drift assumed by the cached clock before it has been measured
+	static const unsigned long ALARM_SCHEDULE_CHECK_MS = 1000; //!< How often loop() retries setting a recurring alarm if the RTC could not be read
+	static const uint32_t ALARM_SCHEDULE_MAX_WAIT_SEC = 86400; //!< Longest time loop() waits before checking the RTC for a recurring alarm
+	static const uint32_t ALARM_SCHEDULE_MAX_ARM_SEC = 300 * 86400; //!< The alarm does not compare the year, so occurrences further out than this are armed later
+	static const size_t ALARM_SCHEDULE_SRAM_SIZE = 13; //!< SRAM bytes per alarm used by withAlarmScheduleSRAM()
+	static const uint8_t ALARM_SCHEDULE_SRAM_MAGIC = 0xa9; //!< First byte of a recurring alarm schedule in SRAM
+	static const unsigned long SECONDS_COUNTER_READ_WINDOW_MS = 100; //!< How soon after an edge loop() must read the RTC to match it to the seconds counter
+	static const unsigned long SECONDS_COUNTER_TIMEOUT_MS = 1500; //!< The seconds counter is not used if there hasn't been an edge in this long
+	static const uint32_t SECONDS_COUNTER_MAX_MISMATCHES = 3; //!< The seconds counter is disabled after this many mismatches with the RTC
+	static const unsigned long OSC_STOP_TIMEOUT_MS = 100; //!< How long deviceStopOscillator() waits for OSCRUN to clear
+	static const unsigned long SET_ALIGN_LEAD_MS = 20; //!< How long before the expected Time.now() change loop() calls setRTCFromCloud()
+	static const unsigned long ANCHOR_RETRY_MS = 10000; //!< Time to wait before looking for the rollover again if the RTC is not running
+
 	static const uint8_t EEPROM_PROTECT_NONE = 0x0; //!< EEPROM write protection disabled
 	static const uint8_t EEPROM_PROTECT_UPPER_QUARTER = 0x1; //!< EEPROM write protection protects addresses 0x60 to 0x7f from writing
 	static const uint8_t EEPROM_PROTECT_UPPER_HALF = 0x2; //!< EEPROM write protection protects addresses 0x40 to 0x7f from writing
@@ -1079,6 +2451,268 @@ public:
 
 protected:
 
+	/**
+	 * @brief Write the alarm registers and enable the alarm, used by setAlarm()
+	 *
+	 * @param time The alarm time and alarmMode
+	 *
+	 * @param polarity Alarm polarity (true = active high)
+	 *
+	 * @param alarmNum 0 or 1
+	 *
+	 * @param control The current value of the control register, so it does not need to be read again
+	 *
+	 * This is one 6-byte write, which also clears ALMxIF, plus a write of the control register if the
+	 * alarm is not already enabled.
+	 *
+	 * @return 0 on success or a non-zero error code
+	 */
+	int deviceWriteAlarm(const MCP79410Time &time, bool polarity, int alarmNum, uint8_t control);
+
+	/**
+	 * @brief Called from loop() to set non-native recurring alarms for their next occurrence. See
+	 * setAlarm(const MCP79410Schedule &, bool, int).
+	 */
+	void alarmScheduleLoop();
+
+	/**
+	 * @brief Stop the recurring alarm schedule for alarmNum, and invalidate it in SRAM if it was stored there
+	 */
+	void alarmScheduleStop(int alarmNum);
+
+	/**
+	 * @brief Make alarmScheduleLoop() check the RTC for alarmNum in seconds, limited to ALARM_SCHEDULE_MAX_WAIT_SEC
+	 * so the interval in milliseconds doesn't overflow
+	 */
+	void alarmScheduleWait(int alarmNum, time_t seconds);
+
+	/**
+	 * @brief Make alarmScheduleLoop() set alarmNum again after ALARM_SCHEDULE_CHECK_MS, after a failure
+	 */
+	void alarmScheduleRetry(int alarmNum);
+
+	/**
+	 * @brief Store the recurring alarm schedule for alarmNum in SRAM, if enabled with withAlarmScheduleSRAM()
+	 */
+	void alarmSchedulePersist(int alarmNum);
+
+	/**
+	 * @brief Called from setup() to restore recurring alarm schedules from SRAM, if enabled with withAlarmScheduleSRAM()
+	 */
+	void alarmScheduleRestore();
+
+	/**
+	 * @brief Decode a time value from raw register bytes
+	 *
+	 * @param buf The register bytes, as read from the chip starting at the time address
+	 *
+	 * @param time A reference to a MCP79410Time to save the data to
+	 *
+	 * @param timeMode the format of the time, TIME_MODE_RTC, TIME_MODE_ALARM, or TIME_MODE_POWER. See deviceReadTime().
+	 *
+	 * The alarm and power failure times don't include a year, so the year is set from Time.year(). This is
+	 * used by deviceReadTime() and MCP79410RegisterSnapshot.
+	 */
+	static void deviceDecodeTime(const uint8_t *buf, MCP79410Time &time, int timeMode);
+
+	/**
+	 * @brief Stop the oscillator by clearing ST and wait for OSCRUN to clear, which resets the divider chain
+	 *
+	 * @return 0 on success, ERROR_TIMEOUT if OSCRUN did not clear within OSC_STOP_TIMEOUT_MS, or an I2C error code
+	 */
+	int deviceStopOscillator();
+
+	/**
+	 * @brief Decode the OSCTRIM register (sign and magnitude) to the format used by setOscTrim()
+	 */
+	static int8_t oscTrimFromRaw(uint8_t value);
+
+	/**
+	 * @brief Encode a trim value in the format used by setOscTrim() for the OSCTRIM register
+	 */
+	static uint8_t oscTrimToRaw(int8_t trim);
+
+	/**
+	 * @brief Returns micros() if bus statistics are enabled, otherwise 0
+	 */
+	unsigned long busStatsStart() const;
+
+	/**
+	 * @brief Record the latency and result of an operation in the bus statistics
+	 *
+	 * @param op The operation, such as MCP79410BusStats::OP_READ
+	 *
+	 * @param startUs The value returned by busStatsStart() at the start of the operation
+	 *
+	 * @param stat The result of the operation, 0 = success. Pass 0 if the error was already counted by a
+	 * nested operation.
+	 */
+	void busStatsRecord(size_t op, unsigned long startUs, int stat) const;
+
+	/**
+	 * @brief Count an error in the bus statistics. Does nothing if stat is 0.
+	 */
+	void busStatsError(int stat) const;
+
+	/**
+	 * @brief Count an EEPROM write cycle timeout in the bus statistics
+	 */
+	void busStatsEEPROMTimeout() const;
+
+	/**
+	 * @brief Update the register shadow after a successful read or write of registers
+	 *
+	 * @param addr The register address of the first byte in buf
+	 *
+	 * @param buf The register values
+	 *
+	 * @param bufLen The number of register values in buf
+	 *
+	 * Does nothing if the shadow is not enabled. See withRegisterShadow().
+	 */
+	void registerShadowUpdate(uint8_t addr, const uint8_t *buf, size_t bufLen) const;
+
+	/**
+	 * @brief Returns the index into registerShadowValue for a register, or -1 if the register is not shadowed
+	 */
+	int registerShadowIndex(uint8_t addr) const;
+
+	/**
+	 * @brief Write to EEPROM within a single page, then wait for the write cycle to complete
+	 *
+	 * @param addr The address 0 <= addr <= 0x7f
+	 *
+	 * @param buf The buffer to write
+	 *
+	 * @param bufLen The length of data to write. The data must not cross an 8-byte page boundary, or it will
+	 * wrap around to the beginning of the page. It can be 1 to write a single byte.
+	 *
+	 * This does not verify the data. It's used by deviceWriteEEPROM().
+	 */
+	int deviceWriteEEPROMPage(uint8_t addr, const uint8_t *buf, size_t bufLen);
+
+	/**
+	 * @brief Write to EEPROM within a single page, starting the write cycle without waiting for it
+	 *
+	 * This is used by deviceWriteEEPROMPage() and asynchronous writes, and counted in the bus statistics.
+	 */
+	int deviceWriteEEPROMStart(uint8_t addr, const uint8_t *buf, size_t bufLen);
+
+	/**
+	 * @brief Poll the EEPROM once to see if the write cycle has completed, counted in the bus statistics
+	 *
+	 * @return 0 if the EEPROM responded (the write cycle is complete), non-zero if it's still busy
+	 */
+	int devicePollEEPROM();
+
+	/**
+	 * @brief Read back EEPROM data and compare it to buf
+	 *
+	 * @return 0 if the data matches, ERROR_EEPROM_VERIFY if it does not, or an I2C error code
+	 */
+	int deviceVerifyEEPROM(uint8_t addr, const uint8_t *buf, size_t bufLen) const;
+
+	/**
+	 * @brief Write to EEPROM one byte per write cycle, waiting for each write cycle to complete
+	 *
+	 * This does not verify the data. It's used by deviceWriteEEPROM() in byte mode and to retry a page that
+	 * did not verify.
+	 */
+	int deviceWriteEEPROMBytes(uint8_t addr, const uint8_t *buf, size_t bufLen);
+
+	/**
+	 * @brief Read the seconds register continuously until it changes
+	 *
+	 * @param timeoutMs Maximum time to wait in milliseconds
+	 *
+	 * @param edgeMs Filled in with the millis() value at the start of the read that saw the new second
+	 *
+	 * This does not yield between reads, as the accuracy depends on reading as often as possible.
+	 *
+	 * @return 0 on success, ERROR_TIMEOUT if the second did not change, or an I2C error code
+	 */
+	int deviceWaitSecondEdge(unsigned long timeoutMs, unsigned long &edgeMs) const;
+
+	/**
+	 * @brief Read the time right after a seconds rollover and update the anchor for getRTCTimeMs()
+	 *
+	 * @param edgeMs The millis() value when the rollover was seen
+	 *
+	 * If there was a previous anchor, this also updates lastAnchorOffsetMs and anchorDriftPpm.
+	 */
+	bool anchorSet(unsigned long edgeMs);
+
+	/**
+	 * @brief Called from loop() to find the seconds rollover without blocking for long. See withRTCTimeMs().
+	 */
+	void anchorLoop();
+
+	/**
+	 * @brief How old the anchor can be, in milliseconds, before the error could exceed the cached clock error bound
+	 */
+	unsigned long anchorMaxAgeMs() const;
+
+	/**
+	 * @brief Interrupt handler for measureSquareWave()
+	 */
+	void squareWaveISR();
+
+	/**
+	 * @brief Interrupt handler for withSecondsCounter()
+	 */
+	void secondsCounterISR();
+
+	/**
+	 * @brief Called from loop() to match the seconds counter to the RTC. See withSecondsCounter().
+	 */
+	void secondsCounterLoop();
+
+	/**
+	 * @brief Interrupt handler for withAlarmInterrupt()
+	 */
+	void alarmInterruptISR();
+
+	/**
+	 * @brief Called from loop() to handle alarms after alarmInterruptISR(). See withAlarmInterrupt().
+	 */
+	void alarmInterruptLoop();
+
+	/**
+	 * @brief Uncertainty of the measured drift between millis() and the RTC in ppm
+	 */
+	float anchorUncertaintyPpm() const;
+
+	/**
+	 * @brief Called from loop() to track when Time.now() changes, for setRTCFromCloud()
+	 */
+	void systemSecondLoop();
+
+	/**
+	 * @brief Called from loop() to set the RTC on the first cloud time sync and check it on later ones
+	 */
+	void timeSyncLoop();
+
+	/**
+	 * @brief Measure the RTC error relative to the system clock. Used by timeSyncLoop().
+	 *
+	 * @param errorMs Filled in with RTC time minus system time in milliseconds
+	 *
+	 * @param precise Filled in with true if the error was measured to the millisecond
+	 *
+	 * @return true on success, false if the RTC could not be read or is not valid
+	 */
+	bool measureRTCError(int32_t &errorMs, bool &precise);
+
+	/**
+	 * @brief Add a sync error to the history. See getSyncError().
+	 */
+	void addSyncError(int32_t errorMs, bool precise, bool corrected);
+
+	/**
+	 * @brief Update the oscillator trim calibration from a new sync error. Called from addSyncError().
+	 */
+	void oscTrimCalibrationUpdate(const MCP79410SyncError &entry);
+
 	static const uint8_t REG_I2C_ADDR    = 0b1101111; //!< I2C address (0x6f) for reading and writing the registers and SRAM
 	static const uint8_t REG_DATE_TIME  = 0x00; //!< Start of date and time register
 	static const uint8_t REG_DATE_RTCSEC  = 0x00; //!< Second value and oscillator start/stop bit
@@ -1093,6 +2727,7 @@ protected:
 	static const uint8_t  REG_CONTROL_SQWEN = 0x40; //!< Square wave enabled (used for calibration)
 	static const uint8_t  REG_CONTROL_ALM1EN = 0x20; //!< Alarm 1 enabled
 	static const uint8_t  REG_CONTROL_ALM0EN = 0x10; //!< Alarm 0 enabled
+	static const uint8_t  REG_CONTROL_CRSTRIM = 0x04; //!< Coarse trim mode (trim applied 128 times per second)
 
 	static const uint8_t REG_OSCTRIM = 0x08; //!< Oscillator trim register
 
@@ -1115,17 +2750,99 @@ protected:
 
 
 
-	TwoWire &wire; //!< The I2C interface to use. Typically Wire (the default) but could be Wire1 on some devices.
+#ifndef MCP79410_DISABLE_TWOWIRE
+	MCP79410TwoWireTransport *wireTransport = NULL; //!< Transport for TwoWire, allocated by the TwoWire constructor only. NULL otherwise.
+#endif
+	MCP79410Transport *transport; //!< The bus transport to use. Either wireTransport or the transport passed to the constructor.
 	bool setupDone = false; //!< True after rtc.setup() has been called.
 	bool timeSet = false; //!< True after the RTC has been set from cloud time the first time.
 	bool batteryEnable = true; //!< True if the battery should be enabled.
+	bool eepromPageWrite = true; //!< True to use page writes for EEPROM. See withEEPROMPageWrite().
+	unsigned long eepromWriteCycleMinMs = 2; //!< Time to wait before polling for EEPROM write completion. See withEEPROMWriteCycleTiming().
+	unsigned long eepromWriteCycleTimeoutMs = 10; //!< Maximum time to wait for EEPROM write completion. See withEEPROMWriteCycleTiming().
+	unsigned long lastEEPROMWriteCycleUs = 0; //!< Duration of the last EEPROM write cycle. See getLastEEPROMWriteCycleUs().
 	uint8_t timeSyncMode = TIME_SYNC_AUTOMATIC; //!< Time synchronization mode. Default is automatic.
 
+	bool rtcTimeMsEnabled = false; //!< True if loop() maintains the anchor for getRTCTimeMs(). See withRTCTimeMs().
+	unsigned long anchorResyncIntervalMs = 600000; //!< How often to measure the rollover again. See withRTCTimeMs().
+	uint8_t anchorState = ANCHOR_STATE_NONE; //!< ANCHOR_STATE_NONE, ANCHOR_STATE_COARSE, ...
+	uint8_t anchorCoarseSecond = 0; //!< Last seconds register value read in ANCHOR_STATE_COARSE
+	unsigned long anchorCoarseMs = 0; //!< millis() of the last read in ANCHOR_STATE_COARSE
+	unsigned long anchorCoarseStartMs = 0; //!< millis() when ANCHOR_STATE_COARSE started
+	bool anchorRetryWait = false; //!< True to wait ANCHOR_RETRY_MS in ANCHOR_STATE_NONE before trying again
+	unsigned long anchorExpectedMs = 0; //!< millis() value the next rollover is expected at in ANCHOR_STATE_FINE and ANCHOR_STATE_RESYNC
+	time_t anchorTime = 0; //!< RTC time (Unix time) that started at anchorMs
+	unsigned long anchorMs = 0; //!< millis() value at the RTC seconds rollover to anchorTime
+	int32_t lastAnchorOffsetMs = 0; //!< See getLastAnchorOffsetMs()
+	float anchorDriftPpm = 0; //!< See getAnchorDriftPpm()
+	unsigned long anchorDriftIntervalMs = 0; //!< Total weight (interval) of the measurements averaged into anchorDriftPpm, 0 if not measured yet
+	time_t systemSecondLast = 0; //!< Time.now() as of the last call to systemSecondLoop()
+	unsigned long systemSecondEdgeMs = 0; //!< millis() when Time.now() was last seen to change
+	bool systemSecondEdgeValid = false; //!< True if systemSecondEdgeMs is valid
+	unsigned long timeSyncWaitStartMs = 0; //!< millis() when loop() started waiting in TIME_SYNC_STATE_WRITE or TIME_SYNC_STATE_MEASURE
+	uint8_t timeSyncState = TIME_SYNC_STATE_IDLE; //!< TIME_SYNC_STATE_IDLE, TIME_SYNC_STATE_WRITE, ...
+	unsigned long timeSyncedLastSeen = 0; //!< Particle.timeSyncedLast() value that was last handled
+	unsigned long resyncThresholdMs = 500; //!< See withResyncThreshold()
+	volatile uint32_t squareWaveEdges = 0; //!< Rising edges counted by squareWaveISR()
+	volatile uint32_t squareWaveMissed = 0; //!< Intervals longer than squareWaveMaxIntervalUs seen by squareWaveISR()
+	uint32_t squareWaveMaxIntervalUs = 0; //!< Longest expected interval between edges for squareWaveISR()
+	volatile uint32_t squareWaveFirstUs = 0; //!< micros() at the first edge counted by squareWaveISR()
+	volatile uint32_t squareWaveLastUs = 0; //!< micros() at the last edge counted by squareWaveISR()
+	MCP79410Schedule alarmSchedule[2]; //!< Recurring alarm schedule for each alarm. See setAlarm(const MCP79410Schedule &, bool, int).
+	bool alarmSchedulePolarity[2] = { true, true }; //!< Polarity for each recurring alarm
+	time_t alarmScheduleNext[2] = { 0, 0 }; //!< Time each non-native recurring alarm is set for, 1 if loop() needs to set it, 0 if there's no schedule
+	bool alarmScheduleFired[2] = { false, false }; //!< True if the alarm went off and clearInterrupt() has not been called yet
+	unsigned long alarmScheduleCheckMs[2] = { 0, 0 }; //!< millis() when alarmScheduleLoop() started waiting for each alarm
+	unsigned long alarmScheduleWaitMs[2] = { 0, 0 }; //!< How long alarmScheduleLoop() waits before checking the RTC for each alarm
+	int alarmScheduleSRAMAddr = -1; //!< See withAlarmScheduleSRAM(), -1 if not enabled
+	bool alarmSchedulePersisted[2] = { false, false }; //!< True if the schedule for each alarm is stored in SRAM
+	bool secondsCounterEnabled = false; //!< See withSecondsCounter()
+	pin_t secondsCounterPin = 0; //!< See withSecondsCounter()
+	unsigned long secondsCounterVerifyIntervalMs = 3600000; //!< See withSecondsCounter()
+	volatile uint32_t secondsCounter = 0; //!< Rising edges counted by secondsCounterISR()
+	volatile unsigned long secondsCounterEdgeMs = 0; //!< millis() at the last edge counted by secondsCounterISR()
+	volatile bool secondsCounterBaseValid = false; //!< True if secondsCounterBase has been set from the RTC
+	time_t secondsCounterBase = 0; //!< RTC time minus secondsCounter
+	uint32_t secondsCounterLastSeen = 0; //!< Value of secondsCounter seen by the last call to secondsCounterLoop()
+	unsigned long secondsCounterVerifyMs = 0; //!< millis() when the counter was last compared to the RTC
+	uint32_t secondsCounterMismatches = 0; //!< See getSecondsCounterMismatches()
+	bool alarmInterruptEnabled = false; //!< See withAlarmInterrupt()
+	pin_t alarmInterruptPin = 0; //!< See withAlarmInterrupt()
+	bool alarmInterruptPolarity = true; //!< See withAlarmInterrupt()
+	volatile bool alarmInterruptPending = false; //!< Set by alarmInterruptISR(), cleared by alarmInterruptLoop()
+	std::function<void(int alarmNum)> alarmCallback[2]; //!< See withAlarmCallback()
+	bool oscTrimCalibration = false; //!< See withOscTrimCalibration()
+	int oscTrimEEPROMAddr = -1; //!< See withOscTrimCalibration()
+	bool oscTrimBaseValid = false; //!< True if oscTrimBaseTime and oscTrimBaseErrorMs are valid
+	bool oscTrimPhasePending = false; //!< True if oscTrimCorrectionMs is waiting for the set phase error measurement
+	time_t oscTrimBaseTime = 0; //!< Cloud time of the calibration starting point
+	int32_t oscTrimBaseErrorMs = 0; //!< RTC error at the calibration starting point
+	int32_t oscTrimCorrectionMs = 0; //!< Total error removed by rewriting the RTC since the starting point
+	uint32_t oscTrimUncertaintyMs = 0; //!< Total uncertainty of the measurements since the starting point, not including cloud time
+	float lastOscTrimCalibrationPpm = 0; //!< See getLastOscTrimCalibrationPpm()
+	MCP79410SyncError syncErrors[SYNC_ERROR_HISTORY]; //!< Circular buffer of sync errors. See getSyncError().
+	size_t syncErrorNext = 0; //!< Index in syncErrors to write next
+	size_t syncErrorCount = 0; //!< Number of valid entries in syncErrors
+	bool setPhasePending = false; //!< True if the phase error of the last setRTCFromCloud() has not been measured yet
+	bool setPhaseValid = false; //!< See hasSetPhaseError()
+	unsigned long setEdgeMs = 0; //!< millis() when the system clock second changed in the last setRTCFromCloud()
+	int32_t lastSetPhaseErrorMs = 0; //!< See getLastSetPhaseErrorMs()
+	bool cachedClock = false; //!< True if getRTCTime() is served from the anchor. See withCachedClock().
+	unsigned long cachedClockErrorBoundMs = 100; //!< Maximum error for the cached clock. See withCachedClock().
+
+	MCP79410BusStats *busStats = NULL; //!< Bus statistics, allocated by withBusStats(). NULL if not enabled.
+
+	static const size_t REGISTER_SHADOW_COUNT = 4; //!< Number of shadowed registers: REG_CONTROL, REG_OSCTRIM, and the two ALMxWKDAY
+	bool registerShadowEnabled = false; //!< True if the register shadow is enabled. See withRegisterShadow().
+	mutable uint8_t registerShadowValid = 0; //!< Bit mask of entries in registerShadowValue that are valid (bit 0 = index 0)
+	mutable uint8_t registerShadowValue[REGISTER_SHADOW_COUNT]; //!< Shadowed register values. ALMxIF is always stored as 0.
+
 	MCP79410SRAM sramObj; //!< Object to access the SRAM (static non-volatile RAM). Use the public sram() method to access it.
 	MCP79410EEPROM eepromObj; //!< Object to access the EEPROM. Use the public eeprom() method to access it.
 
 	friend class MCP79410SRAM;
 	friend class MCP79410EEPROM;
+	friend class MCP79410RegisterSnapshot;
 };
 
 #endif /* __MCP79410RK_H */
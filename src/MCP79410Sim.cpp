@@ -0,0 +1,573 @@
+#include "MCP79410Sim.h"
+
+#include <string.h>
+
+// Register addresses and bits. These are the same as the protected constants in the MCP79410 class,
+// duplicated here so this file does not depend on Particle.h.
+static const uint8_t REG_RTCSEC = 0x00;
+static const uint8_t  REG_RTCSEC_ST = 0x80;
+static const uint8_t REG_RTCMIN = 0x01;
+static const uint8_t REG_RTCHOUR = 0x02;
+static const uint8_t REG_RTCWKDAY = 0x03;
+static const uint8_t  REG_RTCWKDAY_OSCRUN = 0x20;
+static const uint8_t  REG_RTCWKDAY_PWRFAIL = 0x10;
+static const uint8_t  REG_RTCWKDAY_VBATEN = 0x08;
+static const uint8_t REG_RTCDATE = 0x04;
+static const uint8_t REG_RTCMTH = 0x05;
+static const uint8_t  REG_RTCMTH_LPYR = 0x20;
+static const uint8_t REG_RTCYEAR = 0x06;
+static const uint8_t REG_CONTROL = 0x07;
+static const uint8_t  REG_CONTROL_OUT = 0x80;
+static const uint8_t  REG_CONTROL_SQWEN = 0x40;
+static const uint8_t  REG_CONTROL_ALM1EN = 0x20;
+static const uint8_t  REG_CONTROL_ALM0EN = 0x10;
+static const uint8_t  REG_CONTROL_CRSTRIM = 0x04;
+static const uint8_t REG_OSCTRIM = 0x08;
+static const uint8_t REG_EEUNLOCK = 0x09;
+static const uint8_t REG_ALARM0 = 0x0a;
+static const uint8_t REG_ALARM1 = 0x11;
+static const uint8_t  REG_ALARM_WKDAY_OFFSET = 3;
+static const uint8_t  REG_ALARM_WKDAY_ALMPOL = 0x80;
+static const uint8_t  REG_ALARM_WKDAY_ALMIF = 0x08;
+static const uint8_t REG_POWER_DOWN = 0x18;
+static const uint8_t REG_POWER_UP = 0x1c;
+static const uint8_t REG_SRAM = 0x20;
+static const uint8_t REG_SRAM_END = 0x60;
+
+static const uint8_t EEPROM_PROTECTED = 0xf0;
+static const uint8_t EEPROM_STATUS = 0xff;
+static const uint8_t EEPROM_PAGE_SIZE = 8;
+
+static int bcdToInt(uint8_t value) {
+	return ((value >> 4) & 0xf) * 10 + (value & 0xf);
+}
+
+static uint8_t intToBcd(int value) {
+	return (uint8_t) (((value / 10) % 10) << 4) | (uint8_t)(value % 10);
+}
+
+static int daysInMonth(int year, int month) {
+	static const uint8_t days[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+	if (month == 2 && (year % 4) == 0) {
+		// The MCP79410 treats every year divisible by 4 as a leap year, which is correct for 2000 - 2099
+		return 29;
+	}
+	return days[(month - 1) % 12];
+}
+
+
+MCP79410Sim::MCP79410Sim() {
+	coldBoot();
+	memset(eeprom, 0xff, sizeof(eeprom));
+	memset(eepromProtected, 0xff, sizeof(eepromProtected));
+	eepromStatus = 0;
+	resetStats();
+}
+
+MCP79410Sim::~MCP79410Sim() {
+
+}
+
+void MCP79410Sim::coldBoot() {
+	memset(regs, 0, sizeof(regs));
+	regs[REG_RTCWKDAY] = 0x01;
+	regs[REG_RTCDATE] = 0x01;
+	regs[REG_RTCMTH] = 0x01;
+	regs[REG_CONTROL] = REG_CONTROL_OUT;
+	memset(sram, 0, sizeof(sram));
+	subSecondUs = 0;
+	unlockState = 0;
+	lastMatch[0] = lastMatch[1] = false;
+}
+
+void MCP79410Sim::resetStats() {
+	memset(&stats, 0, sizeof(stats));
+}
+
+int MCP79410Sim::writeRead(uint8_t i2cAddr, const uint8_t *writeBuf, size_t writeLen, uint8_t *readBuf, size_t readLen) {
+	// Address byte + write bytes, then address byte + read bytes after a repeated start
+	busTransaction(1 + writeLen + ((readLen != 0) ? (1 + readLen) : 0), (readLen != 0) ? 1 : 0);
+
+	if (writeLen > maxWriteLen() || readLen > maxReadLen()) {
+		return STAT_TOO_LONG;
+	}
+
+	if (i2cAddr == REG_I2C_ADDR) {
+		if (writeLen > 0) {
+			regPointer = writeBuf[0];
+			for(size_t ii = 1; ii < writeLen; ii++) {
+				regWrite(regPointer++, writeBuf[ii]);
+			}
+			stats.bytesWritten += writeLen;
+		}
+		for(size_t ii = 0; ii < readLen; ii++) {
+			if (regPointer >= REG_SRAM_END) {
+				regPointer = 0;
+			}
+			readBuf[ii] = regRead(regPointer++);
+		}
+		stats.bytesRead += readLen;
+		return STAT_SUCCESS;
+	}
+	else
+	if (i2cAddr == EEPROM_I2C_ADDR) {
+		if (isEEPROMBusy()) {
+			stats.nacks++;
+			return STAT_ADDR_NACK;
+		}
+		if (writeLen > 1) {
+			int stat = eepromWrite(writeBuf, writeLen);
+			if (stat != STAT_SUCCESS || readLen == 0) {
+				return stat;
+			}
+		}
+		else
+		if (writeLen == 1) {
+			eepromPointer = writeBuf[0];
+			stats.bytesWritten++;
+		}
+		for(size_t ii = 0; ii < readLen; ii++) {
+			readBuf[ii] = eepromRead(eepromPointer);
+			if (eepromPointer < sizeof(eeprom)) {
+				eepromPointer = (eepromPointer + 1) % sizeof(eeprom);
+			}
+			else {
+				eepromPointer++;
+			}
+		}
+		stats.bytesRead += readLen;
+		return STAT_SUCCESS;
+	}
+	else {
+		stats.nacks++;
+		return STAT_ADDR_NACK;
+	}
+}
+
+int MCP79410Sim::writeSegments(uint8_t i2cAddr, const MCP79410TransportSegment *segments, size_t numSegments) {
+	uint8_t buf[64];
+	size_t len = 0;
+
+	for(size_t ii = 0; ii < numSegments; ii++) {
+		if (len + segments[ii].len > sizeof(buf)) {
+			busTransaction(1 + len, 0);
+			return STAT_TOO_LONG;
+		}
+		if (segments[ii].len) {
+			memcpy(&buf[len], segments[ii].buf, segments[ii].len);
+			len += segments[ii].len;
+		}
+	}
+
+	if (len > maxWriteLen()) {
+		busTransaction(1 + len, 0);
+		return STAT_TOO_LONG;
+	}
+
+	if (i2cAddr == EEPROM_I2C_ADDR) {
+		if (isEEPROMBusy()) {
+			// The EEPROM does not ACK its address during a write cycle, so the data is not sent
+			busTransaction(1, 0);
+			stats.nacks++;
+			return STAT_ADDR_NACK;
+		}
+		busTransaction(1 + len, 0);
+		if (len == 0) {
+			// ACK poll
+			return STAT_SUCCESS;
+		}
+		if (len == 1) {
+			eepromPointer = buf[0];
+			stats.bytesWritten++;
+			return STAT_SUCCESS;
+		}
+		return eepromWrite(buf, len);
+	}
+
+	if (i2cAddr != REG_I2C_ADDR) {
+		busTransaction(1, 0);
+		stats.nacks++;
+		return STAT_ADDR_NACK;
+	}
+
+	busTransaction(1 + len, 0);
+
+	if (len > 0) {
+		regPointer = buf[0];
+		for(size_t ii = 1; ii < len; ii++) {
+			regWrite(regPointer++, buf[ii]);
+		}
+		stats.bytesWritten += len;
+	}
+
+	return STAT_SUCCESS;
+}
+
+void MCP79410Sim::busTransaction(size_t numBytes, size_t repeatedStarts) {
+	// 9 clocks per byte (8 data + ACK), plus start, stop, and repeated start conditions
+	uint64_t bits = numBytes * 9 + 2 + repeatedStarts;
+
+	uint64_t us = (bits * 1000000 + busClockHz - 1) / busClockHz;
+
+	stats.transactions++;
+	stats.busTimeUs += us;
+
+	advanceTime(us);
+}
+
+void MCP79410Sim::regWrite(uint8_t addr, uint8_t value) {
+	if (addr >= REG_SRAM_END) {
+		// Register pointer wraps
+		addr = 0;
+		regPointer = 1;
+	}
+
+	if (addr >= REG_SRAM) {
+		sram[addr - REG_SRAM] = value;
+		return;
+	}
+
+	if (addr != REG_EEUNLOCK) {
+		unlockState = 0;
+	}
+
+	switch(addr) {
+	case REG_RTCSEC:
+		if ((value & REG_RTCSEC_ST) == 0) {
+			// Stopping the oscillator resets the divider chain, so the second starts over when ST is set again
+			subSecondUs = 0;
+		}
+		// While the oscillator is running, loading the seconds register does not reset the divider chain,
+		// so the seconds keep rolling over at the same point
+		regs[addr] = value;
+		break;
+
+	case REG_RTCWKDAY: {
+		// OSCRUN is read-only. PWRFAIL can only be cleared.
+		uint8_t newValue = value & ~(REG_RTCWKDAY_OSCRUN | REG_RTCWKDAY_PWRFAIL);
+		newValue |= regs[addr] & REG_RTCWKDAY_OSCRUN;
+		newValue |= regs[addr] & value & REG_RTCWKDAY_PWRFAIL;
+		regs[addr] = newValue;
+		break;
+	}
+
+	case REG_RTCMTH:
+		// LPYR is read-only and calculated from the year
+		regs[addr] = (value & ~REG_RTCMTH_LPYR) | (regs[addr] & REG_RTCMTH_LPYR);
+		break;
+
+	case REG_RTCYEAR:
+		regs[addr] = value;
+		if ((bcdToInt(value) % 4) == 0) {
+			regs[REG_RTCMTH] |= REG_RTCMTH_LPYR;
+		}
+		else {
+			regs[REG_RTCMTH] &= ~REG_RTCMTH_LPYR;
+		}
+		break;
+
+	case REG_EEUNLOCK:
+		if (value == 0x55) {
+			unlockState = 1;
+		}
+		else
+		if (value == 0xAA && unlockState == 1) {
+			unlockState = 2;
+		}
+		else {
+			unlockState = 0;
+		}
+		break;
+
+	case REG_ALARM0 + REG_ALARM_WKDAY_OFFSET:
+	case REG_ALARM1 + REG_ALARM_WKDAY_OFFSET:
+		// ALMxIF can only be cleared by software
+		regs[addr] = (value & ~REG_ALARM_WKDAY_ALMIF) | (regs[addr] & value & REG_ALARM_WKDAY_ALMIF);
+		break;
+
+	case 0x10:
+	case 0x17:
+		// Reserved
+		break;
+
+	default:
+		if (addr >= REG_POWER_DOWN) {
+			// Power fail time stamps are read-only
+			break;
+		}
+		regs[addr] = value;
+		break;
+	}
+
+	// OSCRUN follows ST (the simulator does not model oscillator start-up time)
+	if (regs[REG_RTCSEC] & REG_RTCSEC_ST) {
+		regs[REG_RTCWKDAY] |= REG_RTCWKDAY_OSCRUN;
+	}
+	else {
+		regs[REG_RTCWKDAY] &= ~REG_RTCWKDAY_OSCRUN;
+	}
+
+	// Changing the time or alarm registers updates the match state without setting the flags,
+	// because alarms only fire on transition into the matching condition.
+	checkAlarms(false);
+}
+
+uint8_t MCP79410Sim::regRead(uint8_t addr) const {
+	if (addr >= REG_SRAM) {
+		return sram[addr - REG_SRAM];
+	}
+	if (addr == REG_EEUNLOCK || addr == 0x10 || addr == 0x17) {
+		return 0;
+	}
+	return regs[addr];
+}
+
+int MCP79410Sim::eepromWrite(const uint8_t *data, size_t dataLen) {
+	uint8_t addr = data[0];
+	const uint8_t *bytes = &data[1];
+	size_t numBytes = dataLen - 1;
+	bool wrote = false;
+
+	stats.bytesWritten += dataLen;
+
+	if (addr < sizeof(eeprom)) {
+		uint8_t protectFrom;
+		switch((eepromStatus >> 2) & 0x3) {
+		case 1:
+			protectFrom = 0x60;
+			break;
+		case 2:
+			protectFrom = 0x40;
+			break;
+		case 3:
+			protectFrom = 0x00;
+			break;
+		default:
+			protectFrom = 0x80;
+			break;
+		}
+
+		uint8_t pageStart = addr & ~(EEPROM_PAGE_SIZE - 1);
+		for(size_t ii = 0; ii < numBytes; ii++) {
+			// Page write wraps around within the 8-byte page
+			uint8_t curAddr = pageStart | ((addr + ii) & (EEPROM_PAGE_SIZE - 1));
+			if (curAddr < protectFrom) {
+				eeprom[curAddr] = bytes[ii];
+				stats.eepromBytesWritten++;
+				wrote = true;
+			}
+		}
+		eepromPointer = pageStart | ((addr + numBytes) & (EEPROM_PAGE_SIZE - 1));
+	}
+	else
+	if (addr >= EEPROM_PROTECTED && addr < EEPROM_PROTECTED + sizeof(eepromProtected)) {
+		if (unlockState == 2) {
+			for(size_t ii = 0; ii < numBytes; ii++) {
+				eepromProtected[(addr + ii) & 0x7] = bytes[ii];
+				stats.eepromBytesWritten++;
+			}
+			wrote = true;
+		}
+		unlockState = 0;
+	}
+	else
+	if (addr == EEPROM_STATUS) {
+		eepromStatus = bytes[0] & 0x0c;
+		wrote = true;
+	}
+	else {
+		stats.nacks++;
+		return STAT_DATA_NACK;
+	}
+
+	if (wrote) {
+		eepromBusyUntilUs = nowUs + EEPROM_WRITE_CYCLE_US;
+		stats.eepromWriteCycles++;
+	}
+	return STAT_SUCCESS;
+}
+
+uint8_t MCP79410Sim::eepromRead(uint8_t addr) const {
+	if (addr < sizeof(eeprom)) {
+		return eeprom[addr];
+	}
+	if (addr >= EEPROM_PROTECTED && addr < EEPROM_PROTECTED + sizeof(eepromProtected)) {
+		return eepromProtected[addr - EEPROM_PROTECTED];
+	}
+	if (addr == EEPROM_STATUS) {
+		return eepromStatus;
+	}
+	return 0xff;
+}
+
+double MCP79410Sim::getEffectiveErrorPpm() const {
+	// Each trim step adds or subtracts 2 clock cycles, once per minute normally or 128 times
+	// per second in coarse trim mode. Sign bit 1 = add clocks (speeds up the clock).
+	uint8_t trim = regs[REG_OSCTRIM];
+	double clocksPerSecond = (double)(trim & 0x7f) * 2.0;
+	if (regs[REG_CONTROL] & REG_CONTROL_CRSTRIM) {
+		clocksPerSecond *= 128.0;
+	}
+	else {
+		clocksPerSecond /= 60.0;
+	}
+	double trimPpm = clocksPerSecond * 1000000.0 / 32768.0;
+
+	return crystalErrorPpm + ((trim & 0x80) ? trimPpm : -trimPpm);
+}
+
+void MCP79410Sim::advanceTime(uint64_t us) {
+	if (regs[REG_RTCSEC] & REG_RTCSEC_ST) {
+		subSecondUs += (double) us * (1.0 + getEffectiveErrorPpm() / 1000000.0);
+		while(subSecondUs >= 1000000.0) {
+			subSecondUs -= 1000000.0;
+			tickSecond();
+		}
+	}
+	nowUs += us;
+}
+
+void MCP79410Sim::tickSecond() {
+	int second = bcdToInt(regs[REG_RTCSEC] & 0x7f) + 1;
+	if (second < 60) {
+		regs[REG_RTCSEC] = (regs[REG_RTCSEC] & REG_RTCSEC_ST) | intToBcd(second);
+	}
+	else {
+		regs[REG_RTCSEC] &= REG_RTCSEC_ST;
+
+		int minute = bcdToInt(regs[REG_RTCMIN] & 0x7f) + 1;
+		if (minute < 60) {
+			regs[REG_RTCMIN] = intToBcd(minute);
+		}
+		else {
+			regs[REG_RTCMIN] = 0;
+
+			// 24-hour mode only
+			int hour = bcdToInt(regs[REG_RTCHOUR] & 0x3f) + 1;
+			if (hour < 24) {
+				regs[REG_RTCHOUR] = intToBcd(hour);
+			}
+			else {
+				regs[REG_RTCHOUR] = 0;
+
+				uint8_t wkday = (regs[REG_RTCWKDAY] & 0x7) + 1;
+				if (wkday > 7) {
+					wkday = 1;
+				}
+				regs[REG_RTCWKDAY] = (regs[REG_RTCWKDAY] & ~0x7) | wkday;
+
+				int year = bcdToInt(regs[REG_RTCYEAR]);
+				int month = bcdToInt(regs[REG_RTCMTH] & 0x1f);
+				int day = bcdToInt(regs[REG_RTCDATE] & 0x3f) + 1;
+				if (day > daysInMonth(year, month)) {
+					day = 1;
+					if (++month > 12) {
+						month = 1;
+						year = (year + 1) % 100;
+						regs[REG_RTCYEAR] = intToBcd(year);
+					}
+				}
+				regs[REG_RTCDATE] = intToBcd(day);
+				regs[REG_RTCMTH] = intToBcd(month) | (((year % 4) == 0) ? REG_RTCMTH_LPYR : 0);
+			}
+		}
+	}
+
+	checkAlarms(true);
+}
+
+bool MCP79410Sim::alarmMatches(int alarmNum) const {
+	const uint8_t *alm = &regs[(alarmNum == 0) ? REG_ALARM0 : REG_ALARM1];
+
+	bool secMatch = (alm[0] & 0x7f) == (regs[REG_RTCSEC] & 0x7f);
+	bool minMatch = (alm[1] & 0x7f) == (regs[REG_RTCMIN] & 0x7f);
+	bool hourMatch = (alm[2] & 0x7f) == (regs[REG_RTCHOUR] & 0x7f);
+	bool wkdayMatch = (alm[3] & 0x7) == (regs[REG_RTCWKDAY] & 0x7);
+	bool dateMatch = (alm[4] & 0x3f) == (regs[REG_RTCDATE] & 0x3f);
+	bool monthMatch = (alm[5] & 0x1f) == (regs[REG_RTCMTH] & 0x1f);
+
+	switch((alm[3] >> 4) & 0x7) {
+	case 0:
+		return secMatch;
+	case 1:
+		return minMatch;
+	case 2:
+		return hourMatch;
+	case 3:
+		return wkdayMatch;
+	case 4:
+		return dateMatch;
+	case 7:
+		return secMatch && minMatch && hourMatch && wkdayMatch && dateMatch && monthMatch;
+	default:
+		// Reserved mask values never match
+		return false;
+	}
+}
+
+void MCP79410Sim::checkAlarms(bool setFlags) {
+	for(int alarmNum = 0; alarmNum < 2; alarmNum++) {
+		uint8_t enableBit = (alarmNum == 0) ? REG_CONTROL_ALM0EN : REG_CONTROL_ALM1EN;
+		bool match = (regs[REG_CONTROL] & enableBit) != 0 && alarmMatches(alarmNum);
+
+		if (setFlags && match && !lastMatch[alarmNum]) {
+			regs[((alarmNum == 0) ? REG_ALARM0 : REG_ALARM1) + REG_ALARM_WKDAY_OFFSET] |= REG_ALARM_WKDAY_ALMIF;
+		}
+		lastMatch[alarmNum] = match;
+	}
+}
+
+void MCP79410Sim::simulatePowerFailure(uint32_t seconds) {
+	if ((regs[REG_RTCWKDAY] & REG_RTCWKDAY_VBATEN) == 0) {
+		// No battery backup: registers and SRAM are lost. Time still passes for the EEPROM.
+		nowUs += (uint64_t) seconds * 1000000;
+		coldBoot();
+		return;
+	}
+
+	bool storeStamps = (regs[REG_RTCWKDAY] & REG_RTCWKDAY_PWRFAIL) == 0;
+
+	if (storeStamps) {
+		// Minute, hour, date, and month with the weekday in bits 7:5
+		regs[REG_POWER_DOWN] = regs[REG_RTCMIN] & 0x7f;
+		regs[REG_POWER_DOWN + 1] = regs[REG_RTCHOUR] & 0x7f;
+		regs[REG_POWER_DOWN + 2] = regs[REG_RTCDATE] & 0x3f;
+		regs[REG_POWER_DOWN + 3] = (regs[REG_RTCMTH] & 0x1f) | ((regs[REG_RTCWKDAY] & 0x7) << 5);
+	}
+
+	advanceTime((uint64_t) seconds * 1000000);
+
+	if (storeStamps) {
+		regs[REG_POWER_UP] = regs[REG_RTCMIN] & 0x7f;
+		regs[REG_POWER_UP + 1] = regs[REG_RTCHOUR] & 0x7f;
+		regs[REG_POWER_UP + 2] = regs[REG_RTCDATE] & 0x3f;
+		regs[REG_POWER_UP + 3] = (regs[REG_RTCMTH] & 0x1f) | ((regs[REG_RTCWKDAY] & 0x7) << 5);
+	}
+	regs[REG_RTCWKDAY] |= REG_RTCWKDAY_PWRFAIL;
+}
+
+bool MCP79410Sim::getMFP() const {
+	uint8_t control = regs[REG_CONTROL];
+
+	if (control & REG_CONTROL_SQWEN) {
+		static const double freqs[4] = { 1.0, 4096.0, 8192.0, 32768.0 };
+		double cycles = subSecondUs * freqs[control & 0x3] / 1000000.0;
+		return (cycles - (double)(uint64_t) cycles) < 0.5;
+	}
+
+	if (control & (REG_CONTROL_ALM0EN | REG_CONTROL_ALM1EN)) {
+		// Polarity comes from ALM0WKDAY. The output is asserted if any enabled alarm flag is set.
+		bool polarity = (regs[REG_ALARM0 + REG_ALARM_WKDAY_OFFSET] & REG_ALARM_WKDAY_ALMPOL) != 0;
+		bool asserted = false;
+		if ((control & REG_CONTROL_ALM0EN) && (regs[REG_ALARM0 + REG_ALARM_WKDAY_OFFSET] & REG_ALARM_WKDAY_ALMIF)) {
+			asserted = true;
+		}
+		if ((control & REG_CONTROL_ALM1EN) && (regs[REG_ALARM1 + REG_ALARM_WKDAY_OFFSET] & REG_ALARM_WKDAY_ALMIF)) {
+			asserted = true;
+		}
+		return asserted ? polarity : !polarity;
+	}
+
+	return (control & REG_CONTROL_OUT) != 0;
+}
@@ -0,0 +1,210 @@
+#ifndef __MCP79410SIM_H
+#define __MCP79410SIM_H
+
+// This file intentionally does not include Particle.h so the simulator can be compiled on a host computer.
+#include "MCP79410Transport.h"
+
+/**
+ * @brief Counters kept by MCP79410Sim. See MCP79410Sim::getStats().
+ */
+struct MCP79410SimStats {
+	uint32_t transactions; //!< Number of bus transactions (writeRead or writeSegments calls), including ones that were NACKed
+	uint32_t nacks; //!< Number of transactions that were NACKed, including EEPROM polls while busy
+	uint32_t bytesWritten; //!< Number of bytes written, not including the I2C address byte
+	uint32_t bytesRead; //!< Number of bytes read
+	uint64_t busTimeUs; //!< Simulated time spent on the bus in microseconds, based on the bus clock
+	uint32_t eepromWriteCycles; //!< Number of EEPROM write cycles started (each is MCP79410Sim::EEPROM_WRITE_CYCLE_US)
+	uint32_t eepromBytesWritten; //!< Number of EEPROM bytes actually stored
+};
+
+/**
+ * @brief Behavioral simulation of a MCP79410 chip, for testing and benchmarking on a host computer
+ *
+ * This implements MCP79410Transport so it can be passed to the MCP79410 constructor in place of Wire:
+ *
+ * ```
+ * MCP79410Sim sim;
+ * MCP79410 rtc(sim);
+ * ```
+ *
+ * What is simulated:
+ *
+ * - The register file (0x00 - 0x1f) and 64-byte SRAM at I2C address 0x6f
+ * - The ticking oscillator, including the ST and OSCRUN bits, BCD calendar with leap years, crystal
+ * error, and digital trimming (OSCTRIM and CRSTRIM). As on the chip, writing the seconds register does
+ * not restart the second; only stopping the oscillator (clearing ST) resets the divider chain.
+ * - Alarm matching using the ALMxMSK bits, setting ALMxIF on transition into the matching condition
+ * - The 128-byte EEPROM at I2C address 0x57, with 8-byte page write wrap, block protection from the
+ * EEPROM status register, and a 5 ms write cycle during which the EEPROM does not ACK its address
+ * - The 8-byte protected EEPROM block, which can only be written immediately after the 0x55, 0xAA
+ * unlock sequence to the EEUNLOCK register
+ * - Power failure time stamps and the PWRFAIL bit, using simulatePowerFailure()
+ *
+ * Time in the simulation only advances when you call advanceTime() and by the duration of each bus
+ * transaction, calculated from the bus clock speed (100 kHz by default). Because of this, EEPROM
+ * ACK polling works as it does on real hardware: each poll takes some bus time and eventually the
+ * write cycle completes.
+ *
+ * The MFP output can be read using getMFP(). In 1 Hz square wave mode, the simulator makes the output
+ * high for the first half of each second, so the rising edge coincides with the seconds increment.
+ */
+class MCP79410Sim : public MCP79410Transport {
+public:
+	/**
+	 * @brief Constructor. The simulated chip starts out in the state after a cold boot: oscillator stopped,
+	 * time registers cleared, EEPROM erased to 0xff.
+	 */
+	MCP79410Sim();
+
+	/**
+	 * @brief Destructor
+	 */
+	virtual ~MCP79410Sim();
+
+	/**
+	 * @brief Simulated bus transaction. See MCP79410Transport::writeRead().
+	 */
+	virtual int writeRead(uint8_t i2cAddr, const uint8_t *writeBuf, size_t writeLen, uint8_t *readBuf, size_t readLen);
+
+	/**
+	 * @brief Simulated bus transaction. See MCP79410Transport::writeSegments().
+	 */
+	virtual int writeSegments(uint8_t i2cAddr, const MCP79410TransportSegment *segments, size_t numSegments);
+
+	/**
+	 * @brief Sets the simulated I2C bus clock in Hz (default: 100000)
+	 *
+	 * This determines how much simulated time each transaction takes.
+	 */
+	MCP79410Sim &withBusClock(uint32_t hz) { busClockHz = hz; return *this; };
+
+	/**
+	 * @brief Sets the simulated crystal error in parts per million (default: 0)
+	 *
+	 * Positive values make the clock run fast. The OSCTRIM register is applied on top of this.
+	 */
+	MCP79410Sim &withCrystalErrorPpm(double ppm) { crystalErrorPpm = ppm; return *this; };
+
+	/**
+	 * @brief Advance the simulated time
+	 *
+	 * @param us Number of microseconds to advance. The oscillator (if running) ticks, alarms are
+	 * checked every second, and the EEPROM write cycle may complete.
+	 */
+	void advanceTime(uint64_t us);
+
+	/**
+	 * @brief Gets the simulated time in microseconds since the object was constructed
+	 */
+	uint64_t getTimeUs() const { return nowUs; };
+
+	/**
+	 * @brief Simulate removing main power for a period of time
+	 *
+	 * @param seconds Number of seconds power is removed for
+	 *
+	 * If the battery is enabled (VBATEN), the clock keeps running, the power down and power up time stamps
+	 * are stored (if PWRFAIL is not already set), and PWRFAIL is set. If the battery is not enabled, the
+	 * registers and SRAM are lost, as on a cold boot. The EEPROM is preserved in both cases.
+	 */
+	void simulatePowerFailure(uint32_t seconds);
+
+	/**
+	 * @brief Returns the logic level of the MFP pin
+	 *
+	 * This reflects the OUT bit, square wave mode, or the alarm outputs with polarity, depending on
+	 * the control register.
+	 */
+	bool getMFP() const;
+
+	/**
+	 * @brief Gets the counters for transactions, bytes, and simulated bus time
+	 */
+	const MCP79410SimStats &getStats() const { return stats; };
+
+	/**
+	 * @brief Clear the counters returned by getStats()
+	 */
+	void resetStats();
+
+	/**
+	 * @brief Returns true if an EEPROM write cycle is in progress
+	 */
+	bool isEEPROMBusy() const { return nowUs < eepromBusyUntilUs; };
+
+	static const uint8_t REG_I2C_ADDR = 0x6f; //!< I2C address for registers and SRAM
+	static const uint8_t EEPROM_I2C_ADDR = 0x57; //!< I2C address for EEPROM
+	static const uint32_t EEPROM_WRITE_CYCLE_US = 5000; //!< Duration of an EEPROM write cycle (tWC) in microseconds
+
+	uint8_t regs[0x20]; //!< Register file 0x00 - 0x1f. You can inspect or modify this directly.
+	uint8_t sram[64]; //!< SRAM, register addresses 0x20 - 0x5f
+	uint8_t eeprom[128]; //!< Main EEPROM array
+	uint8_t eepromProtected[8]; //!< Protected EEPROM block (0xf0 - 0xf7)
+	uint8_t eepromStatus; //!< EEPROM status register (0xff), block protection in bits 3:2
+
+protected:
+	/**
+	 * @brief Add the time for a transaction of numBytes bytes (including address bytes) and update counters
+	 */
+	void busTransaction(size_t numBytes, size_t repeatedStarts);
+
+	/**
+	 * @brief Write one byte to a register or SRAM, handling read-only and clear-only bits
+	 */
+	void regWrite(uint8_t addr, uint8_t value);
+
+	/**
+	 * @brief Read one byte from a register or SRAM
+	 */
+	uint8_t regRead(uint8_t addr) const;
+
+	/**
+	 * @brief Handle a write to the EEPROM I2C address. data[0] is the EEPROM address.
+	 *
+	 * @return 0 on success or a MCP79410Transport error code
+	 */
+	int eepromWrite(const uint8_t *data, size_t dataLen);
+
+	/**
+	 * @brief Read one byte from the EEPROM address space (main array, protected block, or status)
+	 */
+	uint8_t eepromRead(uint8_t addr) const;
+
+	/**
+	 * @brief Increment the clock by one second, with BCD and calendar carries
+	 */
+	void tickSecond();
+
+	/**
+	 * @brief Returns true if the alarm registers for alarmNum match the current time, per ALMxMSK
+	 */
+	bool alarmMatches(int alarmNum) const;
+
+	/**
+	 * @brief Evaluate both alarms and set ALMxIF on transition into the matching condition
+	 */
+	void checkAlarms(bool setFlags);
+
+	/**
+	 * @brief Returns the effective oscillator error in ppm, including crystal error and trim
+	 */
+	double getEffectiveErrorPpm() const;
+
+	/**
+	 * @brief Set the registers and SRAM to the cold boot state
+	 */
+	void coldBoot();
+
+	uint32_t busClockHz = 100000; //!< Simulated bus clock
+	double crystalErrorPpm = 0; //!< Simulated crystal error in ppm
+	uint64_t nowUs = 0; //!< Simulated time
+	double subSecondUs = 0; //!< Position within the current second, in microseconds of oscillator time
+	uint64_t eepromBusyUntilUs = 0; //!< EEPROM is busy (NACKs) until this time
+	uint8_t regPointer = 0; //!< Register address pointer for 0x6f
+	uint8_t eepromPointer = 0; //!< Address pointer for 0x57
+	uint8_t unlockState = 0; //!< EEUNLOCK sequence state: 0 = locked, 1 = got 0x55, 2 = unlocked
+	bool lastMatch[2]; //!< Alarm match state as of the last evaluation, for edge detection
+	MCP79410SimStats stats; //!< Counters
+};
+
+#endif /* __MCP79410SIM_H */
@@ -0,0 +1,95 @@
+#ifndef __MCP79410TRANSPORT_H
+#define __MCP79410TRANSPORT_H
+
+// This file intentionally does not include Particle.h so bus implementations (such as a simulator)
+// can be compiled on a host computer.
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief One piece of a multi-segment write. See MCP79410Transport::writeSegments().
+ */
+struct MCP79410TransportSegment {
+	const uint8_t *buf; //!< Data to write. Can be NULL if len is 0.
+	size_t len; //!< Number of bytes in buf
+};
+
+/**
+ * @brief Abstract interface to the I2C bus used by the MCP79410 class
+ *
+ * By default, MCP79410 uses MCP79410TwoWireTransport, which talks to a TwoWire object (Wire or Wire1).
+ * You can implement this interface to use a different bus, for example a DMA-based I2C driver, an
+ * I2C bus behind a multiplexer, or a simulated device, and pass it to the MCP79410 constructor.
+ *
+ * All methods return 0 on success or a non-zero error code. The codes follow the
+ * TwoWire::endTransmission() convention where possible:
+ *
+ * | Value | Description |
+ * | ----- | ----------- |
+ * | 0 | Success |
+ * | 1 | Data too long for the transport |
+ * | 2 | Received NACK on transmit of address |
+ * | 3 | Received NACK on transmit of data |
+ * | 4 | Other error, including fewer bytes received than requested |
+ */
+class MCP79410Transport {
+public:
+	/**
+	 * @brief Destructor
+	 */
+	virtual ~MCP79410Transport() {};
+
+	/**
+	 * @brief Called from MCP79410::setup() to initialize the bus. The default does nothing.
+	 */
+	virtual void begin() {};
+
+	/**
+	 * @brief Write bytes, then (optionally) read bytes after a repeated start in a single transaction
+	 *
+	 * @param i2cAddr The 7-bit I2C address
+	 *
+	 * @param writeBuf The bytes to write, typically the register address
+	 *
+	 * @param writeLen The number of bytes to write
+	 *
+	 * @param readBuf The buffer to read into. Can be NULL if readLen is 0.
+	 *
+	 * @param readLen The number of bytes to read. If 0, this is a plain write ending with a stop.
+	 * Must not be larger than maxReadLen().
+	 */
+	virtual int writeRead(uint8_t i2cAddr, const uint8_t *writeBuf, size_t writeLen, uint8_t *readBuf, size_t readLen) = 0;
+
+	/**
+	 * @brief Write several buffers one after another as a single transaction
+	 *
+	 * @param i2cAddr The 7-bit I2C address
+	 *
+	 * @param segments Array of buffers to write. Can be NULL if numSegments is 0.
+	 *
+	 * @param numSegments The number of segments. If 0, only the address is sent, which is how the
+	 * EEPROM is polled for write completion.
+	 *
+	 * This is used to send a register address followed by the data without copying the data into a
+	 * separate buffer. The total length must not be larger than maxWriteLen().
+	 */
+	virtual int writeSegments(uint8_t i2cAddr, const MCP79410TransportSegment *segments, size_t numSegments) = 0;
+
+	/**
+	 * @brief Maximum number of bytes that can be read in one writeRead() call
+	 */
+	virtual size_t maxReadLen() const { return 32; };
+
+	/**
+	 * @brief Maximum number of bytes, including the register address, that can be written in one call
+	 */
+	virtual size_t maxWriteLen() const { return 32; };
+
+	static const int STAT_SUCCESS = 0; //!< Success
+	static const int STAT_TOO_LONG = 1; //!< Data too long for the transport
+	static const int STAT_ADDR_NACK = 2; //!< Received NACK on transmit of address
+	static const int STAT_DATA_NACK = 3; //!< Received NACK on transmit of data
+	static const int STAT_OTHER = 4; //!< Other error, including fewer bytes received than requested
+};
+
+#endif /* __MCP79410TRANSPORT_H */
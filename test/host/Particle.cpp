@@ -0,0 +1,172 @@
+#include "Particle.h"
+#include "MCP79410Sim.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+TimeClass Time;
+CloudClass Particle;
+
+static MCP79410Sim *sim = nullptr;
+static pin_t mfpPin = 8;
+static bool logEnabled = false;
+
+static const size_t NUM_PINS = 32;
+static PinMode pinModes[NUM_PINS];
+static std::function<void()> handlers[NUM_PINS];
+static InterruptMode handlerModes[NUM_PINS];
+
+static void logMessage(const char *level, const char *name, const char *fmt, va_list ap) {
+	if (logEnabled) {
+		printf("%010lu [%s] %s: ", millis(), name, level);
+		vprintf(fmt, ap);
+		printf("\n");
+	}
+}
+
+void Logger::trace(const char *fmt, ...) const {
+	va_list ap;
+	va_start(ap, fmt);
+	logMessage("TRACE", name, fmt, ap);
+	va_end(ap);
+}
+
+void Logger::info(const char *fmt, ...) const {
+	va_list ap;
+	va_start(ap, fmt);
+	logMessage("INFO", name, fmt, ap);
+	va_end(ap);
+}
+
+void Logger::warn(const char *fmt, ...) const {
+	va_list ap;
+	va_start(ap, fmt);
+	logMessage("WARN", name, fmt, ap);
+	va_end(ap);
+}
+
+void Logger::error(const char *fmt, ...) const {
+	va_list ap;
+	va_start(ap, fmt);
+	logMessage("ERROR", name, fmt, ap);
+	va_end(ap);
+}
+
+time_t TimeClass::now() const {
+	if (stopped != 0) {
+		return stopped;
+	}
+	return base + (time_t)((sim ? sim->getTimeUs() : 0) / 1000000);
+}
+
+int TimeClass::year() const {
+	time_t value = now();
+	struct tm tm;
+	gmtime_r(&value, &tm);
+	return tm.tm_year + 1900;
+}
+
+void TimeClass::setTime(time_t value) {
+	base = value - (time_t)((sim ? sim->getTimeUs() : 0) / 1000000);
+}
+
+String TimeClass::format(time_t value, const char *format) {
+	// Always ISO 8601, which is what TIME_FORMAT_DEFAULT is on a device
+	(void)format;
+
+	char buf[32];
+	struct tm tm;
+	gmtime_r(&value, &tm);
+	strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", &tm);
+	return String(buf);
+}
+
+unsigned long millis() {
+	// Each call takes a little time, so code that polls millis() makes progress
+	hostAdvanceTime(1);
+	return (unsigned long)((sim ? sim->getTimeUs() : 0) / 1000);
+}
+
+unsigned long micros() {
+	return (unsigned long)(sim ? sim->getTimeUs() : 0);
+}
+
+void delay(unsigned long ms) {
+	hostAdvanceTime((uint64_t)ms * 1000);
+}
+
+void os_thread_yield() {
+	hostAdvanceTime(10);
+}
+
+void pinMode(pin_t pin, PinMode mode) {
+	if (pin < NUM_PINS) {
+		pinModes[pin] = mode;
+	}
+}
+
+PinMode getPinMode(pin_t pin) {
+	return (pin < NUM_PINS) ? pinModes[pin] : INPUT;
+}
+
+int32_t digitalRead(pin_t pin) {
+	if (sim && pin == mfpPin) {
+		return sim->getMFP() ? HIGH : LOW;
+	}
+	return LOW;
+}
+
+bool attachInterrupt(pin_t pin, std::function<void()> handler, InterruptMode mode) {
+	if (pin >= NUM_PINS) {
+		return false;
+	}
+	handlers[pin] = handler;
+	handlerModes[pin] = mode;
+	return true;
+}
+
+void detachInterrupt(pin_t pin) {
+	if (pin < NUM_PINS) {
+		handlers[pin] = nullptr;
+	}
+}
+
+void hostSetSim(MCP79410Sim *value, pin_t pin) {
+	for(size_t ii = 0; ii < NUM_PINS; ii++) {
+		handlers[ii] = nullptr;
+	}
+	sim = value;
+	mfpPin = pin;
+}
+
+void hostAdvanceTime(uint64_t us) {
+	if (!sim) {
+		return;
+	}
+	if (mfpPin >= NUM_PINS || !handlers[mfpPin]) {
+		sim->advanceTime(us);
+		return;
+	}
+
+	// In square wave mode (SQWEN in the control register), step 1 us at a time so interrupt handlers see
+	// every edge, even at 4096 Hz. Otherwise MFP only changes on alarms and register writes.
+	uint64_t step = (sim->regs[0x07] & 0x40) ? 1 : 1000;
+	bool last = sim->getMFP();
+	while(us > 0) {
+		uint64_t delta = (us < step) ? us : step;
+		sim->advanceTime(delta);
+		us -= delta;
+		bool cur = sim->getMFP();
+		if (cur != last && handlers[mfpPin]) {
+			InterruptMode mode = handlerModes[mfpPin];
+			if (mode == CHANGE || (mode == RISING && cur) || (mode == FALLING && !cur)) {
+				handlers[mfpPin]();
+			}
+		}
+		last = cur;
+	}
+}
+
+void hostSetLogEnabled(bool enabled) {
+	logEnabled = enabled;
+}
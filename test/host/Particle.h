@@ -0,0 +1,107 @@
+#ifndef __HOST_PARTICLE_H
+#define __HOST_PARTICLE_H
+
+// Minimal stand-in for Particle.h so the library can be built and run on a host computer against
+// MCP79410Sim. Only what the library uses is provided. Build with MCP79410_DISABLE_TWOWIRE defined,
+// since there is no TwoWire here.
+//
+// Time is simulated time: millis(), micros(), Time.now(), and delay() are all derived from the
+// simulator set with hostSetSim(), so bus transactions and EEPROM write cycles take the time they
+// would on real hardware.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <functional>
+
+class MCP79410Sim;
+
+typedef uint16_t pin_t;
+
+enum InterruptMode { CHANGE, RISING, FALLING };
+enum PinMode { INPUT, OUTPUT, INPUT_PULLUP, INPUT_PULLDOWN };
+
+#define LOW 0
+#define HIGH 1
+
+#define TIME_FORMAT_DEFAULT "default"
+
+#define ATOMIC_BLOCK() if (true)
+
+class String : public std::string {
+public:
+	String() {};
+	String(const char *s) : std::string(s) {};
+};
+
+class Logger {
+public:
+	Logger(const char *name) : name(name) {};
+
+	void trace(const char *fmt, ...) const __attribute__((format(printf, 2, 3)));
+	void info(const char *fmt, ...) const __attribute__((format(printf, 2, 3)));
+	void warn(const char *fmt, ...) const __attribute__((format(printf, 2, 3)));
+	void error(const char *fmt, ...) const __attribute__((format(printf, 2, 3)));
+
+protected:
+	const char *name;
+};
+
+class TimeClass {
+public:
+	bool isValid() const { return valid; };
+	time_t now() const;
+	int year() const;
+	void setTime(time_t value);
+	String format(time_t value, const char *format);
+
+	bool valid = true; //!< Set to false to test code paths that need a valid system clock
+	time_t base = 1767225600; //!< Time.now() when the simulated time is 0 (2026-01-01 00:00:00)
+	time_t stopped = 0; //!< If not 0, Time.now() returns this, as if the system clock were not running
+};
+extern TimeClass Time;
+
+class CloudClass {
+public:
+	unsigned long timeSyncedLast() const { return syncedLast; };
+
+	unsigned long syncedLast = 0; //!< Value returned by timeSyncedLast()
+};
+extern CloudClass Particle;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void os_thread_yield();
+
+void pinMode(pin_t pin, PinMode mode);
+PinMode getPinMode(pin_t pin);
+int32_t digitalRead(pin_t pin);
+
+bool attachInterrupt(pin_t pin, std::function<void()> handler, InterruptMode mode);
+template<class T> bool attachInterrupt(pin_t pin, void (T::*handler)(), T *instance, InterruptMode mode) {
+	return attachInterrupt(pin, std::bind(handler, instance), mode);
+}
+void detachInterrupt(pin_t pin);
+
+/**
+ * @brief Set the simulator that drives time, and the pin MFP is connected to
+ *
+ * digitalRead() of mfpPin returns the simulated MFP level, and while time advances, interrupt handlers
+ * attached to mfpPin are called on its edges. Handlers attached for the previous simulator are detached.
+ */
+void hostSetSim(MCP79410Sim *sim, pin_t mfpPin = 8);
+
+/**
+ * @brief Advance simulated time, calling interrupt handlers on MFP edges. delay() calls this.
+ */
+void hostAdvanceTime(uint64_t us);
+
+/**
+ * @brief Enable printing log messages to stdout (default: off)
+ */
+void hostSetLogEnabled(bool enabled);
+
+#endif /* __HOST_PARTICLE_H */
@@ -0,0 +1,201 @@
+// Benchmarks on a host computer against MCP79410Sim: calendar conversion compared to the C library,
+// EEPROM write costs, and the bus traffic of the millisecond time, cached clock, and cloud sync features.
+// Build and run with "make benchmark" in this directory.
+
+#include "MCP79410RK.h"
+#include "MCP79410Sim.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+static double elapsedNs(std::chrono::steady_clock::time_point start, long count) {
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / (double)count;
+}
+
+static void benchCalendar() {
+	// MCP79410Time used mktime() (which depends on TZ) and gmtime() before. Compare against gmtime_r()
+	// and mktime() with TZ set to UTC. The results are checked against gmtime_r() in host-test.cpp.
+	setenv("TZ", "UTC", 1);
+	tzset();
+
+	const long count = 2000000;
+	time_t sum = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	for(long ii = 0; ii < count; ii++) {
+		MCP79410Time time;
+		time.fromUnixTime(1767225600 + ii * 97);
+		sum += time.toUnixTime();
+	}
+	double libraryNs = elapsedNs(start, count);
+
+	start = std::chrono::steady_clock::now();
+	for(long ii = 0; ii < count; ii++) {
+		time_t t = 1767225600 + ii * 97;
+		struct tm tm;
+		gmtime_r(&t, &tm);
+		sum += mktime(&tm);
+	}
+	double libcNs = elapsedNs(start, count);
+
+	printf("calendar: fromUnixTime() + toUnixTime() %.1f ns, gmtime_r() + mktime() %.1f ns (%ld)\n", libraryNs, libcNs, (long)(sum & 1));
+}
+
+static void benchEEPROM() {
+	uint8_t data[128];
+	for(size_t ii = 0; ii < sizeof(data); ii++) {
+		data[ii] = (uint8_t)(ii * 3);
+	}
+
+	for(int pageWrite = 1; pageWrite >= 0; pageWrite--) {
+		MCP79410Sim sim;
+		hostSetSim(&sim);
+		MCP79410 rtc(sim);
+		rtc.setup();
+		rtc.withEEPROMPageWrite(pageWrite != 0);
+
+		sim.resetStats();
+		uint64_t startUs = sim.getTimeUs();
+		rtc.eeprom().writeData(0, data, sizeof(data));
+		printf("EEPROM: 128 byte write, %s mode: %lu write cycles, %lu transactions, %lu ms\n", pageWrite ? "page" : "byte",
+			(unsigned long)sim.getStats().eepromWriteCycles, (unsigned long)sim.getStats().transactions,
+			(unsigned long)((sim.getTimeUs() - startUs) / 1000));
+	}
+
+	// Re-putting a struct with one changed field
+	struct Config {
+		int32_t a;
+		int32_t b;
+		char name[40];
+		int32_t c;
+	};
+	MCP79410Sim sim;
+	hostSetSim(&sim);
+	MCP79410 rtc(sim);
+	rtc.setup();
+	Config config;
+	memset(&config, 0, sizeof(config));
+	strcpy(config.name, "config");
+
+	for(int differential = 0; differential <= 1; differential++) {
+		rtc.eeprom().withDifferentialWrite(differential != 0);
+		config.c = 0;
+		rtc.eeprom().put(0, config);
+		sim.resetStats();
+		config.c = 5;
+		rtc.eeprom().put(0, config);
+		printf("EEPROM: %u byte struct with one changed field, %s: %lu write cycles\n", (unsigned)sizeof(config),
+			differential ? "differential" : "full", (unsigned long)sim.getStats().eepromWriteCycles);
+	}
+}
+
+static void benchRTCTimeMs() {
+	MCP79410Sim sim;
+	sim.withCrystalErrorPpm(50);
+	hostSetSim(&sim);
+	MCP79410 rtc(sim);
+	rtc.withRTCTimeMs().setup();
+	rtc.setRTCTime(Time.now());
+	delay(333);
+	sim.resetStats();
+
+	// Compare getRTCTimeMs() to the simulated RTC at each seconds rollover for 3 hours. Until the drift has
+	// been measured from two anchors, the error grows with the crystal error, so it's reported separately.
+	uint8_t lastSec = sim.regs[0x00];
+	long maxErrMs = 0, maxErrNoDriftMs = 0, lost = 0;
+	bool hadAnchor = false;
+	for(long ii = 0; ii < 3 * 3600 * 1000L; ii++) {
+		rtc.loop();
+		sim.advanceTime(1000);
+		if (sim.regs[0x00] != lastSec) {
+			lastSec = sim.regs[0x00];
+			if (rtc.hasRTCTimeMsAnchor()) {
+				long errMs = (long)(rtc.getRTCTimeMs() % 1000);
+				if (errMs > 500) {
+					errMs -= 1000;
+				}
+				long &maxErr = (rtc.getAnchorDriftPpm() != 0) ? maxErrMs : maxErrNoDriftMs;
+				if (labs(errMs) > labs(maxErr)) {
+					maxErr = errMs;
+				}
+				hadAnchor = true;
+			}
+			else
+			if (hadAnchor) {
+				lost++;
+			}
+		}
+	}
+	printf("getRTCTimeMs(): 50 ppm crystal, 3 hours: max error %ld ms (%ld ms before the drift was measured), anchor lost %ld times, drift %.2f ppm, %lu transactions\n",
+		maxErrMs, maxErrNoDriftMs, lost, rtc.getAnchorDriftPpm(), (unsigned long)sim.getStats().transactions);
+}
+
+static void benchCachedClock() {
+	MCP79410Sim sim;
+	sim.withCrystalErrorPpm(-30);
+	hostSetSim(&sim);
+	MCP79410 rtc(sim);
+	rtc.withCachedClock(true, 100).setup();
+	rtc.setRTCTime(Time.now());
+	delay(333);
+	sim.resetStats();
+
+	// getRTCTime() at 50 Hz for an hour. A call within a millisecond or so of the seconds rollover can
+	// return the other second, which is counted as a mismatch.
+	long calls = 0, mismatches = 0;
+	for(long ii = 0; ii < 3600 * 1000L; ii++) {
+		rtc.loop();
+		if ((ii % 20) == 0) {
+			uint8_t sec = sim.regs[0x00] & 0x7f;
+			MCP79410Time time;
+			time.fromUnixTime(rtc.getRTCTime());
+			if (time.getSecond() != MCP79410Time::bcdToInt(sec)) {
+				mismatches++;
+			}
+			calls++;
+		}
+		sim.advanceTime(1000);
+	}
+	printf("cached clock: %ld getRTCTime() calls in an hour, %ld mismatches, %lu transactions\n",
+		calls, mismatches, (unsigned long)sim.getStats().transactions);
+}
+
+static void benchCloudSync() {
+	MCP79410Sim sim;
+	sim.withCrystalErrorPpm(120);
+	hostSetSim(&sim);
+	MCP79410 rtc(sim);
+	rtc.setup();
+	delay(5333);
+	Particle.syncedLast = 1;
+	sim.resetStats();
+
+	// Hourly cloud time syncs for 3 days
+	for(int hour = 0; hour < 72; hour++) {
+		for(long ii = 0; ii < 3600 * 100L; ii++) {
+			rtc.loop();
+			sim.advanceTime(10000);
+		}
+		Particle.syncedLast += 3600000;
+	}
+
+	int corrected = 0;
+	for(size_t ii = 0; ii < rtc.getSyncErrorCount(); ii++) {
+		if (rtc.getSyncError(ii).corrected) {
+			corrected++;
+		}
+	}
+	printf("cloud sync: 120 ppm crystal, hourly syncs for 3 days: %d of the last %u syncs rewrote the RTC, %lu transactions\n",
+		corrected, (unsigned)rtc.getSyncErrorCount(), (unsigned long)sim.getStats().transactions);
+}
+
+int main() {
+	benchCalendar();
+	benchEEPROM();
+	benchRTCTimeMs();
+	benchCachedClock();
+	benchCloudSync();
+	return 0;
+}
@@ -0,0 +1,1327 @@
+// Runs the SRAM, EEPROM, and alarm code paths against MCP79410Sim on a host computer, and prints the
+// number of bus transactions and simulated bus time for each. Build and run with make in this directory.
+
+#include "MCP79410RK.h"
+#include "MCP79410AlarmScheduler.h"
+#include "MCP79410Sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { printf("FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond); failures++; } } while(0)
+
+static void printStats(const char *name, MCP79410Sim &sim) {
+	const MCP79410SimStats &stats = sim.getStats();
+	printf("%-36s %4lu transactions %8lu us\n", name, (unsigned long)stats.transactions, (unsigned long)stats.busTimeUs);
+	sim.resetStats();
+}
+
+static void testSRAM() {
+	MCP79410Sim sim;
+	hostSetSim(&sim);
+	MCP79410 rtc(sim);
+	rtc.setup();
+
+	uint8_t data[64], check[64];
+	for(size_t ii = 0; ii < sizeof(data); ii++) {
+		data[ii] = (uint8_t)(ii * 7 + 3);
+	}
+
+	sim.resetStats();
+	CHECK(rtc.sram().writeData(0, data, sizeof(data)));
+	printStats("SRAM write 64 bytes", sim);
+
+	CHECK(rtc.sram().readData(0, check, sizeof(check)));
+	printStats("SRAM read 64 bytes", sim);
+	CHECK(memcmp(data, check, sizeof(data)) == 0);
+
+	uint32_t value = 0x12345678, readBack = 0;
+	rtc.sram().put(10, value);
+	rtc.sram().get(10, readBack);
+	CHECK(readBack == value);
+
+	CHECK(!rtc.sram().writeData(60, data, 8));
+}
+
+// Transport that corrupts the next corruptPages multi-byte EEPROM writes, so the page does not verify
+class CorruptingTransport : public MCP79410Transport {
+public:
+	CorruptingTransport(MCP79410Sim &sim) : sim(sim) {};
+
+	virtual int writeRead(uint8_t i2cAddr, const uint8_t *writeBuf, size_t writeLen, uint8_t *readBuf, size_t readLen) {
+		return sim.writeRead(i2cAddr, writeBuf, writeLen, readBuf, readLen);
+	}
+
+	virtual int writeSegments(uint8_t i2cAddr, const MCP79410TransportSegment *segments, size_t numSegments) {
+		if (corruptPages > 0 && i2cAddr == MCP79410Sim::EEPROM_I2C_ADDR && numSegments == 2 && segments[1].len > 1) {
+			uint8_t buf[8];
+			size_t len = segments[1].len < sizeof(buf) ? segments[1].len : sizeof(buf);
+			memcpy(buf, segments[1].buf, len);
+			buf[len - 1] ^= 0xff;
+
+			MCP79410TransportSegment corrupted[2] = { segments[0], { buf, len } };
+			corruptPages--;
+			return sim.writeSegments(i2cAddr, corrupted, numSegments);
+		}
+		return sim.writeSegments(i2cAddr, segments, numSegments);
+	}
+
+	MCP79410Sim &sim;
+	int corruptPages = 0;
+};
+
+static void testEEPROMAsyncRetry() {
+	MCP79410Sim sim;
+	hostSetSim(&sim);
+	CorruptingTransport transport(sim);
+	MCP79410 rtc(transport);
+	rtc.setup();
+
+	uint8_t data[8], check[8];
+	for(size_t ii = 0; ii < sizeof(data); ii++) {
+		data[ii] = (uint8_t)(ii * 5 + 2);
+	}
+
+	// The page write does not verify, so it's rewritten one byte per loop() without blocking
+	transport.corruptPages = 1;
+	bool done = false, result = false;
+	CHECK(rtc.eeprom().writeDataAsync(16, data, sizeof(data), [&](bool success) { done = true; result = success; }));
+
+	unsigned long maxLoopUs = 0;
+	int loops = 0;
+	for(; loops < 200 && !done; loops++) {
+		unsigned long start = micros();
+		rtc.loop();
+		unsigned long elapsed = micros() - start;
+		if (elapsed > maxLoopUs) {
+			maxLoopUs = elapsed;
+		}
+
+		// Reads during the retry return the data being written
+		if (loops == 10) {
+			CHECK(rtc.eeprom().readData(16, check, sizeof(check)));
+			CHECK(memcmp(data, check, sizeof(data)) == 0);
+		}
+		delay(1);
+	}
+	CHECK(done && result);
+	CHECK(transport.corruptPages == 0);
+	CHECK(maxLoopUs < MCP79410Sim::EEPROM_WRITE_CYCLE_US);
+	CHECK(sim.getStats().eepromWriteCycles == 1 + sizeof(data));
+	CHECK(memcmp(&sim.eeprom[16], data, sizeof(data)) == 0);
+}
+
+static void testEEPROM() {
+	MCP79410Sim sim;
+	hostSetSim(&sim);
+	MCP79410 rtc(sim);
+	rtc.setup();
+
+	uint8_t data[128], check[128];
+	for(size_t ii = 0; ii < sizeof(data); ii++) {
+		data[ii] = (uint8_t)(ii * 13 + 1);
+	}
+
+	// Not aligned to a page, so this crosses page boundaries
+	sim.resetStats();
+	CHECK(rtc.eeprom().writeData(5, data, 40));
+	CHECK(sim.getStats().eepromWriteCycles == 6);
+	printStats("EEPROM write 40 bytes at 5", sim);
+
+	CHECK(rtc.eeprom().readData(5, check, 40));
+	printStats("EEPROM read 40 bytes", sim);
+	CHECK(memcmp(data, check, 40) == 0);
+	CHECK(memcmp(&sim.eeprom[5], data, 40) == 0);
+
+	// Block protection: writes to the upper quarter are ignored, so verify fails
+	CHECK(rtc.eeprom().setBlockProtection(MCP79410::EEPROM_PROTECT_UPPER_QUARTER));
+	CHECK(!rtc.eeprom().writeData(100, data, 4));
+	CHECK(rtc.eeprom().setBlockProtection(MCP79410::EEPROM_PROTECT_NONE));
+	CHECK(rtc.eeprom().writeData(100, data, 4));
+	sim.resetStats();
+
+	// Asynchronous writes complete from loop()
+	bool done = false, result = false;
+	CHECK(rtc.eeprom().writeDataAsync(64, data, 32, [&](bool success) { done = true; result = success; }));
+	for(int ii = 0; ii < 100 && !done; ii++) {
+		rtc.loop();
+		delay(1);
+	}
+	CHECK(done && result);
+	printStats("EEPROM async write 32 bytes", sim);
+	CHECK(memcmp(&sim.eeprom[64], data, 32) == 0);
+
+	testEEPROMAsyncRetry();
+}
+
+// Transport that calls a function right after the next read of both alarm flags, before they're cleared
+class RacingTransport : public MCP79410Transport {
+public:
+	RacingTransport(MCP79410Sim &sim) : sim(sim) {};
+
+	virtual int writeRead(uint8_t i2cAddr, const uint8_t *writeBuf, size_t writeLen, uint8_t *readBuf, size_t readLen) {
+		int stat = sim.writeRead(i2cAddr, writeBuf, writeLen, readBuf, readLen);
+		if (race && writeLen == 1 && writeBuf[0] == 0x0d && readLen == 8) {
+			std::function<void()> fn = race;
+			race = nullptr;
+			fn();
+		}
+		return stat;
+	}
+
+	virtual int writeSegments(uint8_t i2cAddr, const MCP79410TransportSegment *segments, size_t numSegments) {
+		return sim.writeSegments(i2cAddr, segments, numSegments);
+	}
+
+	MCP79410Sim &sim;
+	std::function<void()> race;
+};
+
+// Transport that fails writes that failWrite() returns true for
+class FailingTransport : public MCP79410Transport {
+public:
+	FailingTransport(MCP79410Sim &sim) : sim(sim) {};
+
+	virtual int writeRead(uint8_t i2cAddr, const uint8_t *writeBuf, size_t writeLen, uint8_t *readBuf, size_t readLen) {
+		return sim.writeRead(i2cAddr, writeBuf, writeLen, readBuf, readLen);
+	}
+
+	virtual int writeSegments(uint8_t i2cAddr, const MCP79410TransportSegment *segments, size_t numSegments) {
+		if (failWrite && numSegments == 2 && failWrite(segments[0].buf[0], segments[1].buf, segments[1].len)) {
+			failures++;
+			return STAT_DATA_NACK;
+		}
+		return sim.writeSegments(i2cAddr, segments, numSegments);
+	}
+
+	MCP79410Sim &sim;
+	std::function<bool(uint8_t addr, const uint8_t *buf, size_t len)> failWrite;
+	int failures = 0;
+};
+
+static void testAlarm() {
+	MCP79410Sim sim;
+	hostSetSim(&sim);
+	MCP79410 rtc(sim);
+	rtc.setup();
+	CHECK(rtc.setRTCTime(Time.now()));
+
+	sim.resetStats();
+	CHECK(rtc.setAlarm(10));
+	printStats("setAlarm(10)", sim);
+
+	delay(9500);
+	CHECK(!rtc.getInterrupt(0));
+	delay(1000);
+	CHECK(rtc.getInterrupt(0));
+	CHECK(sim.getMFP());
+	rtc.clearInterrupt(0);
+	CHECK(!rtc.getInterrupt(0));
+
+	// Alarm dispatch from a pin interrupt, including the other alarm going off while one is handled
+	int fired[2] = { 0, 0 };
+	MCP79410Sim sim2;
+	RacingTransport racing(sim2);
+	hostSetSim(&sim2, 8);
+	MCP79410 rtc2(racing);
+	rtc2.withAlarmInterrupt(8)
+		.withAlarmCallback(0, [&](int alarmNum) { fired[alarmNum]++; })
+		.withAlarmCallback(1, [&](int alarmNum) { fired[alarmNum]++; });
+	rtc2.setup();
+	CHECK(rtc2.setRTCTime(Time.now()));
+	MCP79410Time alarm0, alarm1;
+	alarm0.setAlarmSecond(30);
+	alarm1.setAlarmSecond(45);
+	CHECK(rtc2.setAlarm(alarm0, true, 0));
+	CHECK(rtc2.setAlarm(alarm1, true, 1));
+	for(int ii = 0; ii < 6000; ii++) {
+		if (ii == 100) {
+			// The next time alarm 0 is handled, alarm 1 goes off in between, so MFP never deasserts
+			racing.race = [&]() { sim2.regs[0x14] |= 0x08; }; // ALMIF in ALM1WKDAY
+		}
+		rtc2.loop();
+		delay(100);
+	}
+	CHECK(fired[0] == 10);
+	CHECK(fired[1] == 11);
+
+	// Clearing both flags only writes ALM0WKDAY and ALM1WKDAY, so alarm 1 set in between isn't reverted
+	sim2.regs[0x11] = 0x30; // ALM1SEC, both alarms at 30 seconds
+	racing.race = [&]() { sim2.regs[0x11] = 0x12; };
+	for(int ii = 0; ii < 600 && fired[0] == 10; ii++) {
+		rtc2.loop();
+		delay(100);
+	}
+	CHECK(sim2.regs[0x11] == 0x12);
+	CHECK((sim2.regs[0x0d] & 0x08) == 0 && (sim2.regs[0x14] & 0x08) == 0);
+	CHECK(fired[0] == 11);
+	CHECK(fired[1] == 12);
+}
+
+static void testAlarmTransactions() {
+	MCP79410Sim sim;
+	hostSetSim(&sim);
+	MCP79410 rtc(sim);
+	rtc.setup();
+	CHECK(rtc.setRTCTime(Time.now()));
+
+	// One read for the time, OSCRUN, and control, one 6-byte alarm write that also clears ALMxIF, and a
+	// control write to enable the alarm, which is skipped if it's already enabled
+	MCP79410Time time;
+	time.setAlarmSecond(30);
+	sim.resetStats();
+	CHECK(rtc.setAlarm(time, true, 0));
+	CHECK(sim.getStats().transactions == 3);
+	printStats("setAlarm(time), not enabled", sim);
+	CHECK(rtc.setAlarm(time, true, 0));
+	CHECK(sim.getStats().transactions == 2);
+	printStats("setAlarm(time), already enabled", sim);
+
+	CHECK(rtc.setAlarm(60, true, 1));
+	CHECK(sim.getStats().transactions == 3);
+	printStats("setAlarm(seconds), not enabled", sim);
+	CHECK(rtc.setAlarm(60, true, 1));
+	CHECK(sim.getStats().transactions == 2);
+	printStats("setAlarm(seconds), already enabled", sim);
+
+	CHECK(rtc.clearAlarm(0));
+	sim.resetStats();
+	CHECK(rtc.setAlarm(MCP79410Schedule::every(900), true, 0));
+	CHECK(sim.getStats().transactions == 3);
+	printStats("setAlarm(schedule), not enabled", sim);
+	CHECK(rtc.setAlarm(MCP79410Schedule::every(900), true, 0));
+	CHECK(sim.getStats().transactions == 2);
+	printStats("setAlarm(schedule), already enabled", sim);
+}
+
+static void testSetFromCloud() {
+	MCP79410Sim sim;
+	hostSetSim(&sim);
+
+	// Start the oscillator 0.3 seconds out of phase with the system clock
+	sim.advanceTime(300000);
+	sim.regs[0x00] = 0x80;
+	sim.advanceTime(2000000);
+
+	MCP79410 rtc(sim);
+	rtc.setup();
+	delay(456);
+	CHECK(rtc.setRTCFromCloud());
+
+	uint8_t sec = sim.regs[0x00];
+	while(sim.regs[0x00] == sec) {
+		sim.advanceTime(100);
+	}
+	uint32_t phaseUs = (uint32_t)(sim.getTimeUs() % 1000000);
+	printf("%-36s %4lu us after the system second\n", "setRTCFromCloud() RTC rollover", (unsigned long)phaseUs);
+	CHECK(phaseUs < 5000);
+}
+
+static void testSetFromCloudFailure() {
+	MCP79410Sim sim;
+	FailingTransport failing(sim);
+	hostSetSim(&sim);
+	sim.regs[0x00] = 0x80;
+	sim.advanceTime(2000000);
+
+	MCP79410 rtc(failing);
+	rtc.setup();
+	CHECK(rtc.setRTCTime(Time.now()));
+
+	// If writing the time fails, the oscillator is not left stopped
+	failing.failWrite = [](uint8_t addr, const uint8_t *, size_t len) { return addr == 0x00 && len == 7; };
+	CHECK(!rtc.setRTCFromCloud());
+	CHECK(failing.failures == 1);
+	CHECK((sim.regs[0x00] & 0x80) != 0);
+	delay(100);
+	CHECK(rtc.getOscillatorRunning());
+	failing.failWrite = nullptr;
+
+	// If the system clock second doesn't change, the current time is written without aligning
+	Time.stopped = Time.now() + 3600;
+	unsigned long startMs = millis();
+	CHECK(rtc.setRTCFromCloud());
+	CHECK(millis() - startMs < 1200);
+	CHECK(rtc.getRTCTime() == Time.stopped);
+	Time.stopped = 0;
+	CHECK(rtc.setRTCFromCloud());
+}
+
+static void testSquareWave() {
+	MCP79410Sim sim;
+	sim.withCrystalErrorPpm(20);
+	hostSetSim(&sim);
+	MCP79410 rtc(sim);
+	rtc.setup();
+
+	// 2 seconds before the minute rollover, a 3 second gate first waits for the rollover
+	CHECK(rtc.setRTCTime(Time.now() - (Time.now() % 60) + 58));
+	MCP79410SquareWaveResult result;
+	unsigned long startMs = millis();
+	CHECK(rtc.measureSquareWave(8, MCP79410::SQUARE_WAVE_1_HZ, 3000, result));
+	unsigned long elapsedMs = millis() - startMs;
+	CHECK(elapsedMs > 4000 && elapsedMs <= 2 * 3000 + 1000);
+	CHECK(result.errorPpm > 19.0f && result.errorPpm < 21.0f);
+	printf("%-36s %4lu ms\n", "measureSquareWave() 3 s at :58", elapsedMs);
+
+	// Early in the minute it doesn't wait
+	startMs = millis();
+	CHECK(rtc.measureSquareWave(8, MCP79410::SQUARE_WAVE_1_HZ, 3000, result));
+	CHECK(millis() - startMs < 3100);
+	CHECK(!rtc.measureSquareWave(8, MCP79410::SQUARE_WAVE_8192_HZ, 3000, result));
+}
+
+static void testSchedule() {
+	CHECK(MCP79410Schedule::everyDay(23, 59, 59).isValid());
+	CHECK(!MCP79410Schedule::everyDay(24).isValid());
+	CHECK(!MCP79410Schedule::everyDay(2, 60).isValid());
+	CHECK(!MCP79410Schedule::everyHour(30, -1).isValid());
+	CHECK(!MCP79410Schedule::everyMinute(60).isValid());
+	CHECK(!MCP79410Schedule::everyWeek(1, 0, 0, 60).isValid());
+	CHECK(!MCP79410Schedule::everyMonth(1, 25).isValid());
+	CHECK(MCP79410Schedule::everyMonth(31, 12).isValid());
+
+	MCP79410Sim sim;
+	hostSetSim(&sim);
+	MCP79410 rtc(sim);
+	rtc.setup();
+	CHECK(rtc.setRTCTime(Time.now()));
+	CHECK(!rtc.setAlarm(MCP79410Schedule::everyDay(24)));
+
+	// Polling: loop() doesn't set the next occurrence (which would clear ALMxIF) until clearInterrupt()
+	MCP79410Schedule schedule = MCP79410Schedule::every(90);
+	CHECK(!schedule.isNative());
+	CHECK(rtc.setAlarm(schedule));
+	time_t next;
+	CHECK(rtc.getNextAlarmTime(0, next));
+	CHECK(next == schedule.nextAfter(Time.now()));
+	while(Time.now() < next + 5) {
+		rtc.loop();
+		delay(100);
+	}
+	CHECK(rtc.getInterrupt(0));
+	sim.resetStats();
+	for(int ii = 0; ii < 600; ii++) {
+		rtc.loop();
+		delay(100);
+	}
+	CHECK(sim.getStats().transactions == 0);
+	CHECK(rtc.getInterrupt(0));
+	rtc.clearInterrupt(0);
+	CHECK(!rtc.getInterrupt(0));
+	time_t following;
+	CHECK(rtc.getNextAlarmTime(0, following));
+	CHECK(following == schedule.nextAfter(Time.now()) && following > next);
+
+	// Long intervals: loop() checks the RTC once a day (ALARM_SCHEDULE_MAX_WAIT_SEC) while waiting,
+	// and the alarm goes off on time
+	schedule = MCP79410Schedule::every(60 * 86400);
+	CHECK(rtc.setAlarm(schedule));
+	CHECK(rtc.getNextAlarmTime(0, next));
+	CHECK(next == schedule.nextAfter(Time.now()));
+	sim.resetStats();
+	while(Time.now() < next - 120) {
+		rtc.loop();
+		delay(60000);
+	}
+	CHECK(sim.getStats().transactions <= 61);
+	CHECK(!rtc.getInterrupt(0));
+	delay((next - Time.now() + 5) * 1000);
+	rtc.loop();
+	CHECK(rtc.getInterrupt(0));
+	rtc.clearInterrupt(0);
+	CHECK(rtc.getNextAlarmTime(0, following));
+	CHECK(following == next + 60 * 86400);
+
+	// More than ALARM_SCHEDULE_MAX_ARM_SEC away, the alarm isn't enabled until it's close enough, because
+	// it would match the same date earlier
+	schedule = MCP79410Schedule::every(400 * 86400);
+	CHECK(rtc.setAlarm(schedule));
+	next = schedule.nextAfter(Time.now());
+	if (next - Time.now() > 300 * 86400) {
+		CHECK(!rtc.getNextAlarmTime(0, following));
+		while(Time.now() < next - 299 * 86400) {
+			rtc.loop();
+			delay(3600000);
+		}
+	}
+	CHECK(rtc.getNextAlarmTime(0, following));
+	CHECK(following == next);
+
+	// With the alarm interrupt, each occurrence is set after the callback's flag is cleared
+	MCP79410Sim sim2;
+	hostSetSim(&sim2);
+	int fired = 0;
+	MCP79410 rtc2(sim2);
+	rtc2.withAlarmInterrupt(8).withAlarmCallback(1, [&](int) { fired++; });
+	rtc2.setup();
+	CHECK(rtc2.setRTCTime(Time.now()));
+	CHECK(rtc2.setAlarm(MCP79410Schedule::every(90), true, 1));
+	for(int ii = 0; ii < 9000; ii++) {
+		rtc2.loop();
+		delay(100);
+	}
+	CHECK(fired == 10);
+}
+
+// Calls loop() of both objects every 100 ms for the given number of seconds
+static void schedulerRun(MCP79410 &rtc, MCP79410AlarmScheduler &scheduler, int seconds) {
+	for(int ii = 0; ii < seconds * 10; ii++) {
+		rtc.loop();
+		scheduler.loop();
+		delay(100);
+	}
+}
+
+static void testScheduler() {
+	MCP79410Sim sim;
+	hostSetSim(&sim);
+	MCP79410 rtc(sim);
+	rtc.setup();
+	CHECK(rtc.setRTCTime(Time.now()));
+
+	MCP79410AlarmScheduler scheduler(rtc);
+	scheduler.withSRAM(0).setup();
+
+	// Heap ordering: timers fire in deadline order regardless of the order they're added, and the earliest
+	// is always the one armed
+	std::vector<std::string> order;
+	auto record = [&](const char *name) { order.push_back(name); };
+	time_t start = Time.now();
+	CHECK(scheduler.addOneShotAt("c", start + 30, record));
+	CHECK(scheduler.addOneShotAt("a", start + 10, record));
+	CHECK(scheduler.addOneShotAt("d", start + 40, record));
+	CHECK(scheduler.addOneShotAt("b", start + 20, record));
+	CHECK(scheduler.getCount() == 4);
+	CHECK(scheduler.getNextDeadline() == start + 10);
+	time_t next;
+	CHECK(rtc.getNextAlarmTime(0, next) && next == start + 10);
+
+	// Without the alarm interrupt, loop() only reads the alarm flag, once per second
+	schedulerRun(rtc, scheduler, 5);
+	sim.resetStats();
+	schedulerRun(rtc, scheduler, 4);
+	CHECK(sim.getStats().transactions <= 5);
+
+	schedulerRun(rtc, scheduler, 40);
+	CHECK(order.size() == 4);
+	if (order.size() == 4) {
+		CHECK(order[0] == "a" && order[1] == "b" && order[2] == "c" && order[3] == "d");
+	}
+	CHECK(scheduler.getCount() == 0);
+
+	// Names with the same hash are different timers
+	CHECK(MCP79410AlarmScheduler::nameHash("costarring") == MCP79410AlarmScheduler::nameHash("liquid"));
+	start = Time.now();
+	CHECK(scheduler.addOneShotAt("costarring", start + 100, record));
+	CHECK(scheduler.addOneShotAt("liquid", start + 200, record));
+	CHECK(scheduler.getCount() == 2);
+	CHECK(scheduler.getNextTime("costarring") == start + 100);
+	CHECK(scheduler.getNextTime("liquid") == start + 200);
+	CHECK(scheduler.cancel("liquid"));
+	CHECK(scheduler.getNextTime("costarring") == start + 100);
+	CHECK(scheduler.cancel("costarring"));
+
+	// Periodic catch-up: after missing several periods, the callback is called once and the timer stays
+	// aligned to its first time
+	int periodic = 0;
+	start = Time.now();
+	CHECK(scheduler.addPeriodic("p", 60, [&](const char *) { periodic++; }, start + 60));
+	delay(60 * 5500);
+	schedulerRun(rtc, scheduler, 2);
+	CHECK(periodic == 1);
+	CHECK(scheduler.getNextTime("p") == start + 6 * 60);
+	CHECK(rtc.getNextAlarmTime(0, next) && next == start + 6 * 60);
+
+	// Cancel from inside a callback, both the timer itself and another one that's due but not called yet
+	CHECK(scheduler.addPeriodic("p", 60, [&](const char *) { periodic++; scheduler.cancel("p"); }));
+	schedulerRun(rtc, scheduler, 180);
+	CHECK(periodic == 2);
+	CHECK(scheduler.getCount() == 0);
+
+	order.clear();
+	start = Time.now();
+	CHECK(scheduler.addOneShotAt("x", start + 10, [&](const char *name) { order.push_back(name); CHECK(scheduler.cancel("y")); }));
+	CHECK(scheduler.addOneShotAt("y", start + 20, record));
+	delay(30000);
+	schedulerRun(rtc, scheduler, 2);
+	CHECK(order.size() == 1 && order[0] == "x");
+	CHECK(scheduler.getCount() == 0);
+
+	// SRAM persist and restore, as after a reset or SLEEP_MODE_DEEP
+	start = Time.now();
+	CHECK(scheduler.addPeriodic("hourly", 3600, record, start + 3600));
+	CHECK(scheduler.addOneShotAt("once", start + 1800, record));
+	{
+		MCP79410 rtc2(sim);
+		rtc2.setup();
+		MCP79410AlarmScheduler scheduler2(rtc2);
+		scheduler2.withSRAM(0).setup();
+		CHECK(scheduler2.getCount() == 2);
+		CHECK(scheduler2.getNextTime("hourly") == start + 3600);
+		CHECK(scheduler2.getNextTime("once") == start + 1800);
+
+		// Adding the timer again with the same period keeps its deadline
+		order.clear();
+		CHECK(scheduler2.addPeriodic("hourly", 3600, record));
+		CHECK(scheduler2.getNextTime("hourly") == start + 3600);
+		CHECK(scheduler2.getCount() == 2);
+
+		// The restored one-shot was not added again, so it fires without a callback
+		delay(3700 * 1000);
+		schedulerRun(rtc2, scheduler2, 2);
+		CHECK(order.size() == 1 && order[0] == "hourly");
+		CHECK(scheduler2.getCount() == 1);
+		CHECK(scheduler2.getNextTime("hourly") == start + 7200);
+		CHECK(scheduler2.cancel("hourly"));
+	}
+	CHECK(scheduler.cancel("hourly"));
+	CHECK(scheduler.cancel("once"));
+
+	// More than MAX_ARM_SECONDS away, the alarm is armed in steps because it does not compare the year
+	order.clear();
+	start = Time.now();
+	time_t far = start + 400 * 86400;
+	CHECK(scheduler.addOneShotAt("far", far, record));
+	CHECK(rtc.getNextAlarmTime(0, next) && next == start + (time_t)MCP79410AlarmScheduler::MAX_ARM_SECONDS);
+	while(Time.now() < far - 2 * 86400) {
+		rtc.loop();
+		scheduler.loop();
+		delay(86400 * 1000);
+	}
+	CHECK(order.empty());
+	CHECK(rtc.getNextAlarmTime(0, next) && next == far);
+	while(order.empty() && Time.now() < far + 10) {
+		rtc.loop();
+		scheduler.loop();
+		delay(100);
+	}
+	CHECK(order.size() == 1 && Time.now() >= far && Time.now() <= far + 2);
+
+	// With the alarm interrupt, there's no I2C traffic between timers
+	MCP79410Sim sim2;
+	hostSetSim(&sim2);
+	MCP79410 rtc2(sim2);
+	rtc2.withAlarmInterrupt(8);
+	rtc2.setup();
+	CHECK(rtc2.setRTCTime(Time.now()));
+	MCP79410AlarmScheduler scheduler2(rtc2);
+	scheduler2.setup();
+
+	int fired = 0;
+	start = Time.now();
+	CHECK(scheduler2.addPeriodic("p", 30, [&](const char *) { fired++; }, start + 30));
+	schedulerRun(rtc2, scheduler2, 5);
+	sim2.resetStats();
+	schedulerRun(rtc2, scheduler2, 20);
+	CHECK(sim2.getStats().transactions == 0);
+	schedulerRun(rtc2, scheduler2, 100);
+	CHECK(fired == 4);
+}
+
+static void testRTCTimeMs() {
+	MCP79410Sim sim;
+	sim.withCrystalErrorPpm(50);
+	hostSetSim(&sim);
+	MCP79410 rtc(sim);
+	rtc.withRTCTimeMs(true, 60000).setup();
+	CHECK(rtc.setRTCTime(Time.now()));
+	CHECK(!rtc.hasRTCTimeMsAnchor());
+	CHECK(rtc.getRTCTimeMs() == 0);
+
+	// The anchor is found by loop() within a couple of seconds, without blocking for long
+	unsigned long maxLoopUs = 0;
+	for(int ii = 0; ii < 3000 && !rtc.hasRTCTimeMsAnchor(); ii++) {
+		unsigned long start = micros();
+		rtc.loop();
+		unsigned long elapsed = micros() - start;
+		if (elapsed > maxLoopUs) {
+			maxLoopUs = elapsed;
+		}
+		sim.advanceTime(1000);
+	}
+	CHECK(rtc.hasRTCTimeMsAnchor());
+	CHECK(maxLoopUs < 70000);
+
+	// getRTCTimeMs() doesn't access the bus
+	sim.resetStats();
+	uint64_t ms = rtc.getRTCTimeMs();
+	CHECK(sim.getStats().transactions == 0);
+	CHECK(ms / 1000 == (uint64_t)rtc.getRTCTime());
+
+	// At each seconds rollover of the RTC, getRTCTimeMs() is on a whole second. Once the drift between
+	// millis() and the 50 ppm crystal has been measured, it stays within a few milliseconds.
+	uint8_t lastSec = sim.regs[0x00];
+	long maxErrMs = 0;
+	for(long ii = 0; ii < 20 * 60 * 1000L; ii++) {
+		rtc.loop();
+		sim.advanceTime(1000);
+		if (sim.regs[0x00] != lastSec) {
+			lastSec = sim.regs[0x00];
+			CHECK(rtc.hasRTCTimeMsAnchor());
+			if (rtc.getAnchorDriftPpm() != 0) {
+				long errMs = (long)(rtc.getRTCTimeMs() % 1000);
+				if (errMs > 500) {
+					errMs -= 1000;
+				}
+				if (labs(errMs) > maxErrMs) {
+					maxErrMs = labs(errMs);
+				}
+			}
+		}
+	}
+	CHECK(rtc.getAnchorDriftPpm() > 45 && rtc.getAnchorDriftPpm() < 55);
+	CHECK(maxErrMs <= 3);
+	CHECK(labs(rtc.getLastAnchorOffsetMs()) <= 3);
+
+	// syncRTCTimeMs() sets the anchor right away, blocking until the rollover
+	MCP79410Sim sim2;
+	hostSetSim(&sim2);
+	MCP79410 rtc2(sim2);
+	rtc2.setup();
+	CHECK(!rtc2.syncRTCTimeMs());
+	CHECK(rtc2.setRTCTime(Time.now()));
+	delay(250);
+	CHECK(rtc2.syncRTCTimeMs());
+	CHECK(rtc2.hasRTCTimeMsAnchor());
+	CHECK(rtc2.getRTCTimeMs() % 1000 <= 2);
+}
+
+static void testCachedClock() {
+	MCP79410Sim sim;
+	sim.withCrystalErrorPpm(-30);
+	hostSetSim(&sim);
+	MCP79410 rtc(sim);
+	rtc.withCachedClock(true, 100).setup();
+	CHECK(rtc.setRTCTime(Time.now()));
+
+	// Until there's an anchor, getRTCTime() reads the RTC
+	sim.resetStats();
+	CHECK(rtc.getRTCTime() != 0);
+	CHECK(sim.getStats().transactions == 1);
+
+	for(int ii = 0; ii < 3000 && !rtc.hasRTCTimeMsAnchor(); ii++) {
+		rtc.loop();
+		sim.advanceTime(1000);
+	}
+	CHECK(rtc.hasRTCTimeMsAnchor());
+
+	// For an hour, getRTCTime() in the middle of each RTC second returns the RTC time without reading it,
+	// except for the occasional resync from loop()
+	MCP79410Time time;
+	uint8_t lastSec = sim.regs[0x00];
+	long lastRollover = 0, calls = 0, mismatches = 0;
+	sim.resetStats();
+	for(long ii = 0; ii < 3600 * 1000L; ii++) {
+		rtc.loop();
+		sim.advanceTime(1000);
+		if (sim.regs[0x00] != lastSec) {
+			lastSec = sim.regs[0x00];
+			lastRollover = ii;
+		}
+		if (ii - lastRollover == 500) {
+			time.fromUnixTime(rtc.getRTCTime());
+			if (time.getSecond() != MCP79410Time::bcdToInt(sim.regs[0x00] & 0x7f)) {
+				mismatches++;
+			}
+			calls++;
+		}
+	}
+	CHECK(calls > 3500);
+	CHECK(mismatches == 0);
+	CHECK(sim.getStats().transactions < 1000);
+
+	// isRTCValid() and getRTCTime(MCP79410Time &) always read the RTC
+	sim.resetStats();
+	CHECK(rtc.isRTCValid());
+	CHECK(rtc.getRTCTime(time));
+	CHECK(sim.getStats().transactions == 2);
+
+	// When the possible error would exceed the bound and loop() hasn't resynced yet, getRTCTime() reads
+	// the RTC again
+	MCP79410Sim sim2;
+	hostSetSim(&sim2);
+	MCP79410 rtc2(sim2);
+	rtc2.withCachedClock(true, 5).setup();
+	CHECK(rtc2.setRTCTime(Time.now()));
+	CHECK(rtc2.syncRTCTimeMs());
+	sim2.resetStats();
+	CHECK(rtc2.getRTCTime() == Time.now());
+	CHECK(sim2.getStats().transactions == 0);
+	delay(60000);
+	CHECK(rtc2.getRTCTime() == Time.now());
+	CHECK(sim2.getStats().transactions == 1);
+}
+
+// Runs loop() for a few seconds, simulates a cloud time sync, and runs loop() for a few more seconds, after
+// waiting until hours after the previous sync. Between syncs, loop() isn't called.
+static void cloudSyncAfter(MCP79410 &rtc, double hours) {
+	delay((unsigned long)(hours * 3600000) - 6000);
+	for(int ii = 0; ii < 3000; ii++) {
+		rtc.loop();
+		delay(1);
+	}
+	Particle.syncedLast++;
+	for(int ii = 0; ii < 3000; ii++) {
+		rtc.loop();
+		delay(1);
+	}
+}
+
+static void testResync() {
+	// With the anchor, the error at each sync is measured to the millisecond and the RTC is only rewritten
+	// when it's more than the threshold off. The 120 ppm crystal gains 432 ms per hour.
+	MCP79410Sim sim;
+	sim.withCrystalErrorPpm(120);
+	hostSetSim(&sim);
+	MCP79410 rtc(sim);
+	Particle.syncedLast = 0;
+	rtc.withRTCTimeMs(true, 60000).withResyncThreshold(500).setup();
+	cloudSyncAfter(rtc, 0.01);
+	CHECK(rtc.isRTCValid());
+	CHECK(rtc.getSyncErrorCount() == 0);
+	CHECK(rtc.hasSetPhaseError());
+	int32_t phaseMs = rtc.getLastSetPhaseErrorMs();
+
+	CHECK(labs(phaseMs) <= 2);
+
+	cloudSyncAfter(rtc, 1);
+	CHECK(rtc.getSyncErrorCount() == 1);
+	const MCP79410SyncError &first = rtc.getSyncError(0);
+	CHECK(first.precise && !first.corrected);
+	CHECK(first.errorMs >= 422 && first.errorMs <= 442);
+	CHECK(first.residualMs == first.errorMs);
+
+	cloudSyncAfter(rtc, 1);
+	CHECK(rtc.getSyncErrorCount() == 2);
+	const MCP79410SyncError &second = rtc.getSyncError(0);
+	CHECK(second.precise && second.corrected);
+	CHECK(second.errorMs >= 854 && second.errorMs <= 874);
+	CHECK(second.residualMs == 0);
+
+	cloudSyncAfter(rtc, 1);
+	CHECK(rtc.getSyncErrorCount() == 3);
+	CHECK(!rtc.getSyncError(0).corrected);
+	CHECK(rtc.getSyncError(0).errorMs >= 422 && rtc.getSyncError(0).errorMs <= 442);
+	CHECK(labs(rtc.getSyncError(2).errorMs - rtc.getSyncError(0).errorMs) <= 2);
+
+	// Without the anchor, the RTC is read in the middle of the system clock second, so the error is measured to
+	// the nearest second
+	MCP79410Sim sim2;
+	sim2.withCrystalErrorPpm(120);
+	hostSetSim(&sim2);
+	MCP79410 rtc2(sim2);
+	Particle.syncedLast = 0;
+	rtc2.withResyncThreshold(500).setup();
+	cloudSyncAfter(rtc2, 0.01);
+	CHECK(rtc2.isRTCValid());
+
+	cloudSyncAfter(rtc2, 1);
+	CHECK(rtc2.getSyncErrorCount() == 1);
+	CHECK(!rtc2.getSyncError(0).precise && !rtc2.getSyncError(0).corrected && rtc2.getSyncError(0).errorMs == 0);
+
+	cloudSyncAfter(rtc2, 1);
+	CHECK(rtc2.getSyncErrorCount() == 2);
+	CHECK(!rtc2.getSyncError(0).precise && rtc2.getSyncError(0).corrected && rtc2.getSyncError(0).errorMs == 1000);
+
+	// A threshold of 0 only sets the RTC at the first sync
+	MCP79410Sim sim3;
+	hostSetSim(&sim3);
+	MCP79410 rtc3(sim3);
+	Particle.syncedLast = 0;
+	rtc3.withResyncThreshold(0).setup();
+	cloudSyncAfter(rtc3, 0.01);
+	CHECK(rtc3.isRTCValid());
+	sim3.resetStats();
+	cloudSyncAfter(rtc3, 1);
+	CHECK(rtc3.getSyncErrorCount() == 0);
+	CHECK(sim3.getStats().transactions == 0);
+
+	Particle.syncedLast = 0;
+}
+
+static void testOscTrim() {
+	MCP79410Sim sim;
+	sim.withCrystalErrorPpm(60);
+	hostSetSim(&sim);
+	MCP79410 rtc(sim);
+	rtc.setup();
+
+	// Signed trim values round trip through the sign and magnitude OSCTRIM register
+	CHECK(rtc.setOscTrim(-5));
+	CHECK(sim.regs[0x08] == 0x05);
+	CHECK(rtc.getOscTrim() == -5);
+	CHECK(rtc.setOscTrim(100));
+	CHECK(sim.regs[0x08] == 0x80 + 100);
+	CHECK(rtc.getOscTrim() == 100);
+
+	// Each step is about 1.017 ppm, and a fast RTC gets a lower trim
+	CHECK(rtc.setOscTrim(0));
+	CHECK(rtc.calibrateOscTrim(60));
+	CHECK(rtc.getOscTrim() == -59);
+	CHECK(rtc.calibrateOscTrim(-2));
+	CHECK(rtc.getOscTrim() == -57);
+	CHECK(rtc.calibrateOscTrim(-500));
+	CHECK(rtc.getOscTrim() == 127);
+	CHECK(rtc.setOscTrim(0));
+
+	// Automatic calibration from 6-hourly cloud time syncs. With the anchor, the error at each sync is
+	// precise, so the 60 ppm error is known well enough to adjust the trim after about 1.5 days, even though
+	// the RTC is rewritten at each sync in between.
+	MCP79410Sim sim2;
+	sim2.withCrystalErrorPpm(60);
+	hostSetSim(&sim2);
+	Particle.syncedLast = 0;
+	MCP79410 rtc2(sim2);
+	rtc2.withOscTrimCalibration(true, 120).withRTCTimeMs(true, 60000).setup();
+	cloudSyncAfter(rtc2, 0.01);
+	CHECK(rtc2.isRTCValid());
+
+	for(int ii = 0; ii < 8 && rtc2.getOscTrim() == 0; ii++) {
+		cloudSyncAfter(rtc2, 6);
+		CHECK(rtc2.getSyncError(0).corrected);
+	}
+	CHECK(rtc2.getOscTrim() >= -60 && rtc2.getOscTrim() <= -58);
+	CHECK(rtc2.getLastOscTrimCalibrationPpm() > 59 && rtc2.getLastOscTrimCalibrationPpm() < 61);
+	CHECK(sim2.eeprom[120] == MCP79410::OSC_TRIM_EEPROM_MAGIC && (int8_t)sim2.eeprom[121] == rtc2.getOscTrim());
+
+	// With the new trim, the RTC keeps time to within a few ms over 6 hours
+	cloudSyncAfter(rtc2, 6);
+	CHECK(labs(rtc2.getSyncError(0).errorMs) < 30);
+	CHECK(!rtc2.getSyncError(0).corrected);
+
+	// setup() restores the trim from EEPROM if the RTC lost it
+	int8_t trim = rtc2.getOscTrim();
+	sim2.regs[0x08] = 0;
+	MCP79410 rtc3(sim2);
+	rtc3.withOscTrimCalibration(true, 120).setup();
+	CHECK(rtc3.getOscTrim() == trim);
+
+	Particle.syncedLast = 0;
+}
+
+// Brute force for testNextAlarmTime(): the first boundary of unit seconds after after where the alarm
+// condition becomes true
+static time_t nextAlarmBruteForce(int mode, int value, time_t after, time_t unit) {
+	auto matches = [&](time_t t) {
+		struct tm tm;
+		gmtime_r(&t, &tm);
+		switch(mode) {
+			case 0: return tm.tm_sec == value;
+			case 1: return tm.tm_min == value;
+			case 2: return tm.tm_hour == value;
+			case 3: return tm.tm_wday == value;
+			default: return tm.tm_mday == value;
+		}
+	};
+	for(time_t t = (after / unit + 1) * unit; t < after + 100 * 86400; t += unit) {
+		if (matches(t) && !matches(t - 1)) {
+			return t;
+		}
+	}
+	return 0;
+}
+
+static void testNextAlarmTime() {
+	// Each masked alarm mode against a brute force search, at pseudo-random times from 2000 to 2099
+	static const time_t units[5] = { 1, 60, 3600, 86400, 86400 };
+	static const int ranges[5] = { 60, 60, 24, 7, 31 };
+	uint32_t seed = 12345;
+	for(int ii = 0; ii < 500; ii++) {
+		seed = seed * 1103515245 + 12345;
+		time_t after = 946684800 + (time_t)(seed % (3155760000UL - 100 * 86400));
+		seed = seed * 1103515245 + 12345;
+		int mode = (int)((seed >> 8) % 5);
+		int value = (int)((seed >> 16) % ranges[mode]) + (mode == 4 ? 1 : 0);
+
+		MCP79410Time alarm;
+		switch(mode) {
+			case 0: alarm.setAlarmSecond(value); break;
+			case 1: alarm.setAlarmMinute(value); break;
+			case 2: alarm.setAlarmHour(value); break;
+			case 3: alarm.setAlarmDayOfWeek(value); break;
+			default: alarm.setAlarmDayOfMonth(value); break;
+		}
+		time_t next = 0;
+		bool result = alarm.getNextAlarmTime(after, next);
+		time_t expected = nextAlarmBruteForce(mode, value, after, units[mode]);
+		CHECK(result && next == expected);
+		if (!result || next != expected) {
+			printf("mode=%d value=%d after=%ld next=%ld expected=%ld\n", mode, value, (long)after, (long)next, (long)expected);
+			break;
+		}
+	}
+
+	// The result is strictly after the given time
+	MCP79410Time alarm;
+	alarm.setAlarmMinute(30);
+	time_t next;
+	CHECK(alarm.getNextAlarmTime(1767227400, next) && next == 1767227400 + 3600); // 2026-01-01 00:30:00
+
+	// Day 31 skips the months that don't have it
+	alarm.setAlarmDayOfMonth(31);
+	CHECK(alarm.getNextAlarmTime(1769904000, next) && next == 1774915200); // 2026-02-01 -> 2026-03-31
+
+	// Full date alarms don't compare the year, so February 29 at 12:00:00 on a Tuesday only matches in the
+	// leap years where it's a Tuesday: 2028, 2056, 2084, and never again before the RTC calendar ends
+	alarm.setAlarmTime(1835438400); // 2028-02-29 12:00:00, Tuesday
+	CHECK(alarm.getDayOfWeek() == 2);
+	CHECK(alarm.getNextAlarmTime(1767225600, next) && next == 1835438400);
+	CHECK(alarm.getNextAlarmTime(1835438400, next) && next == 2719051200);
+	CHECK(alarm.getNextAlarmTime(2719051200, next) && next == 3602664000);
+	CHECK(!alarm.getNextAlarmTime(3602707200, next)); // 2084-03-01
+
+	// Settings that can never match
+	alarm.setAlarmTime(1835438400);
+	alarm.setDayOfMonth(30);
+	CHECK(!alarm.getNextAlarmTime(1767225600, next));
+	alarm.setAlarmHour(24);
+	CHECK(!alarm.getNextAlarmTime(1767225600, next));
+
+	// From the chip, the time and alarm registers in one read
+	MCP79410Sim sim;
+	hostSetSim(&sim);
+	MCP79410 rtc(sim);
+	rtc.setup();
+	CHECK(!rtc.getNextAlarmTime(0, next));
+	CHECK(rtc.setRTCTime(Time.now()));
+	alarm.setAlarmTime(1835438400);
+	CHECK(rtc.setAlarm(alarm, true, 1));
+	sim.resetStats();
+	CHECK(rtc.getNextAlarmTime(1, next) && next == 1835438400);
+	CHECK(sim.getStats().transactions == 1);
+	CHECK(!rtc.getNextAlarmTime(0, next));
+}
+
+// Compares the fields of time to gmtime_r() of t
+static bool calendarMatches(const MCP79410Time &time, time_t t) {
+	struct tm tm;
+	gmtime_r(&t, &tm);
+	return time.getYear() == tm.tm_year + 1900 && time.getMonth() == tm.tm_mon + 1 && time.getDayOfMonth() == tm.tm_mday &&
+		time.getDayOfWeek() == tm.tm_wday && time.getHour() == tm.tm_hour && time.getMinute() == tm.tm_min &&
+		time.getSecond() == tm.tm_sec;
+}
+
+static void testCalendar() {
+	// fromUnixTime() and toUnixTime() don't depend on the time zone, so use one that's not UTC
+	setenv("TZ", "EST5EDT,M3.2.0,M11.1.0", 1);
+	tzset();
+
+	// The RTC only stores years 2000 to 2099. The step isn't a divisor of a minute, hour, or day, so every
+	// field takes all of its values.
+	long mismatches = 0;
+	for(time_t t = 946684800; t < 4102444800LL; t += 3607) {
+		MCP79410Time time;
+		time.fromUnixTime(t);
+		if (!calendarMatches(time, t) || time.toUnixTime() != t) {
+			if (mismatches++ == 0) {
+				printf("calendar mismatch at %ld\n", (long)t);
+			}
+		}
+	}
+	CHECK(mismatches == 0);
+
+	// Year, month, and day boundaries, including 2000 (leap, divisible by 400) and the end of 2099
+	static const time_t edges[] = { 946684800, 951782399, 951782400, 951868800, 1709164800, 1709251199, 1735689599, 4102444799LL };
+	for(size_t ii = 0; ii < sizeof(edges) / sizeof(edges[0]); ii++) {
+		MCP79410Time time;
+		time.fromUnixTime(edges[ii]);
+		CHECK(calendarMatches(time, edges[ii]));
+		CHECK(time.toUnixTime() == edges[ii]);
+	}
+
+	// daysFromCivil() and civilFromDays() are inverses, including before 1970
+	for(int32_t days = -800000; days <= 800000; days += 97) {
+		int year, month, dayOfMonth;
+		MCP79410Time::civilFromDays(days, year, month, dayOfMonth);
+		CHECK(MCP79410Time::daysFromCivil(year, month, dayOfMonth) == days);
+		if (MCP79410Time::daysFromCivil(year, month, dayOfMonth) != days) {
+			break;
+		}
+	}
+	static_assert(MCP79410Time::daysFromCivil(1970, 1, 1) == 0, "daysFromCivil epoch");
+	static_assert(MCP79410Time::daysFromCivil(2000, 3, 1) == 11017, "daysFromCivil 2000-03-01");
+
+	unsetenv("TZ");
+	tzset();
+}
+
+static void testBcdPacked() {
+	// Every value 0 - 99 in every byte lane, with different values in the other lanes
+	for(int value = 0; value < 100; value++) {
+		uint64_t binary = 0, bcd = 0;
+		for(int lane = 0; lane < 8; lane++) {
+			int laneValue = (value + lane * 37) % 100;
+			binary |= (uint64_t)laneValue << (lane * 8);
+			bcd |= (uint64_t)MCP79410Time::intToBcd(laneValue) << (lane * 8);
+			CHECK(MCP79410Time::bcdToInt(MCP79410Time::intToBcd(laneValue)) == laneValue);
+		}
+		CHECK(MCP79410Time::intToBcdPacked(binary) == bcd);
+		CHECK(MCP79410Time::bcdToIntPacked(bcd) == binary);
+	}
+
+	// Raw register fields round trip through the packed form, and the mode and status bits are kept
+	for(time_t t = 946684800; t < 4102444800LL; t += 86400 * 37 + 3607) {
+		MCP79410Time time;
+		time.fromUnixTime(t);
+		time.rawSecond |= 0x80;
+		time.rawDayOfWeek |= 0x38;
+
+		uint64_t packed = time.toRawPacked();
+		CHECK((packed >> 56) == 0);
+		CHECK((uint8_t)packed == time.rawSecond && (uint8_t)(packed >> 24) == time.rawDayOfWeek &&
+			(uint8_t)(packed >> 48) == time.rawYear);
+
+		MCP79410Time copy;
+		copy.fromRawPacked(packed);
+		CHECK(copy.toRawPacked() == packed);
+		CHECK(copy.toUnixTime() == t);
+		CHECK(copy.getOscillatorRunning() && copy.getPowerFail() && copy.getBatteryEnable());
+
+		// The mask leaves only the BCD digits, which convert to the binary fields
+		uint64_t binary = MCP79410Time::bcdToIntPacked(packed & MCP79410Time::RAW_PACKED_VALUE_MASK);
+		CHECK((int)(binary & 0xff) == time.getSecond() && (int)((binary >> 8) & 0xff) == time.getMinute() &&
+			(int)((binary >> 16) & 0xff) == time.getHour() && (int)((binary >> 32) & 0xff) == time.getDayOfMonth() &&
+			(int)((binary >> 40) & 0xff) == time.getMonth() && (int)((binary >> 48) & 0xff) + 2000 == time.getYear());
+	}
+}
+
+static void testCalendarArithmetic() {
+	// addSeconds(), addMinutes(), and addDays() work on the BCD fields directly. Compare them to converting
+	// through Unix time, at pseudo-random times and offsets in both directions, staying within 2000 - 2099.
+	uint32_t seed = 54321;
+	for(int ii = 0; ii < 20000; ii++) {
+		seed = seed * 1103515245 + 12345;
+		time_t t = 946684800 + 800 * 86400 + (time_t)(seed % (3155760000UL - 1600 * 86400));
+		seed = seed * 1103515245 + 12345;
+		int kind = (int)(seed % 3);
+		seed = seed * 1103515245 + 12345;
+		int32_t offset = (int32_t)(seed % 1500001) - 750000;
+
+		MCP79410Time time;
+		time.fromUnixTime(t);
+		MCP79410Time before = time;
+		time_t expected;
+		switch(kind) {
+			case 0:
+				time.addSeconds(offset * 97);
+				expected = t + (time_t)offset * 97;
+				break;
+			case 1:
+				time.addMinutes(offset);
+				expected = t + (time_t)offset * 60;
+				break;
+			default:
+				time.addDays(offset / 1000);
+				expected = t + (time_t)(offset / 1000) * 86400;
+				break;
+		}
+
+		MCP79410Time check;
+		check.fromUnixTime(expected);
+		bool ok = time.toUnixTime() == expected && time == check && time.getDayOfWeek() == check.getDayOfWeek() &&
+			time.difference(before) == expected - t && before.difference(time) == t - expected;
+		CHECK(ok);
+		if (!ok) {
+			printf("kind=%d t=%ld offset=%ld\n", kind, (long)t, (long)offset);
+			break;
+		}
+	}
+
+	// Across the leap day of 2000, a century year that's a leap year, in both directions
+	MCP79410Time time;
+	time.fromUnixTime(951782399); // 2000-02-28 23:59:59
+	time.addSeconds(1);
+	CHECK(time.getMonth() == 2 && time.getDayOfMonth() == 29 && time.getDayOfWeek() == 2);
+	time.addDays(1);
+	CHECK(time.getMonth() == 3 && time.getDayOfMonth() == 1);
+	time.addDays(365);
+	CHECK(time.getYear() == 2001 && time.getMonth() == 3 && time.getDayOfMonth() == 1);
+	time.addDays(-366);
+	CHECK(time.getYear() == 2000 && time.getMonth() == 2 && time.getDayOfMonth() == 29);
+}
+
+static void testRegisterSnapshot() {
+	MCP79410Sim sim;
+	hostSetSim(&sim);
+	MCP79410 rtc(sim);
+	rtc.setup();
+	CHECK(rtc.setRTCTime(Time.now()));
+	CHECK(rtc.setOscTrim(-12));
+
+	MCP79410Time alarm;
+	alarm.setAlarmMinute(45);
+	CHECK(rtc.setAlarm(alarm, true, 1));
+	sim.regs[0x14] |= 0x08; // ALMIF in ALM1WKDAY
+
+	// The whole register block is one transaction, and the accessors don't access the bus
+	MCP79410RegisterSnapshot snapshot;
+	sim.resetStats();
+	CHECK(rtc.readRegisterSnapshot(snapshot));
+	CHECK(sim.getStats().transactions == 1);
+	CHECK(sim.getStats().bytesRead == 32);
+	printStats("readRegisterSnapshot()", sim);
+
+	MCP79410Time time, snapshotAlarm;
+	CHECK(snapshot.getRTCTime(time));
+	CHECK(time.toUnixTime() == Time.now());
+	CHECK(snapshot.getOscillatorRunning() && snapshot.getBatteryEnable() && !snapshot.getPowerFail());
+	CHECK(!snapshot.getInterrupt(0) && snapshot.getInterrupt(1));
+	CHECK(!snapshot.getAlarmEnabled(0) && snapshot.getAlarmEnabled(1));
+	snapshot.getAlarm(1, snapshotAlarm);
+	CHECK(snapshotAlarm.alarmMode == alarm.ALARM_MINUTE && snapshotAlarm.getMinute() == 45);
+	CHECK(snapshot.getOscTrim() == -12);
+	CHECK(snapshot.getControl() == sim.regs[0x07]);
+	CHECK(sim.getStats().transactions == 0);
+
+	// Same results as the individual reads
+	CHECK(rtc.getInterrupt(1) == snapshot.getInterrupt(1));
+	CHECK(rtc.getOscTrim() == snapshot.getOscTrim());
+	CHECK(rtc.getBatteryEnable() == snapshot.getBatteryEnable());
+}
+
+static void testRegisterShadow() {
+	MCP79410Sim sim;
+	hostSetSim(&sim);
+	FailingTransport transport(sim);
+	MCP79410 rtc(transport);
+	rtc.withRegisterShadow().setup();
+	CHECK(rtc.setRTCTime(Time.now()));
+	rtc.invalidateRegisterShadow();
+
+	// The first read-modify-write of the control register reads it, after that it's a single write
+	sim.resetStats();
+	CHECK(rtc.deviceWriteRegisterFlag(0x07, 0x80, true) == 0); // OUT
+	CHECK(sim.getStats().transactions == 2);
+	printStats("control flag, shadow not valid", sim);
+	CHECK(rtc.deviceWriteRegisterFlag(0x07, 0x80, false) == 0);
+	CHECK(sim.getStats().transactions == 1);
+	printStats("control flag, shadow valid", sim);
+	CHECK((sim.regs[0x07] & 0x80) == 0);
+
+	// Writing OSCTRIM fills its shadow, so a read-modify-write after that is a single write
+	CHECK(rtc.setOscTrim(7));
+	sim.resetStats();
+	CHECK(rtc.deviceWriteRegisterByteMask(0x08, 0xff, 0x80) == 0);
+	CHECK(sim.getStats().transactions == 1);
+	CHECK(sim.regs[0x08] == 0x87);
+
+	// ALMxWKDAY: ALMIF is set by the hardware, so keeping it needs a read, but overwriting it doesn't
+	MCP79410Time alarm;
+	alarm.setAlarmSecond(30);
+	CHECK(rtc.setAlarm(alarm, true, 0));
+	sim.regs[0x0d] |= 0x08;
+	sim.resetStats();
+	CHECK(rtc.deviceWriteRegisterByteMask(0x0d, 0xff, 0x00) == 0);
+	CHECK(sim.getStats().transactions == 2);
+	CHECK((sim.regs[0x0d] & 0x08) != 0);
+	CHECK(rtc.deviceWriteRegisterFlag(0x0d, 0x08, false) == 0);
+	CHECK(sim.getStats().transactions == 3);
+	CHECK((sim.regs[0x0d] & 0x08) == 0);
+
+	// A failed write invalidates the shadow, because the chip may or may not have the new value. The next
+	// write reads the register again, so a change made by something else in between isn't lost.
+	transport.failWrite = [](uint8_t addr, const uint8_t *, size_t) { return addr == 0x07; };
+	CHECK(rtc.deviceWriteRegisterFlag(0x07, 0x80, true) != 0);
+	CHECK(transport.failures == 1);
+	transport.failWrite = nullptr;
+	sim.regs[0x07] |= 0x40; // SQWEN
+	sim.resetStats();
+	CHECK(rtc.deviceWriteRegisterFlag(0x07, 0x80, true) == 0);
+	CHECK(sim.getStats().transactions == 2);
+	CHECK((sim.regs[0x07] & 0xc0) == 0xc0);
+
+	// Without the shadow, every read-modify-write reads first
+	MCP79410 rtc2(sim);
+	rtc2.setup();
+	sim.resetStats();
+	CHECK(rtc2.deviceWriteRegisterFlag(0x07, 0x80, false) == 0);
+	CHECK(rtc2.deviceWriteRegisterFlag(0x07, 0x80, true) == 0);
+	CHECK(sim.getStats().transactions == 4);
+}
+
+static void testEEPROMDifferential() {
+	MCP79410Sim sim;
+	hostSetSim(&sim);
+	MCP79410 rtc(sim);
+	rtc.setup();
+	rtc.eeprom().withDifferentialWrite();
+
+	uint8_t data[32], check[32];
+	for(size_t ii = 0; ii < sizeof(data); ii++) {
+		data[ii] = (uint8_t)(ii * 11 + 5);
+	}
+
+	// The EEPROM starts out erased, so all 4 pages are written
+	sim.resetStats();
+	CHECK(rtc.eeprom().writeData(8, data, sizeof(data)));
+	CHECK(sim.getStats().eepromWriteCycles == 4);
+	CHECK(rtc.eeprom().getStats().writeCycles == 4 && rtc.eeprom().getStats().cyclesSaved == 0);
+	CHECK(memcmp(&sim.eeprom[8], data, sizeof(data)) == 0);
+
+	// Writing the same data again is a single read, with no write cycles
+	rtc.eeprom().resetStats();
+	sim.resetStats();
+	CHECK(rtc.eeprom().writeData(8, data, sizeof(data)));
+	CHECK(sim.getStats().transactions == 1);
+	CHECK(sim.getStats().eepromWriteCycles == 0);
+	CHECK(rtc.eeprom().getStats().cyclesSaved == 4 && rtc.eeprom().getStats().bytesSkipped == 32);
+	printStats("EEPROM differential, unchanged", sim);
+
+	// Changing two bytes in one page only writes the bytes from the first to the last changed one
+	data[18] ^= 0xff;
+	data[20] ^= 0xff;
+	rtc.eeprom().resetStats();
+	CHECK(rtc.eeprom().writeData(8, data, sizeof(data)));
+	CHECK(sim.getStats().eepromWriteCycles == 1);
+	CHECK(sim.getStats().eepromBytesWritten == 3);
+	CHECK(rtc.eeprom().getStats().writeCycles == 1 && rtc.eeprom().getStats().cyclesSaved == 3);
+	CHECK(rtc.eeprom().getStats().bytesSkipped == 29);
+	// One read, one write, the poll that's ACKed at the end of the write cycle, and the verify read. The
+	// other polls are NACKed while the write cycle is in progress.
+	CHECK(sim.getStats().transactions - sim.getStats().nacks == 4);
+	printStats("EEPROM differential, 2 bytes changed", sim);
+	CHECK(rtc.eeprom().readData(8, check, sizeof(check)));
+	CHECK(memcmp(check, data, sizeof(data)) == 0);
+
+	// Without differential mode, every page is written
+	rtc.eeprom().withDifferentialWrite(false);
+	sim.resetStats();
+	CHECK(rtc.eeprom().writeData(8, data, sizeof(data)));
+	CHECK(sim.getStats().eepromWriteCycles == 4);
+}
+
+int main() {
+	testSRAM();
+	testEEPROM();
+	testEEPROMDifferential();
+	testAlarm();
+	testAlarmTransactions();
+	testRegisterSnapshot();
+	testRegisterShadow();
+	testSetFromCloud();
+	testSetFromCloudFailure();
+	testSquareWave();
+	testRTCTimeMs();
+	testCachedClock();
+	testResync();
+	testOscTrim();
+	testNextAlarmTime();
+	testCalendar();
+	testBcdPacked();
+	testCalendarArithmetic();
+	testSchedule();
+	testScheduler();
+
+	if (failures) {
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+	printf("all checks passed\n");
+	return 0;
+}